@@ -0,0 +1,1720 @@
+// ------------------------------------------------------------
+// broker.c - broker pub/sub unificado: TCP, UDP y QUIC en un solo proceso
+//
+// Compilación:
+//   gcc -Wall -Wextra -O2 -pthread -o broker broker.c -I./quiche/quiche/include
+//       ./quiche/target/release/libquiche.a -lssl -lcrypto -ldl -lm -lrt   (una sola línea)
+//   Sin QUIC (no hace falta quiche):
+//   gcc -Wall -Wextra -O2 -pthread -DNO_QUIC -o broker broker.c
+// Ejecución:
+//   ./broker [-L nivel] [-l segundos] [-i id] [-P host:puerto]... <puerto_tcp> <puerto_udp>
+//            [<puerto_quic> <cert.pem> <key.pem>]
+//
+// Un solo índice de temas y una sola representación de la publicación para los tres
+// transportes: un PUB que llega por cualquiera de ellos se busca una vez en el índice,
+// se arma una vez ("<tema>: <texto>\n" y el texto solo) y se reparte en una pasada a
+// los suscriptores de todos los transportes. Cada transporte se ocupa solo de su encuadre:
+//   TCP : líneas, como broker_tcp. La primera línea es "SUB <tema>" (luego se admiten
+//         más SUB) o "PUB <tema>" seguida de líneas "MSG <texto>".
+//         Se reenvía "<tema>: <texto>\n".
+//   UDP : datagramas, como broker_udp en modo básico. "SUB <tema>" registra la dirección
+//         con una concesión que se renueva reenviando SUB (-l, 30 s por defecto);
+//         "PUB <tema> <texto>" publica. Se reenvía el texto solo.
+//   QUIC: líneas por stream, como broker_quic: "SUB <tema> [urgencia]" abre un stream
+//         unidireccional por tema; un stream con "PUB <tema>" publica con "MSG <texto>".
+//
+// Un hilo con epoll. Durante una ráfaga de eventos la salida solo se acumula; al final
+// cada conexión TCP con datos se vacía con un send() y los datagramas UDP y QUIC salen
+// con un sendmmsg() por socket.
+//
+// Federación (-P host:puerto_tcp, repetible): enlaces TCP con otros brokers. Cada broker
+// anuncia a sus pares los temas que le interesan (suscriptores locales o de otros pares)
+// y reenvía una publicación solo a los pares que la pidieron, así que la capacidad de
+// reparto crece agregando nodos sin más estado compartido que ese interés.
+// ------------------------------------------------------------
+#define _GNU_SOURCE         // recvmmsg(), sendmmsg() y struct mmsghdr.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef NO_QUIC
+#include <openssl/rand.h>
+#include <quiche.h>
+#endif
+
+#include "log_ring.h"
+
+#define MAX_LINE 4096
+#define TOPIC_MAX 128
+#define TOPIC_BUCKETS 1024
+#define BACKLOG 128
+#define LOG_RING_RECORDS 4096
+#define MAX_EVENTS 256
+#define RX_BATCH 32               // datagramas por recvmmsg()
+#define RX_BUF_SIZE 65536
+#define TX_MAX_MSGS 256           // datagramas por sendmmsg()
+#define TX_BUF_BYTES (1024 * 1024)
+#define TCP_OUT_MAX (4 * 1024 * 1024) // salida pendiente de un suscriptor TCP antes de cortarlo
+#define DEFAULT_LEASE_S 30
+#define SWEEP_MS 1000             // revisión de concesiones UDP vencidas
+#define PEER_ID_MAX 64
+#define PEER_MAX 16               // enlaces salientes (-P)
+#define PEER_LINKS_MAX 64         // enlaces en total (salientes y entrantes)
+#define PEER_MAX_HOPS 8
+#define PEER_RETRY_MS 1000        // reintento de un enlace saliente caído
+#define SEEN_SLOTS 4096           // (origen, seq) recientes, contra bucles
+#define LINE_BUF (MAX_LINE + TOPIC_MAX + PEER_ID_MAX + 48) // línea entrante más larga (FWD)
+
+#ifndef NO_QUIC
+#define MAX_DATAGRAM_SIZE 1350
+#define LOCAL_CONN_ID_LEN 16
+#define MAX_CONN_IDS 2
+#define INITIAL_CID_BUCKETS 256
+#define IDLE_TIMEOUT_MS 30000
+#define DEFAULT_URGENCY 3
+#define FIRST_SERVER_UNI 3
+#endif
+
+typedef enum { TR_TCP, TR_UDP, TR_QUIC, TR_PEER } Transport;
+
+// Identificadores de eventos de epoll: tipo en los 32 bits altos, fd en los bajos.
+enum { EV_TCP_LISTEN = 1, EV_TCP_CONN, EV_UDP, EV_QUIC };
+#define EV_KEY(kind, fd) (((uint64_t)(kind) << 32) | (uint32_t)(fd))
+
+// ---------------------------------------------------------------------------
+// Núcleo común: índice de temas
+// ---------------------------------------------------------------------------
+
+// Suscripción: transporte y destino. TCP, QUIC y los pares apuntan a su conexión (y QUIC
+// al stream del tema); UDP guarda la dirección y el vencimiento de la concesión.
+typedef struct {
+    uint8_t tr;
+    int conn;                     // TCP y pares: fd; QUIC: índice en la tabla de conexiones
+    uint64_t stream;              // QUIC: stream unidireccional del tema
+    struct sockaddr_in addr;      // UDP: destino
+    uint64_t expires_ms;          // UDP: vencimiento (0 = nunca)
+} Sub;
+
+// Interés en un tema de otro broker de la federación ("origen"), con la versión que le dio
+// ese broker y el enlace por el que llegó primero (hacia allí se reenvía).
+typedef struct {
+    char id[PEER_ID_MAX];
+    uint64_t ver;
+    int via;                      // fd del enlace (-1 = sin camino)
+    bool active;                  // false: retirado (se guarda la versión)
+} Origin;
+
+typedef struct Topic {
+    char name[TOPIC_MAX];
+    Sub *subs;
+    size_t nsubs, cap;
+    uint64_t published;
+    Origin *origins;              // federación: interés de otros brokers
+    size_t norigins, origins_cap;
+    bool local;                   // federación: último interés local anunciado
+    uint64_t local_ver;           // ... y su versión
+    struct Topic *next;
+} Topic;
+
+// Temas de una conexión (para darla de baja de todos al cerrarse).
+typedef struct {
+    Topic **items;
+    size_t n, cap;
+} TopicList;
+
+// Publicación ya analizada: se arma una vez y la comparten todos los transportes.
+typedef struct {
+    Topic *topic;
+    const char *text;             // texto tal cual (UDP)
+    size_t len;
+    char line[TOPIC_MAX + MAX_LINE + 4]; // "<tema>: <texto>\n" (TCP y QUIC)
+    size_t line_len;
+    char fwd[LINE_BUF];           // "FWD ..." (pares)
+    size_t fwd_len;
+} Msg;
+
+static Topic *topic_buckets[TOPIC_BUCKETS];
+static uint64_t lease_ms = DEFAULT_LEASE_S * 1000ull;
+static uint64_t stats_published = 0, stats_delivered[4] = {0}, stats_dup = 0;
+
+static uint64_t mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static uint32_t topic_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Busca un tema; si no existe y 'create', lo crea.
+static Topic *find_topic(const char *name, bool create) {
+    Topic **bucket = &topic_buckets[topic_hash(name) % TOPIC_BUCKETS];
+    for (Topic *t = *bucket; t; t = t->next) {
+        if (strcmp(t->name, name) == 0) return t;
+    }
+    if (!create) return NULL;
+    Topic *t = (Topic *)calloc(1, sizeof(Topic));
+    if (!t) return NULL;
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->next = *bucket;
+    *bucket = t;
+    log_info("[broker] Tema nuevo creado: '%s'\n", name);
+    return t;
+}
+
+static bool topic_list_add(TopicList *tl, Topic *t) {
+    if (tl->n == tl->cap) {
+        size_t ncap = tl->cap ? tl->cap * 2 : 4;
+        Topic **ni = (Topic **)realloc(tl->items, ncap * sizeof(Topic *));
+        if (!ni) return false;
+        tl->items = ni;
+        tl->cap = ncap;
+    }
+    tl->items[tl->n++] = t;
+    return true;
+}
+
+static bool topic_list_has(const TopicList *tl, const Topic *t) {
+    for (size_t i = 0; i < tl->n; i++) {
+        if (tl->items[i] == t) return true;
+    }
+    return false;
+}
+
+static void topic_list_remove(TopicList *tl, const Topic *t) {
+    for (size_t i = 0; i < tl->n; i++) {
+        if (tl->items[i] == t) {
+            tl->items[i] = tl->items[--tl->n];
+            return;
+        }
+    }
+}
+
+static Sub *topic_add_sub(Topic *t) {
+    if (t->nsubs == t->cap) {
+        size_t ncap = t->cap ? t->cap * 2 : 4;
+        Sub *ns = (Sub *)realloc(t->subs, ncap * sizeof(Sub));
+        if (!ns) return NULL;
+        t->subs = ns;
+        t->cap = ncap;
+    }
+    Sub *s = &t->subs[t->nsubs++];
+    memset(s, 0, sizeof(*s));
+    return s;
+}
+
+static void interest_update(Topic *t);
+
+static void topic_remove_sub(Topic *t, uint8_t tr, int conn) {
+    for (size_t k = 0; k < t->nsubs; k++) {
+        if (t->subs[k].tr == tr && t->subs[k].conn == conn) {
+            t->subs[k] = t->subs[--t->nsubs];
+            return;
+        }
+    }
+}
+
+// Quita de cada tema de 'tl' las suscripciones de la conexión (tr, conn) y libera la lista.
+static void unsubscribe_conn(TopicList *tl, uint8_t tr, int conn) {
+    for (size_t i = 0; i < tl->n; i++) {
+        topic_remove_sub(tl->items[i], tr, conn);
+        interest_update(tl->items[i]);
+    }
+    free(tl->items);
+    memset(tl, 0, sizeof(*tl));
+}
+
+// Separa "<cmd> <tema> [resto]" de una línea o datagrama (sin depender de un '\0' final).
+static void parse_command(const char *p, size_t len, char *cmd, char *topic,
+                          const char **rest, size_t *rest_len) {
+    const char *end = p + len;
+    size_t i = 0;
+    while (p < end && *p == ' ') p++;
+    while (p < end && *p != ' ' && i < 7) cmd[i++] = *p++;
+    cmd[i] = '\0';
+    while (p < end && *p != ' ') p++;
+    while (p < end && *p == ' ') p++;
+    i = 0;
+    while (p < end && *p != ' ' && *p != '\n' && *p != '\r' && i < TOPIC_MAX - 1) topic[i++] = *p++;
+    topic[i] = '\0';
+    if (p < end && *p == ' ') p++; // un único separador antes del resto
+    *rest = p;
+    *rest_len = (size_t)(end - p);
+}
+
+// ---------------------------------------------------------------------------
+// Salida UDP por lotes (la usan el transporte UDP y el QUIC, cada uno con su socket)
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int fd;
+    size_t n, used;
+    struct sockaddr_storage to[TX_MAX_MSGS];
+    socklen_t to_len[TX_MAX_MSGS];
+    size_t off[TX_MAX_MSGS], len[TX_MAX_MSGS];
+    uint8_t buf[TX_BUF_BYTES];
+    uint64_t calls, datagrams;    // estadísticas
+} UdpTx;
+
+static void udptx_flush(UdpTx *tx) {
+    if (tx->n == 0) return;
+    struct mmsghdr mm[TX_MAX_MSGS];
+    struct iovec iov[TX_MAX_MSGS];
+    memset(mm, 0, sizeof(mm));
+    for (size_t i = 0; i < tx->n; i++) {
+        iov[i].iov_base = tx->buf + tx->off[i];
+        iov[i].iov_len = tx->len[i];
+        mm[i].msg_hdr.msg_name = &tx->to[i];
+        mm[i].msg_hdr.msg_namelen = tx->to_len[i];
+        mm[i].msg_hdr.msg_iov = &iov[i];
+        mm[i].msg_hdr.msg_iovlen = 1;
+    }
+    size_t i = 0;
+    while (i < tx->n) {
+        int r = sendmmsg(tx->fd, mm + i, (unsigned)(tx->n - i), 0);
+        tx->calls++;
+        if (r > 0) {
+            i += (size_t)r;
+        } else if (errno != EINTR) {
+            i++; // EAGAIN u otro error: se descarta este datagrama (UDP; QUIC lo retransmite)
+        }
+    }
+    tx->datagrams += tx->n;
+    tx->n = tx->used = 0;
+}
+
+// Lugar para escribir un datagrama de hasta 'max' bytes.
+static uint8_t *udptx_reserve(UdpTx *tx, size_t max) {
+    if (tx->n == TX_MAX_MSGS || tx->used + max > sizeof(tx->buf)) udptx_flush(tx);
+    return tx->buf + tx->used;
+}
+
+static void udptx_commit(UdpTx *tx, size_t len, const void *to, socklen_t to_len) {
+    size_t i = tx->n++;
+    tx->off[i] = tx->used;
+    tx->len[i] = len;
+    memcpy(&tx->to[i], to, to_len);
+    tx->to_len[i] = to_len;
+    tx->used += len;
+}
+
+static void udptx_add(UdpTx *tx, const void *data, size_t len, const void *to, socklen_t to_len) {
+    if (len > sizeof(tx->buf)) return;
+    memcpy(udptx_reserve(tx, len), data, len);
+    udptx_commit(tx, len, to, to_len);
+}
+
+// ---------------------------------------------------------------------------
+// Transporte TCP: conexiones no bloqueantes indexadas por fd
+// ---------------------------------------------------------------------------
+
+typedef enum { ROLE_NONE, ROLE_SUB, ROLE_PUB, ROLE_PEER } Role;
+
+typedef struct {
+    bool in_use;
+    bool dirty;                   // hay salida acumulada en esta ráfaga
+    bool dead;                    // se cierra al final de la ráfaga
+    bool want_out;                // EPOLLOUT activo (el kernel no aceptó todo)
+    Role role;
+    Topic *pub;
+    struct sockaddr_in addr;
+    char in[LINE_BUF + 1];        // +1 para terminar la línea con '\0'
+    size_t in_len;
+    char *out;
+    size_t out_off, out_len, out_cap;
+    TopicList topics;             // suscripciones (en un par: temas que pidió)
+    bool connecting;              // enlace saliente esperando connect()
+    int peer_cfg;                 // enlace saliente: índice en peer_cfg + 1 (0 = entrante)
+    char peer_id[PEER_ID_MAX];
+} TcpConn;
+
+static TcpConn *tcp = NULL;       // indexado por fd
+static size_t tcp_cap = 0;
+static int *tcp_dirty = NULL;
+static size_t tcp_ndirty = 0;
+static int *tcp_dead = NULL;
+static size_t tcp_ndead = 0;
+static int ep = -1;
+
+static bool tcp_grow(int fd) {
+    if ((size_t)fd < tcp_cap) return true;
+    size_t ncap = tcp_cap ? tcp_cap : 64;
+    while (ncap <= (size_t)fd) ncap *= 2;
+    TcpConn *nc = (TcpConn *)realloc(tcp, ncap * sizeof(TcpConn));
+    if (!nc) return false;
+    memset(nc + tcp_cap, 0, (ncap - tcp_cap) * sizeof(TcpConn));
+    tcp = nc;
+    int *nd = (int *)realloc(tcp_dirty, ncap * sizeof(int));
+    if (!nd) return false;
+    tcp_dirty = nd;
+    int *nx = (int *)realloc(tcp_dead, ncap * sizeof(int));
+    if (!nx) return false;
+    tcp_dead = nx;
+    tcp_cap = ncap;
+    return true;
+}
+
+static void tcp_kill(int fd) {
+    TcpConn *c = &tcp[fd];
+    if (c->dead) return;
+    c->dead = true;
+    tcp_dead[tcp_ndead++] = fd;
+}
+
+// Acumula 'len' bytes para el cliente; salen al final de la ráfaga.
+static void tcp_queue(int fd, const char *data, size_t len) {
+    TcpConn *c = &tcp[fd];
+    if (c->dead) return;
+    if (c->out_off > 0 && c->out_off == c->out_len) c->out_off = c->out_len = 0;
+    if (c->out_len + len > c->out_cap) {
+        if (c->out_off > 0) {
+            memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+            c->out_len -= c->out_off;
+            c->out_off = 0;
+        }
+        if (c->out_len + len > TCP_OUT_MAX) {
+            log_warn("[broker] TCP %I:%d no lee a tiempo (%zu bytes pendientes): se cierra\n",
+                     c->addr.sin_addr.s_addr, ntohs(c->addr.sin_port), c->out_len);
+            tcp_kill(fd);
+            return;
+        }
+        if (c->out_len + len > c->out_cap) {
+            size_t ncap = c->out_cap ? c->out_cap : 16384;
+            while (ncap < c->out_len + len) ncap *= 2;
+            char *no = (char *)realloc(c->out, ncap);
+            if (!no) {
+                tcp_kill(fd);
+                return;
+            }
+            c->out = no;
+            c->out_cap = ncap;
+        }
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    if (!c->dirty) {
+        c->dirty = true;
+        tcp_dirty[tcp_ndirty++] = fd;
+    }
+}
+
+static void tcp_set_want_out(int fd, bool on) {
+    TcpConn *c = &tcp[fd];
+    if (c->want_out == on) return;
+    c->want_out = on;
+    struct epoll_event ev = { .events = EPOLLIN | (on ? EPOLLOUT : 0) };
+    ev.data.u64 = EV_KEY(EV_TCP_CONN, fd);
+    epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+}
+
+// Envía lo acumulado; lo que el kernel no acepta espera a EPOLLOUT.
+static void tcp_flush(int fd) {
+    TcpConn *c = &tcp[fd];
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(fd, c->out + c->out_off, c->out_len - c->out_off, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out_off += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        tcp_kill(fd);
+        return;
+    }
+    if (c->out_off == c->out_len) c->out_off = c->out_len = 0;
+    tcp_set_want_out(fd, c->out_len > 0);
+}
+
+static void peer_closed(int fd);
+
+static void tcp_close(int fd) {
+    TcpConn *c = &tcp[fd];
+    if (c->role == ROLE_PEER) {
+        peer_closed(fd);
+    } else {
+        log_info("[broker] TCP %I:%d desconectado\n", c->addr.sin_addr.s_addr, ntohs(c->addr.sin_port));
+    }
+    unsubscribe_conn(&c->topics, c->role == ROLE_PEER ? TR_PEER : TR_TCP, fd);
+    free(c->out);
+    epoll_ctl(ep, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    memset(c, 0, sizeof(*c));
+}
+
+static void tcp_accept(int srv) {
+    for (;;) {
+        struct sockaddr_in cli = {0};
+        socklen_t clilen = sizeof(cli);
+        int fd = accept4(srv, (struct sockaddr *)&cli, &clilen, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN: no hay más
+        }
+        if (!tcp_grow(fd)) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        TcpConn *c = &tcp[fd];
+        memset(c, 0, sizeof(*c));
+        c->in_use = true;
+        c->addr = cli;
+        struct epoll_event ev = { .events = EPOLLIN };
+        ev.data.u64 = EV_KEY(EV_TCP_CONN, fd);
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+        log_info("[broker] TCP %I:%d conectado\n", cli.sin_addr.s_addr, ntohs(cli.sin_port));
+    }
+}
+
+static void publish(Topic *t, const char *text, size_t len);
+static void peer_line(int fd, char *line, size_t len);
+static void peer_link_up(int fd);
+
+// Una línea completa de un cliente TCP (mismo protocolo que broker_tcp) o de un par.
+static void tcp_line(int fd, char *line, size_t len) {
+    TcpConn *c = &tcp[fd];
+    if (len > 0 && line[len - 1] == '\r') len--;
+    line[len] = '\0';
+    if (c->role == ROLE_PEER) {
+        peer_line(fd, line, len);
+        return;
+    }
+    char cmd[8], topic[TOPIC_MAX];
+    const char *rest;
+    size_t rest_len;
+
+    if (c->role == ROLE_PUB) {
+        if (len >= 4 && memcmp(line, "MSG ", 4) == 0) {
+            log_info("[broker] TCP publicación en '%s': %.*s\n", c->pub->name, (int)(len - 4), line + 4);
+            publish(c->pub, line + 4, len - 4);
+        } else {
+            tcp_queue(fd, "WARN: use 'MSG <texto>'\n", 24);
+        }
+        return;
+    }
+    parse_command(line, len, cmd, topic, &rest, &rest_len);
+    if (topic[0] == '\0') {
+        if (c->role == ROLE_NONE) {
+            static const char err[] = "ERR protocolo: use 'SUB <tema>' o 'PUB <tema>'\n";
+            tcp_queue(fd, err, sizeof(err) - 1);
+            tcp_kill(fd);
+        }
+        return; // otras líneas de un SUB se ignoran
+    }
+    if (strcmp(cmd, "SUB") == 0) {
+        c->role = ROLE_SUB;
+        Topic *t = find_topic(topic, true);
+        if (!t || topic_list_has(&c->topics, t) || !topic_list_add(&c->topics, t)) return;
+        Sub *s = topic_add_sub(t);
+        if (!s) return;
+        s->tr = TR_TCP;
+        s->conn = fd;
+        log_info("[broker] TCP %d suscrito a '%s'\n", fd, topic);
+        interest_update(t);
+    } else if (c->role == ROLE_NONE && strcmp(cmd, "PEER") == 0) {
+        c->role = ROLE_PEER; // enlace entrante de otro broker
+        peer_line(fd, line, len);
+        if (!c->dead) peer_link_up(fd);
+    } else if (c->role == ROLE_NONE && strcmp(cmd, "PUB") == 0) {
+        c->role = ROLE_PUB;
+        c->pub = find_topic(topic, true);
+        if (!c->pub) tcp_kill(fd);
+    } else if (c->role == ROLE_NONE) {
+        static const char err[] = "ERR rol desconocido\n";
+        tcp_queue(fd, err, sizeof(err) - 1);
+        tcp_kill(fd);
+    }
+}
+
+// Lee lo disponible y lo separa en líneas.
+static void tcp_read(int fd) {
+    TcpConn *c = &tcp[fd];
+    char buf[65536];
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            tcp_kill(fd);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        for (ssize_t i = 0; i < n && !c->dead; i++) {
+            if (buf[i] == '\n') {
+                tcp_line(fd, c->in, c->in_len);
+                c->in_len = 0;
+            } else if (c->in_len < sizeof(c->in) - 1) {
+                c->in[c->in_len++] = buf[i];
+            }
+        }
+        if (c->dead || (size_t)n < sizeof(buf)) return;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Federación: enlaces TCP entre brokers
+// ---------------------------------------------------------------------------
+// Un enlace es una conexión TCP más, con estas líneas (en los dos sentidos):
+//   PEER <id>                                  presentación
+//   INT +|- <tema> <origen> <versión>         el broker <origen> gana/pierde interés en el tema
+//   FWD <origen> <seq> <saltos> <tema> <texto> publicación reenviada
+// El interés se propaga por inundación y lleva el broker que lo originó (el que tiene
+// suscriptores locales) y una versión que ese broker incrementa en cada cambio; cada
+// broker guarda por tema y origen la última versión vista y el enlace por el que llegó.
+// Una versión vieja se ignora, así que un retiro alcanza a todos los nodos aunque los
+// enlaces formen ciclos (un anuncio no puede volver y revivir un interés retirado). Si
+// cae el enlace de un origen, el broker lo retira con la misma versión solo hacia los
+// que lo aprendieron de él, y lo acepta de nuevo si otro enlace lo vuelve a anunciar.
+// Los enlaces por los que se alcanza algún origen activo son una suscripción más
+// (TR_PEER) del tema, así que el reparto los alcanza en la misma pasada que a los
+// suscriptores locales: cada publicación sigue el camino inverso de los anuncios.
+// Contra bucles: una publicación nunca vuelve por el enlace del que llegó, se descarta
+// si su (origen, seq) ya se vio o si su origen es este broker, y muere a los
+// PEER_MAX_HOPS saltos.
+
+typedef struct {
+    char name[128];               // host:puerto tal como se pasó en -P
+    struct sockaddr_in addr;
+    int fd;                       // -1 = sin enlace
+    uint64_t retry_at;
+} PeerCfg;
+
+static char my_id[PEER_ID_MAX];
+static uint64_t my_seq = 0;
+static PeerCfg peer_cfg[PEER_MAX];
+static size_t npeer_cfg = 0;
+static int peer_links[PEER_LINKS_MAX]; // enlaces presentados (fds)
+static size_t npeer_links = 0;
+static uint64_t int_clock;             // versiones del interés local (µs de reloj al iniciar)
+static uint64_t seen[SEEN_SLOTS];
+
+static void route(Topic *t, const char *text, size_t len, const char *origin,
+                  uint64_t seq, unsigned hops, int from);
+
+// Registra (origen, seq); devuelve true si ya estaba (copia repetida por otro camino).
+static bool seen_before(const char *origin, uint64_t seq) {
+    uint64_t k = 1469598103934665603ull;
+    for (const char *p = origin; *p; p++) {
+        k ^= (uint8_t)*p;
+        k *= 1099511628211ull;
+    }
+    k = (k ^ seq) * 1099511628211ull;
+    if (k == 0) k = 1;
+    uint64_t *slot = &seen[k % SEEN_SLOTS];
+    if (*slot == k) return true;
+    *slot = k;
+    return false;
+}
+
+// ¿Hay suscriptores locales (no pares) de 't'?
+static bool local_interest(const Topic *t) {
+    for (size_t i = 0; i < t->nsubs; i++) {
+        if (t->subs[i].tr != TR_PEER) return true;
+    }
+    return false;
+}
+
+static void int_send(int fd, const Topic *t, bool on, const char *origin, uint64_t ver) {
+    char line[TOPIC_MAX + PEER_ID_MAX + 32];
+    int n = snprintf(line, sizeof(line), "INT %c %s %s %" PRIu64 "\n", on ? '+' : '-', t->name,
+                     origin, ver);
+    tcp_queue(fd, line, (size_t)n);
+}
+
+// Inunda un cambio de interés por todos los enlaces salvo 'except'.
+static void int_flood(const Topic *t, bool on, const char *origin, uint64_t ver, int except) {
+    for (size_t i = 0; i < npeer_links; i++) {
+        if (peer_links[i] != except) int_send(peer_links[i], t, on, origin, ver);
+    }
+}
+
+// Mantiene la suscripción TR_PEER del enlace 'fd' en 't': existe si por ese enlace se
+// alcanza algún origen activo.
+static void peer_sub_sync(Topic *t, int fd) {
+    if (fd < 0) return;
+    bool want = false;
+    for (size_t i = 0; i < t->norigins; i++) {
+        if (t->origins[i].active && t->origins[i].via == fd) want = true;
+    }
+    TcpConn *c = &tcp[fd];
+    if (want == topic_list_has(&c->topics, t)) return;
+    if (!want) {
+        topic_remove_sub(t, TR_PEER, fd);
+        topic_list_remove(&c->topics, t);
+        return;
+    }
+    Sub *s = topic_add_sub(t);
+    if (!s) return;
+    if (!topic_list_add(&c->topics, t)) {
+        t->nsubs--;
+        return;
+    }
+    s->tr = TR_PEER;
+    s->conn = fd;
+}
+
+static Origin *find_origin(Topic *t, const char *id, bool create) {
+    for (size_t i = 0; i < t->norigins; i++) {
+        if (strcmp(t->origins[i].id, id) == 0) return &t->origins[i];
+    }
+    if (!create) return NULL;
+    if (t->norigins == t->origins_cap) {
+        size_t ncap = t->origins_cap ? t->origins_cap * 2 : 4;
+        Origin *no = (Origin *)realloc(t->origins, ncap * sizeof(Origin));
+        if (!no) return NULL;
+        t->origins = no;
+        t->origins_cap = ncap;
+    }
+    Origin *o = &t->origins[t->norigins++];
+    memset(o, 0, sizeof(*o));
+    snprintf(o->id, sizeof(o->id), "%s", id);
+    o->via = -1;
+    return o;
+}
+
+// Los suscriptores locales de 't' cambiaron: si el tema ganó o perdió interés local, se
+// anuncia con una versión nueva a todos los pares.
+static void interest_update(Topic *t) {
+    bool local = local_interest(t);
+    if (local == t->local) return;
+    t->local = local;
+    t->local_ver = ++int_clock;
+    int_flood(t, local, my_id, t->local_ver, -1);
+}
+
+// "INT +|- <tema> <origen> <versión>" recibido por el enlace 'fd'.
+static void interest_recv(int fd, bool on, const char *topic, const char *origin, uint64_t ver) {
+    if (strcmp(origin, my_id) == 0) return; // nuestro propio anuncio, de vuelta por un ciclo
+    Topic *t = find_topic(topic, on);
+    if (!t) return;
+    Origin *o = find_origin(t, origin, on);
+    if (!o) return;
+    // Se acepta una versión nueva; con la misma, solo el retiro que viene del enlace por el
+    // que se aprendió (ese camino se cortó) o un anuncio que restituye uno así retirado.
+    bool newer = ver > o->ver;
+    bool same = ver == o->ver && (on ? !o->active : (o->active && o->via == fd));
+    if (!newer && !same) return;
+    int old_via = o->via;
+    o->ver = ver;
+    o->active = on;
+    o->via = on ? fd : -1;
+    peer_sub_sync(t, old_via);
+    peer_sub_sync(t, o->via);
+    log_info("[broker] El broker '%s' %s interés en '%s' (vía '%s')\n", origin,
+             on ? "tiene" : "ya no tiene", topic, tcp[fd].peer_id);
+    int_flood(t, on, origin, ver, fd);
+}
+
+// Enlace listo: presentación y anuncio de todo el interés vigente (salvo el que se aprendió
+// por este mismo enlace).
+static void peer_link_up(int fd) {
+    if (npeer_links == PEER_LINKS_MAX) {
+        log_warn("[broker] Demasiados enlaces con otros brokers (%d)\n", PEER_LINKS_MAX);
+        tcp_kill(fd);
+        return;
+    }
+    peer_links[npeer_links++] = fd;
+    char line[PEER_ID_MAX + 8];
+    int n = snprintf(line, sizeof(line), "PEER %s\n", my_id);
+    tcp_queue(fd, line, (size_t)n);
+    for (size_t b = 0; b < TOPIC_BUCKETS; b++) {
+        for (Topic *t = topic_buckets[b]; t; t = t->next) {
+            if (t->local) int_send(fd, t, true, my_id, t->local_ver);
+            for (size_t i = 0; i < t->norigins; i++) {
+                Origin *o = &t->origins[i];
+                if (o->active && o->via != fd) int_send(fd, t, true, o->id, o->ver);
+            }
+        }
+    }
+}
+
+static void peer_closed(int fd) {
+    TcpConn *c = &tcp[fd];
+    for (size_t i = 0; i < npeer_links; i++) {
+        if (peer_links[i] == fd) {
+            peer_links[i] = peer_links[--npeer_links];
+            break;
+        }
+    }
+    // El interés aprendido por este enlace ya no tiene camino: se retira con la misma
+    // versión, lo que solo afecta a quienes lo aprendieron de este broker.
+    for (size_t b = 0; b < TOPIC_BUCKETS; b++) {
+        for (Topic *t = topic_buckets[b]; t; t = t->next) {
+            for (size_t i = 0; i < t->norigins; i++) {
+                Origin *o = &t->origins[i];
+                if (!o->active || o->via != fd) continue;
+                o->active = false;
+                o->via = -1;
+                int_flood(t, false, o->id, o->ver, fd);
+            }
+        }
+    }
+    if (c->peer_cfg > 0) {
+        PeerCfg *pc = &peer_cfg[c->peer_cfg - 1];
+        pc->fd = -1;
+        pc->retry_at = mono_ms() + PEER_RETRY_MS;
+        if (c->connecting) {
+            log_debug("[broker] Par %s no disponible, se reintenta\n", pc->name);
+            return;
+        }
+    }
+    log_warn("[broker] Enlace con el broker '%s' (%I:%d) cerrado\n", c->peer_id,
+             c->addr.sin_addr.s_addr, ntohs(c->addr.sin_port));
+}
+
+// Inicia un enlace saliente (connect no bloqueante; termina en peer_connected()).
+static void peer_connect(size_t i) {
+    PeerCfg *pc = &peer_cfg[i];
+    pc->retry_at = mono_ms() + PEER_RETRY_MS;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return;
+    if ((connect(fd, (struct sockaddr *)&pc->addr, sizeof(pc->addr)) < 0 && errno != EINPROGRESS) ||
+        !tcp_grow(fd)) {
+        close(fd);
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    TcpConn *c = &tcp[fd];
+    memset(c, 0, sizeof(*c));
+    c->in_use = true;
+    c->role = ROLE_PEER;
+    c->connecting = true;
+    c->want_out = true;
+    c->peer_cfg = (int)i + 1;
+    c->addr = pc->addr;
+    pc->fd = fd;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT };
+    ev.data.u64 = EV_KEY(EV_TCP_CONN, fd);
+    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void peer_connected(int fd) {
+    TcpConn *c = &tcp[fd];
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        tcp_kill(fd);
+        return;
+    }
+    c->connecting = false;
+    peer_link_up(fd);
+}
+
+static void peer_line(int fd, char *line, size_t len) {
+    TcpConn *c = &tcp[fd];
+    char cmd[8], arg[TOPIC_MAX];
+    const char *rest;
+    size_t rest_len;
+    parse_command(line, len, cmd, arg, &rest, &rest_len);
+
+    if (strcmp(cmd, "FWD") == 0) {
+        // arg = origen; rest = "<seq> <saltos> <tema> <texto>"
+        char *p = (char *)rest;
+        uint64_t seq = strtoull(p, &p, 10);
+        unsigned long hops = strtoul(p, &p, 10);
+        char topic[TOPIC_MAX];
+        size_t i = 0;
+        if (*p == ' ') p++;
+        while (*p && *p != ' ' && i < sizeof(topic) - 1) topic[i++] = *p++;
+        topic[i] = '\0';
+        if (*p == ' ') p++;
+        if (strlen(arg) >= PEER_ID_MAX || strcmp(arg, my_id) == 0 ||
+            hops >= PEER_MAX_HOPS || seen_before(arg, seq)) {
+            stats_dup++;
+            return;
+        }
+        Topic *t = find_topic(topic, false);
+        if (!t) return; // el interés se retiró mientras viajaba
+        log_debug("[broker] Publicación de '%s' (seq %" PRIu64 ", %lu salto(s)) en '%s' vía '%s'\n",
+                  arg, seq, hops + 1, topic, c->peer_id);
+        route(t, p, (size_t)(line + len - p), arg, seq, (unsigned)hops + 1, fd);
+    } else if (strcmp(cmd, "INT") == 0 && (arg[0] == '+' || arg[0] == '-') && rest_len > 0) {
+        // rest = "<tema> <origen> <versión>"
+        char buf[LINE_BUF], topic[TOPIC_MAX], origin[PEER_ID_MAX];
+        uint64_t ver;
+        snprintf(buf, sizeof(buf), "%.*s", (int)rest_len, rest);
+        if (sscanf(buf, "%127s %63s %" SCNu64, topic, origin, &ver) != 3) {
+            log_warn("[broker] Línea inválida del broker '%s': %s\n", c->peer_id, line);
+            return;
+        }
+        interest_recv(fd, arg[0] == '+', topic, origin, ver);
+    } else if (strcmp(cmd, "PEER") == 0 && arg[0] != '\0') {
+        if (strcmp(arg, my_id) == 0) {
+            log_warn("[broker] Enlace consigo mismo (id '%s'): se cierra\n", my_id);
+            tcp_kill(fd);
+            return;
+        }
+        snprintf(c->peer_id, sizeof(c->peer_id), "%.*s", PEER_ID_MAX - 1, arg);
+        log_info("[broker] Enlace con el broker '%s' (%I:%d)\n", c->peer_id,
+                 c->addr.sin_addr.s_addr, ntohs(c->addr.sin_port));
+    } else {
+        log_warn("[broker] Línea inválida del broker '%s': %s\n", c->peer_id, line);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Transporte UDP
+// ---------------------------------------------------------------------------
+
+static int udp_sock = -1;
+static UdpTx udp_tx;
+
+static void udp_subscribe(const char *name, const struct sockaddr_in *from) {
+    Topic *t = find_topic(name, true);
+    if (!t) return;
+    uint64_t expires = lease_ms ? mono_ms() + lease_ms : 0;
+    for (size_t i = 0; i < t->nsubs; i++) {
+        Sub *s = &t->subs[i];
+        if (s->tr == TR_UDP && s->addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+            s->addr.sin_port == from->sin_port) {
+            s->expires_ms = expires; // latido: renueva la concesión
+            return;
+        }
+    }
+    Sub *s = topic_add_sub(t);
+    if (!s) return;
+    s->tr = TR_UDP;
+    s->conn = -1;
+    s->addr = *from;
+    s->expires_ms = expires;
+    log_info("[broker] UDP %I:%d suscrito a '%s'\n", from->sin_addr.s_addr, ntohs(from->sin_port), name);
+    interest_update(t);
+}
+
+// Quita las suscripciones UDP con la concesión vencida.
+static void udp_sweep(uint64_t now) {
+    size_t expired = 0;
+    for (size_t b = 0; b < TOPIC_BUCKETS; b++) {
+        for (Topic *t = topic_buckets[b]; t; t = t->next) {
+            size_t before = expired;
+            for (size_t i = 0; i < t->nsubs;) {
+                Sub *s = &t->subs[i];
+                if (s->tr == TR_UDP && s->expires_ms && s->expires_ms <= now) {
+                    t->subs[i] = t->subs[--t->nsubs];
+                    expired++;
+                } else {
+                    i++;
+                }
+            }
+            if (expired != before) interest_update(t);
+        }
+    }
+    if (expired) log_info("[broker] %zu suscripción(es) UDP vencida(s) por falta de renovación\n", expired);
+}
+
+static void udp_datagram(const char *p, size_t len, const struct sockaddr_in *from) {
+    char cmd[8], topic[TOPIC_MAX];
+    const char *msg;
+    size_t msg_len;
+    parse_command(p, len, cmd, topic, &msg, &msg_len);
+    if (strcmp(cmd, "SUB") == 0 && topic[0] != '\0') {
+        udp_subscribe(topic, from);
+    } else if (strcmp(cmd, "PUB") == 0 && topic[0] != '\0') {
+        if (msg_len == 0) return;
+        if (msg_len > MAX_LINE) msg_len = MAX_LINE;
+        Topic *t = find_topic(topic, true);
+        if (!t) return;
+        log_info("[broker] UDP publicación de %I:%d en '%s': %.*s\n",
+                 from->sin_addr.s_addr, ntohs(from->sin_port), topic, (int)msg_len, msg);
+        publish(t, msg, msg_len);
+    } else {
+        log_warn("[broker] UDP mensaje inválido de %I:%d: %.*s\n",
+                 from->sin_addr.s_addr, ntohs(from->sin_port), (int)len, p);
+    }
+}
+
+static void udp_read(void) {
+    static char bufs[RX_BATCH][RX_BUF_SIZE];
+    static struct sockaddr_in peers[RX_BATCH];
+    struct iovec iov[RX_BATCH];
+    struct mmsghdr msgs[RX_BATCH];
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < RX_BATCH; i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = sizeof(bufs[i]);
+            msgs[i].msg_hdr.msg_name = &peers[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int got = recvmmsg(udp_sock, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+        if (got <= 0) return;
+        for (int i = 0; i < got; i++) udp_datagram(bufs[i], msgs[i].msg_len, &peers[i]);
+        if (got < RX_BATCH) return;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Transporte QUIC (mismo diseño que broker_quic, sin DATAGRAM ni 0-RTT)
+// ---------------------------------------------------------------------------
+#ifndef NO_QUIC
+
+typedef struct {
+    uint8_t len;
+    uint8_t id[QUICHE_MAX_CONN_ID_LEN];
+} ConnId;
+
+typedef struct {
+    uint64_t sid;
+    Topic *pub;
+    char *line;
+    size_t line_len;
+} InStream;
+
+typedef struct {
+    quiche_conn *conn;
+    bool in_use;
+    bool dirty;
+    ConnId ids[MAX_CONN_IDS];
+    int nids;
+    TopicList topics;
+    uint64_t next_uni;
+    InStream *in;
+    size_t nin, in_cap;
+    uint64_t dropped;
+    uint64_t deadline;            // ns CLOCK_MONOTONIC (UINT64_MAX = ninguno)
+    int heap_pos;
+} QuicConn;
+
+typedef struct {
+    ConnId cid;
+    int idx;                      // -1 vacío, -2 lápida
+} CidEntry;
+
+static int quic_sock = -1;
+static UdpTx quic_tx;
+static quiche_config *quic_config = NULL;
+static struct sockaddr_in quic_addr;
+static QuicConn *qc = NULL;
+static size_t qc_cap = 0, qc_used = 0, qc_live = 0;
+static int *qc_free = NULL, *qc_dirty = NULL, *qheap = NULL;
+static size_t qc_nfree = 0, qc_ndirty = 0, qheap_len = 0;
+static CidEntry *cid_map = NULL;
+static size_t cid_buckets = 0, cid_count = 0; // cid_count: vivas + lápidas
+static size_t cid_live = 0;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t cid_hash(const uint8_t *id, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= id[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int cid_lookup(const uint8_t *id, size_t len) {
+    if (cid_buckets == 0) return -1;
+    for (size_t i = cid_hash(id, len) & (cid_buckets - 1);; i = (i + 1) & (cid_buckets - 1)) {
+        CidEntry *e = &cid_map[i];
+        if (e->idx == -1) return -1;
+        if (e->idx >= 0 && e->cid.len == len && memcmp(e->cid.id, id, len) == 0) return e->idx;
+    }
+}
+
+static void cid_put(CidEntry *map, size_t buckets, const ConnId *cid, int idx) {
+    size_t i = cid_hash(cid->id, cid->len) & (buckets - 1);
+    while (map[i].idx >= 0) i = (i + 1) & (buckets - 1);
+    map[i].cid = *cid;
+    map[i].idx = idx;
+}
+
+static bool cid_insert(const ConnId *cid, int idx) {
+    if ((cid_count + 1) * 2 > cid_buckets) {
+        // Al doble solo si las vivas pasan un cuarto; si no, mismo tamaño sin lápidas.
+        size_t nb = !cid_buckets ? INITIAL_CID_BUCKETS
+                    : (cid_live + 1) * 4 > cid_buckets ? cid_buckets * 2 : cid_buckets;
+        CidEntry *nm = (CidEntry *)malloc(nb * sizeof(CidEntry));
+        if (!nm) return false;
+        for (size_t i = 0; i < nb; i++) nm[i].idx = -1;
+        size_t live = 0;
+        for (size_t i = 0; i < cid_buckets; i++) {
+            if (cid_map[i].idx >= 0) {
+                cid_put(nm, nb, &cid_map[i].cid, cid_map[i].idx);
+                live++;
+            }
+        }
+        free(cid_map);
+        cid_map = nm;
+        cid_buckets = nb;
+        cid_count = cid_live = live;
+    }
+    cid_put(cid_map, cid_buckets, cid, idx);
+    cid_count++;
+    cid_live++;
+    return true;
+}
+
+static void cid_remove(const ConnId *cid) {
+    for (size_t i = cid_hash(cid->id, cid->len) & (cid_buckets - 1);; i = (i + 1) & (cid_buckets - 1)) {
+        CidEntry *e = &cid_map[i];
+        if (e->idx == -1) return;
+        if (e->idx >= 0 && e->cid.len == cid->len && memcmp(e->cid.id, cid->id, cid->len) == 0) {
+            e->idx = -2;
+            cid_live--;
+            return;
+        }
+    }
+}
+
+// Montículo de plazos de quiche (mínimo por 'deadline').
+static void qheap_swap(size_t a, size_t b) {
+    int t = qheap[a];
+    qheap[a] = qheap[b];
+    qheap[b] = t;
+    qc[qheap[a]].heap_pos = (int)a;
+    qc[qheap[b]].heap_pos = (int)b;
+}
+
+static void qheap_fix(size_t i) {
+    while (i > 0 && qc[qheap[(i - 1) / 2]].deadline > qc[qheap[i]].deadline) {
+        qheap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        size_t l = 2 * i + 1, m = i;
+        if (l < qheap_len && qc[qheap[l]].deadline < qc[qheap[m]].deadline) m = l;
+        if (l + 1 < qheap_len && qc[qheap[l + 1]].deadline < qc[qheap[m]].deadline) m = l + 1;
+        if (m == i) return;
+        qheap_swap(i, m);
+        i = m;
+    }
+}
+
+static void qheap_remove(int idx) {
+    int pos = qc[idx].heap_pos;
+    if (pos < 0) return;
+    qc[idx].heap_pos = -1;
+    if ((size_t)pos != --qheap_len) {
+        qheap[pos] = qheap[qheap_len];
+        qc[qheap[pos]].heap_pos = pos;
+        qheap_fix((size_t)pos);
+    }
+}
+
+// Recalcula el plazo de la conexión (cerrada = ya, para liberarla).
+static void quic_schedule(int idx) {
+    QuicConn *q = &qc[idx];
+    uint64_t t = quiche_conn_timeout_as_nanos(q->conn);
+    q->deadline = quiche_conn_is_closed(q->conn) ? 1 : (t == UINT64_MAX ? UINT64_MAX : mono_ns() + t);
+    if (q->deadline == UINT64_MAX) {
+        qheap_remove(idx);
+        return;
+    }
+    if (q->heap_pos < 0) {
+        q->heap_pos = (int)qheap_len;
+        qheap[qheap_len++] = idx;
+    }
+    qheap_fix((size_t)q->heap_pos);
+}
+
+static int quic_alloc(void) {
+    int idx;
+    if (qc_nfree > 0) {
+        idx = qc_free[--qc_nfree];
+    } else {
+        if (qc_used == qc_cap) {
+            size_t ncap = qc_cap ? qc_cap * 2 : 64;
+            QuicConn *nq = (QuicConn *)realloc(qc, ncap * sizeof(QuicConn));
+            if (!nq) return -1;
+            qc = nq;
+            int *a = (int *)realloc(qc_free, ncap * sizeof(int));
+            if (!a) return -1;
+            qc_free = a;
+            int *b = (int *)realloc(qc_dirty, ncap * sizeof(int));
+            if (!b) return -1;
+            qc_dirty = b;
+            int *h = (int *)realloc(qheap, ncap * sizeof(int));
+            if (!h) return -1;
+            qheap = h;
+            qc_cap = ncap;
+        }
+        idx = (int)qc_used++;
+    }
+    memset(&qc[idx], 0, sizeof(QuicConn));
+    qc[idx].in_use = true;
+    qc[idx].heap_pos = -1;
+    qc[idx].next_uni = FIRST_SERVER_UNI;
+    qc_live++;
+    return idx;
+}
+
+static void quic_free(int idx) {
+    QuicConn *q = &qc[idx];
+    for (int i = 0; i < q->nids; i++) cid_remove(&q->ids[i]);
+    unsubscribe_conn(&q->topics, TR_QUIC, idx);
+    qheap_remove(idx);
+    if (q->dirty) {
+        for (size_t i = 0; i < qc_ndirty; i++) {
+            if (qc_dirty[i] == idx) {
+                qc_dirty[i] = qc_dirty[--qc_ndirty];
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < q->nin; i++) free(q->in[i].line);
+    free(q->in);
+    if (q->conn) quiche_conn_free(q->conn);
+    memset(q, 0, sizeof(*q));
+    qc_free[qc_nfree++] = idx;
+    qc_live--;
+}
+
+static void quic_mark_dirty(int idx) {
+    if (qc[idx].dirty) return;
+    qc[idx].dirty = true;
+    qc_dirty[qc_ndirty++] = idx;
+}
+
+// Pasa los paquetes pendientes de la conexión al lote de salida del socket QUIC.
+static void quic_pump(int idx) {
+    QuicConn *q = &qc[idx];
+    for (;;) {
+        quiche_send_info s_info;
+        uint8_t *out = udptx_reserve(&quic_tx, MAX_DATAGRAM_SIZE);
+        ssize_t n = quiche_conn_send(q->conn, out, MAX_DATAGRAM_SIZE, &s_info);
+        if (n < 0) break; // QUICHE_ERR_DONE: no hay más
+        udptx_commit(&quic_tx, (size_t)n, &s_info.to, s_info.to_len);
+    }
+    quic_schedule(idx);
+}
+
+static void quic_reply(QuicConn *q, uint64_t sid, const char *msg) {
+    uint64_t err = 0;
+    quiche_conn_stream_send(q->conn, sid, (const uint8_t *)msg, strlen(msg), false, &err);
+}
+
+static void quic_line(int idx, InStream *st, const char *line, size_t len) {
+    QuicConn *q = &qc[idx];
+    if (len > 0 && line[len - 1] == '\r') len--;
+    if (st->pub) {
+        // Este broker no habilita 0-RTT, pero si llegara early data un MSG no se acepta: podría
+        // ser una repetición (solo SUB y PUB son idempotentes).
+        if (len >= 4 && memcmp(line, "MSG ", 4) == 0 && quiche_conn_is_in_early_data(q->conn)) {
+            log_warn("[broker] QUIC %d: MSG en 0-RTT rechazado ('%s')\n", idx, st->pub->name);
+            quic_reply(q, st->sid, "WARN: MSG en 0-RTT rechazado, reenviar tras el handshake\n");
+        } else if (len >= 4 && memcmp(line, "MSG ", 4) == 0) {
+            log_info("[broker] QUIC publicación en '%s': %.*s\n", st->pub->name, (int)(len - 4), line + 4);
+            publish(st->pub, line + 4, len - 4);
+        } else {
+            quic_reply(q, st->sid, "WARN: use 'MSG <texto>'\n");
+        }
+        return;
+    }
+    char cmd[8], topic[TOPIC_MAX];
+    const char *rest;
+    size_t rest_len;
+    parse_command(line, len, cmd, topic, &rest, &rest_len);
+    if (topic[0] == '\0') {
+        quic_reply(q, st->sid, "ERR protocolo: use 'SUB <tema> [urgencia]' o 'PUB <tema>'\n");
+        return;
+    }
+    if (strcmp(cmd, "SUB") == 0) {
+        int urgency = rest_len > 0 ? atoi(rest) : DEFAULT_URGENCY;
+        if (urgency < 0 || urgency > 7) urgency = DEFAULT_URGENCY;
+        Topic *t = find_topic(topic, true);
+        if (!t || topic_list_has(&q->topics, t)) return;
+        uint64_t sid = q->next_uni;
+        if (quiche_conn_stream_priority(q->conn, sid, (uint8_t)urgency, true) < 0) {
+            log_warn("[broker] QUIC %d: sin streams para '%s' (límite del cliente)\n", idx, topic);
+            return;
+        }
+        if (!topic_list_add(&q->topics, t)) return;
+        Sub *s = topic_add_sub(t);
+        if (!s) return;
+        q->next_uni += 4;
+        s->tr = TR_QUIC;
+        s->conn = idx;
+        s->stream = sid;
+        log_info("[broker] QUIC %d suscrito a '%s' (stream %" PRIu64 ", urgencia %d)\n", idx, topic, sid, urgency);
+        interest_update(t);
+    } else if (strcmp(cmd, "PUB") == 0) {
+        st->pub = find_topic(topic, true);
+    } else {
+        quic_reply(q, st->sid, "ERR comando desconocido\n");
+    }
+}
+
+static InStream *quic_stream(QuicConn *q, uint64_t sid) {
+    for (size_t i = 0; i < q->nin; i++) {
+        if (q->in[i].sid == sid) return &q->in[i];
+    }
+    if (q->nin == q->in_cap) {
+        size_t ncap = q->in_cap ? q->in_cap * 2 : 4;
+        InStream *ni = (InStream *)realloc(q->in, ncap * sizeof(InStream));
+        if (!ni) return NULL;
+        q->in = ni;
+        q->in_cap = ncap;
+    }
+    InStream *st = &q->in[q->nin];
+    memset(st, 0, sizeof(*st));
+    st->sid = sid;
+    if (!(st->line = (char *)malloc(MAX_LINE))) return NULL;
+    q->nin++;
+    return st;
+}
+
+static void quic_packet(uint8_t *in, size_t n, struct sockaddr_in *peer, socklen_t peer_len) {
+    uint8_t type;
+    uint32_t version;
+    uint8_t scid[QUICHE_MAX_CONN_ID_LEN], dcid[QUICHE_MAX_CONN_ID_LEN];
+    size_t scid_len = sizeof(scid), dcid_len = sizeof(dcid);
+    uint8_t token[256];
+    size_t token_len = sizeof(token);
+    if (quiche_header_info(in, n, LOCAL_CONN_ID_LEN, &version, &type,
+                           scid, &scid_len, dcid, &dcid_len, token, &token_len) < 0) {
+        return;
+    }
+
+    int idx = cid_lookup(dcid, dcid_len);
+    if (idx < 0) {
+        if (!quiche_version_is_supported(version)) {
+            uint8_t vn[MAX_DATAGRAM_SIZE];
+            ssize_t vlen = quiche_negotiate_version(scid, scid_len, dcid, dcid_len, vn, sizeof(vn));
+            if (vlen > 0) udptx_add(&quic_tx, vn, (size_t)vlen, peer, peer_len);
+            return;
+        }
+        if (n < QUICHE_MIN_CLIENT_INITIAL_LEN) return;
+        idx = quic_alloc();
+        if (idx < 0) return;
+        ConnId ours = { .len = LOCAL_CONN_ID_LEN };
+        RAND_bytes(ours.id, LOCAL_CONN_ID_LEN);
+        qc[idx].conn = quiche_accept(ours.id, ours.len, NULL, 0,
+                                     (const struct sockaddr *)&quic_addr, sizeof(quic_addr),
+                                     (const struct sockaddr *)peer, peer_len, quic_config);
+        if (!qc[idx].conn) {
+            quic_free(idx);
+            return;
+        }
+        ConnId theirs = { .len = (uint8_t)dcid_len };
+        memcpy(theirs.id, dcid, dcid_len);
+        qc[idx].ids[qc[idx].nids++] = ours;
+        qc[idx].ids[qc[idx].nids++] = theirs;
+        cid_insert(&ours, idx);
+        cid_insert(&theirs, idx);
+        log_info("[broker] QUIC %I:%d conectado (slot %d, %zu conexiones)\n",
+                 peer->sin_addr.s_addr, ntohs(peer->sin_port), idx, qc_live);
+    }
+
+    QuicConn *q = &qc[idx];
+    quiche_recv_info r_info = {
+        .from = (struct sockaddr *)peer,
+        .from_len = peer_len,
+        .to = (struct sockaddr *)&quic_addr,
+        .to_len = sizeof(quic_addr),
+    };
+    quiche_conn_recv(q->conn, in, n, &r_info);
+
+    quiche_stream_iter *it = quiche_conn_readable(q->conn);
+    if (it) {
+        uint64_t sid;
+        while (quiche_stream_iter_next(it, &sid)) {
+            InStream *st = quic_stream(q, sid);
+            for (;;) {
+                uint8_t sbuf[4096];
+                bool fin = false;
+                uint64_t err = 0;
+                ssize_t got = quiche_conn_stream_recv(q->conn, sid, sbuf, sizeof(sbuf), &fin, &err);
+                if (got < 0) break;
+                for (ssize_t i = 0; st && i < got; i++) {
+                    if (sbuf[i] == '\n') {
+                        quic_line(idx, st, st->line, st->line_len);
+                        st->line_len = 0;
+                    } else if (st->line_len < MAX_LINE) {
+                        st->line[st->line_len++] = (char)sbuf[i];
+                    }
+                }
+            }
+        }
+        quiche_stream_iter_free(it);
+    }
+    quic_mark_dirty(idx);
+}
+
+static void quic_read(void) {
+    static uint8_t bufs[RX_BATCH][MAX_DATAGRAM_SIZE];
+    static struct sockaddr_in peers[RX_BATCH];
+    struct iovec iov[RX_BATCH];
+    struct mmsghdr msgs[RX_BATCH];
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < RX_BATCH; i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = sizeof(bufs[i]);
+            msgs[i].msg_hdr.msg_name = &peers[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int got = recvmmsg(quic_sock, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+        if (got <= 0) return;
+        for (int i = 0; i < got; i++) {
+            quic_packet(bufs[i], msgs[i].msg_len, &peers[i], msgs[i].msg_hdr.msg_namelen);
+        }
+        if (got < RX_BATCH) return;
+    }
+}
+
+// Timers vencidos de quiche y conexiones cerradas.
+static void quic_timers(void) {
+    uint64_t now = mono_ns();
+    size_t budget = qheap_len;
+    while (qheap_len > 0 && budget-- > 0) {
+        int idx = qheap[0];
+        QuicConn *q = &qc[idx];
+        if (q->deadline > now) break;
+        if (!quiche_conn_is_closed(q->conn)) {
+            quiche_conn_on_timeout(q->conn);
+            quic_pump(idx);
+        }
+        if (quiche_conn_is_closed(q->conn)) {
+            log_info("[broker] QUIC slot %d cerrado (%" PRIu64 " mensaje(s) descartados)\n", idx, q->dropped);
+            quic_free(idx);
+        }
+    }
+}
+
+// Milisegundos hasta el próximo plazo de quiche (-1 = ninguno).
+static int quic_timeout_ms(void) {
+    if (qheap_len == 0) return -1;
+    uint64_t d = qc[qheap[0]].deadline, now = mono_ns();
+    if (d <= now) return 0;
+    uint64_t ms = (d - now + 999999) / 1000000;
+    return ms > SWEEP_MS ? SWEEP_MS : (int)ms;
+}
+
+static bool quic_init(int port, const char *cert, const char *key) {
+    quic_sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (quic_sock < 0) {
+        perror("socket (QUIC)");
+        return false;
+    }
+    quic_addr.sin_family = AF_INET;
+    quic_addr.sin_port = htons((uint16_t)port);
+    quic_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(quic_sock, (struct sockaddr *)&quic_addr, sizeof(quic_addr)) < 0) {
+        perror("bind (QUIC)");
+        return false;
+    }
+    quic_tx.fd = quic_sock;
+    quic_config = quiche_config_new(QUICHE_PROTOCOL_VERSION);
+    if (!quic_config ||
+        quiche_config_load_cert_chain_from_pem_file(quic_config, cert) < 0 ||
+        quiche_config_load_priv_key_from_pem_file(quic_config, key) < 0) {
+        fprintf(stderr, "[broker] ❌ Error cargando certificados QUIC.\n");
+        return false;
+    }
+    quiche_config_verify_peer(quic_config, false);
+    quiche_config_set_max_idle_timeout(quic_config, IDLE_TIMEOUT_MS);
+    quiche_config_set_initial_max_data(quic_config, 10 * 1024 * 1024);
+    quiche_config_set_initial_max_stream_data_bidi_local(quic_config, 5 * 1024 * 1024);
+    quiche_config_set_initial_max_stream_data_bidi_remote(quic_config, 5 * 1024 * 1024);
+    quiche_config_set_initial_max_streams_bidi(quic_config, 100);
+    if (quiche_config_set_application_protos(quic_config, (uint8_t *)"\x05hq-29\x08http/0.9", 14) < 0) {
+        fprintf(stderr, "[broker] ❌ ALPN inválido\n");
+        return false;
+    }
+    return true;
+}
+
+#endif // NO_QUIC
+
+// ---------------------------------------------------------------------------
+// Reparto: una pasada por los suscriptores del tema, sin importar el transporte
+// ---------------------------------------------------------------------------
+
+// Reparte a los suscriptores locales y a los pares interesados, salvo al enlace del que
+// llegó la publicación ('from', -1 si es local). 'origin', 'seq' y 'hops' viajan en FWD.
+static void route(Topic *t, const char *text, size_t len, const char *origin,
+                  uint64_t seq, unsigned hops, int from) {
+    static Msg m;
+    m.topic = t;
+    m.text = text;
+    m.len = len > MAX_LINE ? MAX_LINE : len;
+    m.line_len = 0; // se arma la primera vez que un suscriptor de línea la necesita
+    m.fwd_len = 0;
+    t->published++;
+    stats_published++;
+
+    for (size_t i = 0; i < t->nsubs; i++) {
+        Sub *s = &t->subs[i];
+        if (s->tr == TR_PEER) {
+            if (s->conn == from) continue;
+            if (m.fwd_len == 0) {
+                m.fwd_len = (size_t)snprintf(m.fwd, sizeof(m.fwd), "FWD %s %" PRIu64 " %u %s %.*s\n",
+                                             origin, seq, hops, t->name, (int)m.len, m.text);
+            }
+            tcp_queue(s->conn, m.fwd, m.fwd_len);
+            stats_delivered[TR_PEER]++;
+            continue;
+        }
+        if (s->tr != TR_UDP && m.line_len == 0) {
+            int hdr = snprintf(m.line, sizeof(m.line), "%s: ", t->name);
+            memcpy(m.line + hdr, m.text, m.len);
+            m.line_len = (size_t)hdr + m.len;
+            m.line[m.line_len++] = '\n';
+        }
+        switch (s->tr) {
+        case TR_TCP:
+            tcp_queue(s->conn, m.line, m.line_len);
+            break;
+        case TR_UDP:
+            udptx_add(&udp_tx, m.text, m.len, &s->addr, sizeof(s->addr));
+            break;
+#ifndef NO_QUIC
+        case TR_QUIC: {
+            QuicConn *q = &qc[s->conn];
+            if (quiche_conn_stream_capacity(q->conn, s->stream) < (ssize_t)m.line_len) {
+                q->dropped++; // sin crédito en el stream de este tema: no se cortan líneas
+                continue;
+            }
+            uint64_t err = 0;
+            quiche_conn_stream_send(q->conn, s->stream, (const uint8_t *)m.line, m.line_len, false, &err);
+            quic_mark_dirty(s->conn);
+            break;
+        }
+#endif
+        default:
+            continue;
+        }
+        stats_delivered[s->tr]++;
+    }
+}
+
+static void publish(Topic *t, const char *text, size_t len) {
+    route(t, text, len, my_id, ++my_seq, 0, -1);
+}
+
+// Fin de ráfaga: cierra las conexiones TCP marcadas (lo que eso anuncie a los pares sale
+// en esta misma ráfaga) y vacía las conexiones TCP con datos y los lotes UDP/QUIC.
+static void flush_all(void) {
+    for (size_t i = 0; i < tcp_ndead; i++) {
+        int fd = tcp_dead[i];
+        if (tcp[fd].out_off < tcp[fd].out_len) tcp_flush(fd); // p.ej. el "ERR ..." final
+        tcp_close(fd);
+    }
+    tcp_ndead = 0;
+    for (size_t i = 0; i < tcp_ndirty; i++) {
+        int fd = tcp_dirty[i];
+        tcp[fd].dirty = false;
+        if (tcp[fd].in_use && !tcp[fd].dead) tcp_flush(fd);
+    }
+    tcp_ndirty = 0;
+    udptx_flush(&udp_tx);
+#ifndef NO_QUIC
+    for (size_t i = 0; i < qc_ndirty; i++) {
+        qc[qc_dirty[i]].dirty = false;
+        quic_pump(qc_dirty[i]);
+    }
+    qc_ndirty = 0;
+    udptx_flush(&quic_tx);
+#endif
+}
+
+static void usage(const char *prog) {
+#ifndef NO_QUIC
+    fprintf(stderr, "Uso: %s [-L error|warn|info|debug] [-l segundos] [-i id] [-P host:puerto]... "
+                    "<puerto_tcp> <puerto_udp> [<puerto_quic> <cert.pem> <key.pem>]\n", prog);
+#else
+    fprintf(stderr, "Uso: %s [-L error|warn|info|debug] [-l segundos] [-i id] [-P host:puerto]... "
+                    "<puerto_tcp> <puerto_udp>\n", prog);
+#endif
+    fprintf(stderr, "  -l  concesión de las suscripciones UDP (por defecto %d s, 0 = nunca vence)\n", DEFAULT_LEASE_S);
+    fprintf(stderr, "  -i  identificador del broker en la federación (por defecto <host>:<puerto_tcp>)\n");
+    fprintf(stderr, "  -P  enlace con otro broker (su puerto TCP); repetible, hasta %d\n", PEER_MAX);
+}
+
+// Resuelve "host:puerto" para un enlace saliente.
+static bool parse_peer(const char *spec, PeerCfg *pc) {
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= 100) return false;
+    char host[100];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }, *res;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0) return false;
+    memcpy(&pc->addr, res->ai_addr, sizeof(pc->addr));
+    freeaddrinfo(res);
+    snprintf(pc->name, sizeof(pc->name), "%s", spec);
+    pc->fd = -1;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int level = LOGL_INFO;
+    int opt;
+    while ((opt = getopt(argc, argv, "L:l:i:P:")) != -1) {
+        if (opt == 'L' && (level = log_parse_level(optarg)) >= 0) continue;
+        if (opt == 'l') {
+            lease_ms = strtoull(optarg, NULL, 10) * 1000ull;
+            continue;
+        }
+        if (opt == 'i' && optarg[0] != '\0' && strlen(optarg) < PEER_ID_MAX && !strchr(optarg, ' ')) {
+            snprintf(my_id, sizeof(my_id), "%s", optarg);
+            continue;
+        }
+        if (opt == 'P' && npeer_cfg < PEER_MAX && parse_peer(optarg, &peer_cfg[npeer_cfg])) {
+            npeer_cfg++;
+            continue;
+        }
+        if (opt == 'P') fprintf(stderr, "[broker] ❌ Par inválido: %s\n", optarg);
+        usage(argv[0]);
+        return 1;
+    }
+    int nargs = argc - optind;
+#ifndef NO_QUIC
+    if (nargs != 2 && nargs != 5) {
+#else
+    if (nargs != 2) {
+#endif
+        usage(argv[0]);
+        return 1;
+    }
+    int tcp_port = atoi(argv[optind]);
+    int udp_port = atoi(argv[optind + 1]);
+    if (my_id[0] == '\0') {
+        char host[PEER_ID_MAX - 8] = "broker";
+        gethostname(host, sizeof(host) - 1);
+        snprintf(my_id, sizeof(my_id), "%s:%d", host, tcp_port);
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now); // versiones crecientes aunque el broker se reinicie
+    int_clock = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+    signal(SIGPIPE, SIG_IGN);
+    if (log_init((LogLevel)level, LOG_RING_RECORDS) != 0) {
+        fprintf(stderr, "[broker] ❌ No se pudo iniciar el hilo de log\n");
+        return 1;
+    }
+
+    ep = epoll_create1(0);
+    if (ep < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    // TCP
+    int srv = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int yes = 1;
+    setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)tcp_port);
+    if (srv < 0 || bind(srv, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv, BACKLOG) < 0) {
+        perror("TCP");
+        return 1;
+    }
+    ev.data.u64 = EV_KEY(EV_TCP_LISTEN, srv);
+    epoll_ctl(ep, EPOLL_CTL_ADD, srv, &ev);
+
+    // UDP
+    udp_sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    addr.sin_port = htons((uint16_t)udp_port);
+    if (udp_sock < 0 || bind(udp_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("UDP");
+        return 1;
+    }
+    udp_tx.fd = udp_sock;
+    ev.data.u64 = EV_KEY(EV_UDP, udp_sock);
+    epoll_ctl(ep, EPOLL_CTL_ADD, udp_sock, &ev);
+
+    printf("[broker] 🟢 TCP en %d, UDP en %d", tcp_port, udp_port);
+#ifndef NO_QUIC
+    if (nargs == 5) {
+        int quic_port = atoi(argv[optind + 2]);
+        if (!quic_init(quic_port, argv[optind + 3], argv[optind + 4])) return 1;
+        ev.data.u64 = EV_KEY(EV_QUIC, quic_sock);
+        epoll_ctl(ep, EPOLL_CTL_ADD, quic_sock, &ev);
+        printf(", QUIC en %d", quic_port);
+    }
+#endif
+    printf(" (id '%s', %zu par(es))\n", my_id, npeer_cfg);
+    fflush(stdout);
+    for (size_t i = 0; i < npeer_cfg; i++) peer_connect(i);
+
+    uint64_t next_sweep = mono_ms() + SWEEP_MS;
+    for (;;) {
+        int timeout = (int)(next_sweep > mono_ms() ? next_sweep - mono_ms() : 0);
+#ifndef NO_QUIC
+        int qt = quic_timeout_ms();
+        if (qt >= 0 && qt < timeout) timeout = qt;
+#endif
+        struct epoll_event evs[MAX_EVENTS];
+        int ne = epoll_wait(ep, evs, MAX_EVENTS, timeout);
+        if (ne < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
+        }
+        for (int e = 0; e < ne; e++) {
+            int kind = (int)(evs[e].data.u64 >> 32);
+            int fd = (int)(uint32_t)evs[e].data.u64;
+            switch (kind) {
+            case EV_TCP_LISTEN:
+                tcp_accept(fd);
+                break;
+            case EV_TCP_CONN:
+                if (tcp[fd].dead) break;
+                if (tcp[fd].connecting) {
+                    peer_connected(fd);
+                    break;
+                }
+                if (evs[e].events & EPOLLOUT) tcp_flush(fd);
+                if (evs[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) tcp_read(fd);
+                break;
+            case EV_UDP:
+                udp_read();
+                break;
+#ifndef NO_QUIC
+            case EV_QUIC:
+                quic_read();
+                break;
+#endif
+            }
+        }
+#ifndef NO_QUIC
+        if (quic_sock >= 0) quic_timers();
+#endif
+        flush_all();
+
+        uint64_t now = mono_ms();
+        if (now >= next_sweep) {
+            if (lease_ms) udp_sweep(now);
+            for (size_t i = 0; i < npeer_cfg; i++) {
+                if (peer_cfg[i].fd < 0 && peer_cfg[i].retry_at <= now) peer_connect(i);
+            }
+            log_debug("[broker] %" PRIu64 " publicaciones; entregas TCP %" PRIu64 ", UDP %" PRIu64
+                      " (%" PRIu64 " sendmmsg), QUIC %" PRIu64 ", a pares %" PRIu64 " (%" PRIu64 " repetidas)\n",
+                      stats_published, stats_delivered[TR_TCP], stats_delivered[TR_UDP], udp_tx.calls,
+                      stats_delivered[TR_QUIC], stats_delivered[TR_PEER], stats_dup);
+            next_sweep = now + SWEEP_MS;
+        }
+    }
+}
@@ -1,3 +1,37 @@
+// ------------------------------------------------------------
+// broker_quic.c (QUIC + TLS con quiche) - pub/sub por temas
+//
+// Protocolo por stream (líneas, igual que broker_tcp):
+//   SUB <tema> [urgencia] -> la conexión se suscribe al tema (admite varios SUB). El broker
+//                            abre un stream unidireccional propio para el tema, con la
+//                            urgencia pedida (0 = máxima, 7 = mínima, 3 por defecto).
+//   PUB <tema>     -> el stream queda como publicador del tema (un stream por tema).
+//   MSG <texto>    -> (en un stream PUB) se reenvía "<tema>: <texto>\n" solo a los suscriptores.
+//
+// Un stream por tema y por conexión: una pérdida o un mensaje grande en un tema no
+// frena la entrega de los demás (sin bloqueo de cabeza de línea entre temas), y quiche
+// envía primero los streams más urgentes.
+//
+// Temas "datagrama" (-D tema, o -D prefijo*): se entregan como frames QUIC DATAGRAM
+// ("<tema>: <texto>", sin reintentos ni orden) en vez de datos de stream; si el
+// suscriptor no negoció DATAGRAM o el mensaje no entra en uno, se usa el stream.
+//
+// Bucle de eventos: epoll sobre el socket (no bloqueante) y un timerfd armado en el
+// vencimiento más cercano entre todas las conexiones (montículo de plazos). Al vencer
+// se llama a quiche_conn_on_timeout() (retransmisiones, ACK diferidos, cierre por
+// inactividad) y las conexiones cerradas se liberan. Los paquetes se envían recién en
+// el instante send_info.at que indica quiche (ritmo/pacing del control de congestión).
+//
+// Reanudación: el broker emite tickets de sesión y acepta 0-RTT, así un cliente que
+// reconecta manda sus SUB/PUB en el primer vuelo. La clave de los tickets se genera al
+// arrancar (los tickets valen mientras el proceso vive) o se lee de -K archivo (48 bytes),
+// para que sobrevivan a un reinicio o sirvan en varios brokers.
+//
+// Salida agrupada: durante una ráfaga de recepción las conexiones con datos nuevos solo
+// se marcan "sucias"; al terminar la ráfaga cada una se vacía una vez y los paquetes de
+// todas salen juntos en un sendmmsg() (cada mensaje, un super-buffer GSO si hay soporte).
+// ------------------------------------------------------------
+#define _GNU_SOURCE         // sendmmsg(), recvmmsg() y struct mmsghdr.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,53 +39,860 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <inttypes.h>
 #include <openssl/rand.h>
 #include <quiche.h>
 
+#include "log_ring.h"
+#include "udp_gso.h"
+
 #define MAX_DATAGRAM_SIZE 1350
-#define MAX_CLIENTS 32
+#define LOCAL_CONN_ID_LEN 16      // largo de los CID que elige el broker
+#define MAX_CONN_IDS 2            // por cliente: nuestro SCID y el DCID original del cliente
+#define INITIAL_CLIENTS 64        // la tabla de clientes crece al doble cuando se llena
+#define INITIAL_CID_BUCKETS 256   // potencia de 2; se duplica con carga > 1/2
+#define LOG_RING_RECORDS 4096
+#define MAX_LINE 4096
+#define TOPIC_MAX 128
+#define TOPIC_BUCKETS 1024
+#define IDLE_TIMEOUT_MS 30000     // quiche cierra la conexión tras este tiempo sin tráfico
+#define PACING_SLACK_NS 200000    // paquetes con send_info.at dentro de 0.2 ms salen ya
+#define RX_BURST 256              // datagramas leídos por vuelta antes de atender timers
+#define RX_BATCH 32               // datagramas por recvmmsg()
+#define TX_MAX_MSGS 64            // mensajes (super-buffers GSO o datagramas) por sendmmsg()
+#define TX_BUF_BYTES (256 * 1024) // paquetes acumulados antes de enviar
+#define DGRAM_QUEUE_LEN 1024      // frames DATAGRAM en cola por conexión (se descartan si se llena)
+#define MAX_DGRAM_TOPICS 32       // patrones -D
+#define TICKET_KEY_LEN 48         // clave de tickets de sesión (formato de BoringSSL)
+#define DEFAULT_URGENCY 3         // prioridad de stream por defecto (RFC 9218)
+#define FIRST_SERVER_UNI 3        // streams unidireccionales del servidor: 3, 7, 11, ...
+
+typedef struct {
+    uint8_t len;
+    uint8_t id[QUICHE_MAX_CONN_ID_LEN];
+} ConnId;
+
+// Suscripción: índice del cliente (estable aunque la tabla crezca) y el stream
+// unidireccional por el que recibe ese tema.
+typedef struct {
+    int client;
+    uint64_t stream;
+} Subscriber;
+
+typedef struct Topic {
+    char name[TOPIC_MAX];
+    bool dgram;                   // entrega por frames DATAGRAM (-D)
+    Subscriber *subs;
+    size_t nsubs, cap;
+    struct Topic *next;
+} Topic;
+
+// Stream abierto por el cliente: línea en armado y, si hizo PUB, su tema.
+typedef struct {
+    uint64_t sid;
+    Topic *pub;
+    char *line;                   // los datos del stream llegan en pedazos
+    size_t line_len;
+} InStream;
 
 typedef struct {
     quiche_conn *conn;
-    struct sockaddr_in addr;
+    struct sockaddr_in addr;      // última dirección vista (puede cambiar: migración/NAT)
     socklen_t addr_len;
+    ConnId ids[MAX_CONN_IDS];     // CIDs registrados en el mapa para este cliente
+    int nids;
     bool in_use;
+    Topic **topics;               // temas suscriptos (para darse de baja al cerrar)
+    size_t ntopics, topics_cap;
+    uint64_t next_uni;            // próximo stream unidireccional para un tema
+    InStream *in;                 // streams abiertos por el cliente
+    size_t nin, in_cap;
+    uint64_t dropped;             // mensajes descartados por falta de crédito en su stream
+    uint64_t deadline;            // próximo plazo (ns CLOCK_MONOTONIC): timeout de quiche o paquete retenido
+    uint64_t quiche_deadline;     // vencimiento de quiche_conn_timeout (UINT64_MAX = ninguno)
+    int heap_pos;                 // posición en el montículo de plazos (-1 = fuera)
+    uint8_t *held;                // paquete retenido hasta su send_info.at (pacing)
+    size_t held_len;
+    struct sockaddr_storage held_to;
+    socklen_t held_to_len;
+    uint64_t held_at;
+    bool dirty;                   // en la lista de conexiones a vaciar al final de la ráfaga
+    bool early_seen;              // ya se informó que llegaron datos en 0-RTT
 } Client;
 
-static void pump_send(int sock, quiche_conn *c,
-                      struct sockaddr_in *to, socklen_t to_len,
-                      struct sockaddr_in *from, socklen_t from_len)
-{
-    if (!c) return;
-    uint8_t out[MAX_DATAGRAM_SIZE];
-    quiche_send_info s_info = {
-        .to = (struct sockaddr *)to,
-        .to_len = to_len,
-        .from = (struct sockaddr *)from,
-        .from_len = from_len
-    };
+static Topic *topic_buckets[TOPIC_BUCKETS];
+static const char *dgram_patterns[MAX_DGRAM_TOPICS];
+static int ndgram_patterns = 0;
+
+// Tabla de clientes: arreglo que crece con realloc; los lugares libres se reutilizan.
+static Client *clients = NULL;
+static size_t clients_cap = 0;
+static size_t clients_used = 0;   // índice más alto en uso + 1
+static size_t clients_live = 0;
+static int *free_slots = NULL;
+static size_t nfree = 0;
+static int *dirty = NULL;         // clientes con datos por enviar (mismo tamaño que la tabla)
+static size_t ndirty = 0;
+
+// Mapa CID -> índice de cliente: direccionamiento abierto con sondeo lineal.
+// idx == -1: vacío; idx == -2: borrado (lápida).
+typedef struct {
+    ConnId cid;
+    int idx;
+} CidEntry;
+
+static CidEntry *cid_map = NULL;
+static size_t cid_buckets = 0;
+static size_t cid_count = 0;      // entradas vivas + lápidas
+static size_t cid_live = 0;       // entradas vivas
+
+static bool gso_enabled = false; // el kernel acepta UDP_SEGMENT en el socket
+
+// Salida acumulada de todas las conexiones. Cada mensaje es un tramo contiguo de tx_buf:
+// paquetes seguidos del mismo tamaño hacia un mismo destino (más, quizás, uno final más
+// corto) que el kernel corta con UDP_SEGMENT, o un solo paquete si no hay GSO.
+typedef struct {
+    size_t off, len;              // tramo de tx_buf
+    uint16_t seg;                 // tamaño de segmento
+    uint16_t nsegs;
+    bool sealed;                  // terminó con un segmento más corto: no admite más
+    struct sockaddr_storage to;
+    socklen_t to_len;
+} TxMsg;
+
+static uint8_t tx_buf[TX_BUF_BYTES];
+static size_t tx_used = 0;
+static TxMsg tx_msgs[TX_MAX_MSGS];
+static size_t tx_nmsgs = 0;
+static size_t tx_pkts = 0;        // paquetes en el lote actual (para el log de depuración)
+
+// Montículo binario (mínimo) de índices de clientes ordenados por 'deadline'.
+static int *heap = NULL;
+static size_t heap_len = 0, heap_cap = 0;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// FNV-1a sobre los bytes del CID.
+static uint32_t cid_hash(const uint8_t *id, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= id[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool cid_equal(const ConnId *c, const uint8_t *id, size_t len) {
+    return c->len == len && memcmp(c->id, id, len) == 0;
+}
+
+// Índice del cliente con ese CID, o -1.
+static int cid_lookup(const uint8_t *id, size_t len) {
+    if (!cid_map) return -1;
+    size_t mask = cid_buckets - 1;
+    for (size_t b = cid_hash(id, len) & mask;; b = (b + 1) & mask) {
+        CidEntry *e = &cid_map[b];
+        if (e->idx == -1) return -1;
+        if (e->idx >= 0 && cid_equal(&e->cid, id, len)) return e->idx;
+    }
+}
+
+static void cid_put(CidEntry *map, size_t buckets, const ConnId *cid, int idx) {
+    size_t mask = buckets - 1;
+    size_t b = cid_hash(cid->id, cid->len) & mask;
+    while (map[b].idx >= 0) b = (b + 1) & mask;
+    map[b].cid = *cid;
+    map[b].idx = idx;
+}
+
+// Rehace el mapa con 'buckets' cubetas (descarta las lápidas).
+static bool cid_rehash(size_t buckets) {
+    CidEntry *nmap = (CidEntry *)malloc(buckets * sizeof(CidEntry));
+    if (!nmap) return false;
+    for (size_t b = 0; b < buckets; b++) nmap[b].idx = -1;
+    size_t live = 0;
+    for (size_t b = 0; b < cid_buckets; b++) {
+        if (cid_map[b].idx >= 0) {
+            cid_put(nmap, buckets, &cid_map[b].cid, cid_map[b].idx);
+            live++;
+        }
+    }
+    free(cid_map);
+    cid_map = nmap;
+    cid_buckets = buckets;
+    cid_count = cid_live = live;
+    return true;
+}
+
+static bool cid_insert(const uint8_t *id, size_t len, int idx) {
+    if (len == 0 || len > QUICHE_MAX_CONN_ID_LEN) return false;
+    if (!cid_map && !cid_rehash(INITIAL_CID_BUCKETS)) return false;
+    // Al pasar media carga (vivas + lápidas) se rehace la tabla: al doble solo si las vivas
+    // pasan un cuarto; si no, del mismo tamaño, lo que barre las lápidas que deja el
+    // recambio de conexiones sin que la tabla crezca con el total histórico.
+    if ((cid_count + 1) * 2 > cid_buckets &&
+        !cid_rehash((cid_live + 1) * 4 > cid_buckets ? cid_buckets * 2 : cid_buckets)) {
+        return false;
+    }
+    ConnId cid = { (uint8_t)len, {0} };
+    memcpy(cid.id, id, len);
+    cid_put(cid_map, cid_buckets, &cid, idx);
+    cid_count++;
+    cid_live++;
+    return true;
+}
+
+static void cid_remove(const ConnId *cid) {
+    if (!cid_map) return;
+    size_t mask = cid_buckets - 1;
+    for (size_t b = cid_hash(cid->id, cid->len) & mask;; b = (b + 1) & mask) {
+        CidEntry *e = &cid_map[b];
+        if (e->idx == -1) return;
+        if (e->idx >= 0 && cid_equal(&e->cid, cid->id, cid->len)) {
+            e->idx = -2;
+            cid_live--;
+            return;
+        }
+    }
+}
+
+// Reserva un lugar en la tabla de clientes (creciendo si hace falta). -1 si no hay memoria.
+static int client_alloc(void) {
+    int idx;
+    if (nfree > 0) {
+        idx = free_slots[--nfree];
+    } else {
+        if (clients_used == clients_cap) {
+            size_t ncap = clients_cap ? clients_cap * 2 : INITIAL_CLIENTS;
+            Client *nc = (Client *)realloc(clients, ncap * sizeof(Client));
+            if (!nc) return -1;
+            clients = nc;
+            int *nf = (int *)realloc(free_slots, ncap * sizeof(int));
+            if (!nf) return -1;
+            free_slots = nf;
+            int *nd = (int *)realloc(dirty, ncap * sizeof(int));
+            if (!nd) return -1;
+            dirty = nd;
+            clients_cap = ncap;
+        }
+        idx = (int)clients_used++;
+    }
+    memset(&clients[idx], 0, sizeof(Client));
+    clients[idx].in_use = true;
+    clients[idx].next_uni = FIRST_SERVER_UNI;
+    clients[idx].heap_pos = -1;
+    clients_live++;
+    return idx;
+}
+
+static void heap_swap(size_t a, size_t b) {
+    int t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+    clients[heap[a]].heap_pos = (int)a;
+    clients[heap[b]].heap_pos = (int)b;
+}
+
+static void heap_up(size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (clients[heap[parent]].deadline <= clients[heap[i]].deadline) break;
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void heap_down(size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < heap_len && clients[heap[l]].deadline < clients[heap[m]].deadline) m = l;
+        if (r < heap_len && clients[heap[r]].deadline < clients[heap[m]].deadline) m = r;
+        if (m == i) break;
+        heap_swap(i, m);
+        i = m;
+    }
+}
+
+static void heap_remove(int idx) {
+    int pos = clients[idx].heap_pos;
+    if (pos < 0) return;
+    clients[idx].heap_pos = -1;
+    heap_len--;
+    if ((size_t)pos == heap_len) return;
+    heap[pos] = heap[heap_len];
+    clients[heap[pos]].heap_pos = pos;
+    heap_up((size_t)pos);
+    heap_down((size_t)clients[heap[pos]].heap_pos);
+}
+
+// Recalcula el plazo del cliente (timeout de quiche, paquete retenido o, si la
+// conexión ya cerró, "ya mismo" para liberarla) y lo reubica en el montículo.
+static void client_schedule(int idx) {
+    Client *cl = &clients[idx];
+    uint64_t now = mono_ns();
+    uint64_t t = quiche_conn_timeout_as_nanos(cl->conn);
+    cl->quiche_deadline = t == UINT64_MAX ? UINT64_MAX : now + t;
+    cl->deadline = cl->quiche_deadline;
+    if (cl->held_len > 0 && cl->held_at < cl->deadline) cl->deadline = cl->held_at;
+    if (quiche_conn_is_closed(cl->conn)) cl->deadline = 1;
+
+    if (cl->deadline == UINT64_MAX) {
+        heap_remove(idx);
+        return;
+    }
+    if (cl->heap_pos < 0) {
+        if (heap_len == heap_cap) {
+            size_t ncap = heap_cap ? heap_cap * 2 : INITIAL_CLIENTS;
+            int *nh = (int *)realloc(heap, ncap * sizeof(int));
+            if (!nh) return;
+            heap = nh;
+            heap_cap = ncap;
+        }
+        heap[heap_len] = idx;
+        cl->heap_pos = (int)heap_len++;
+    }
+    heap_up((size_t)cl->heap_pos);
+    heap_down((size_t)cl->heap_pos);
+}
+
+static void client_add_id(int idx, const uint8_t *id, size_t len) {
+    Client *cl = &clients[idx];
+    if (cl->nids == MAX_CONN_IDS || !cid_insert(id, len, idx)) return;
+    cl->ids[cl->nids].len = (uint8_t)len;
+    memcpy(cl->ids[cl->nids].id, id, len);
+    cl->nids++;
+}
+
+static uint32_t topic_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Busca un tema; si no existe y 'create', lo crea.
+static Topic *find_topic(const char *name, bool create) {
+    Topic **bucket = &topic_buckets[topic_hash(name) % TOPIC_BUCKETS];
+    for (Topic *t = *bucket; t; t = t->next) {
+        if (strcmp(t->name, name) == 0) return t;
+    }
+    if (!create) return NULL;
+    Topic *t = (Topic *)calloc(1, sizeof(Topic));
+    if (!t) return NULL;
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    for (int i = 0; i < ndgram_patterns; i++) {
+        const char *p = dgram_patterns[i];
+        size_t pl = strlen(p);
+        if (pl > 0 && p[pl - 1] == '*' ? strncmp(name, p, pl - 1) == 0 : strcmp(name, p) == 0) {
+            t->dgram = true;
+        }
+    }
+    t->next = *bucket;
+    *bucket = t;
+    log_info("[broker] Tema nuevo creado: '%s'%s\n", name, t->dgram ? " (DATAGRAM)" : "");
+    return t;
+}
+
+static void subscribe(int idx, const char *name, int urgency) {
+    Client *cl = &clients[idx];
+    Topic *t = find_topic(name, true);
+    if (!t) return;
+    for (size_t i = 0; i < cl->ntopics; i++) {
+        if (cl->topics[i] == t) return; // ya suscripto
+    }
+    if (t->nsubs == t->cap) {
+        size_t ncap = t->cap ? t->cap * 2 : 4;
+        Subscriber *ns = (Subscriber *)realloc(t->subs, ncap * sizeof(Subscriber));
+        if (!ns) return;
+        t->subs = ns;
+        t->cap = ncap;
+    }
+    if (cl->ntopics == cl->topics_cap) {
+        size_t ncap = cl->topics_cap ? cl->topics_cap * 2 : 4;
+        Topic **nt = (Topic **)realloc(cl->topics, ncap * sizeof(Topic *));
+        if (!nt) return;
+        cl->topics = nt;
+        cl->topics_cap = ncap;
+    }
+    // quiche crea el stream al fijarle la prioridad; los mensajes del tema van por él.
+    uint64_t sid = cl->next_uni;
+    if (quiche_conn_stream_priority(cl->conn, sid, (uint8_t)urgency, true) < 0) {
+        log_warn("[broker] Cliente %d: sin streams para '%s' (límite del cliente)\n", idx, name);
+        return;
+    }
+    cl->next_uni += 4;
+    t->subs[t->nsubs].client = idx;
+    t->subs[t->nsubs].stream = sid;
+    t->nsubs++;
+    cl->topics[cl->ntopics++] = t;
+    log_info("[broker] Cliente %d suscrito a '%s' (stream %" PRIu64 ", urgencia %d)\n", idx, name, sid, urgency);
+}
+
+static void unsubscribe_all(int idx) {
+    Client *cl = &clients[idx];
+    for (size_t i = 0; i < cl->ntopics; i++) {
+        Topic *t = cl->topics[i];
+        for (size_t k = 0; k < t->nsubs; k++) {
+            if (t->subs[k].client == idx) {
+                t->subs[k] = t->subs[--t->nsubs];
+                break;
+            }
+        }
+    }
+    free(cl->topics);
+}
+
+// Libera la conexión, sus CIDs del mapa, sus suscripciones y el lugar en la tabla.
+static void client_free(int idx) {
+    Client *cl = &clients[idx];
+    for (int i = 0; i < cl->nids; i++) cid_remove(&cl->ids[i]);
+    unsubscribe_all(idx);
+    heap_remove(idx);
+    if (cl->dirty) {
+        for (size_t i = 0; i < ndirty; i++) {
+            if (dirty[i] == idx) {
+                dirty[i] = dirty[--ndirty];
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < cl->nin; i++) free(cl->in[i].line);
+    free(cl->in);
+    free(cl->held);
+    if (cl->conn) quiche_conn_free(cl->conn);
+    memset(cl, 0, sizeof(*cl));
+    free_slots[nfree++] = idx;
+    clients_live--;
+}
+
+static uint64_t timespec_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000ull + (uint64_t)ts->tv_nsec;
+}
+
+// Envía todo lo acumulado con sendmmsg(). Si el kernel rechaza GSO se desactiva y el
+// tramo sale datagrama por datagrama; otros errores (EAGAIN) descartan el mensaje:
+// quiche lo detecta como pérdida y retransmite.
+static void tx_flush(int sock) {
+    if (tx_nmsgs == 0) return;
+    struct mmsghdr mm[TX_MAX_MSGS];
+    struct iovec iov[TX_MAX_MSGS];
+    char ctrl[TX_MAX_MSGS][CMSG_SPACE(sizeof(uint16_t))];
+    memset(mm, 0, sizeof(mm));
+    memset(ctrl, 0, sizeof(ctrl));
+    for (size_t i = 0; i < tx_nmsgs; i++) {
+        TxMsg *m = &tx_msgs[i];
+        iov[i].iov_base = tx_buf + m->off;
+        iov[i].iov_len = m->len;
+        mm[i].msg_hdr.msg_name = &m->to;
+        mm[i].msg_hdr.msg_namelen = m->to_len;
+        mm[i].msg_hdr.msg_iov = &iov[i];
+        mm[i].msg_hdr.msg_iovlen = 1;
+        if (m->nsegs > 1) {
+            mm[i].msg_hdr.msg_control = ctrl[i];
+            mm[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+            struct cmsghdr *cm = CMSG_FIRSTHDR(&mm[i].msg_hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cm), &m->seg, sizeof(m->seg));
+        }
+    }
+
+    size_t calls = 0, i = 0;
+    while (i < tx_nmsgs) {
+        int r = sendmmsg(sock, mm + i, (unsigned)(tx_nmsgs - i), 0);
+        calls++;
+        if (r > 0) {
+            i += (size_t)r;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        TxMsg *m = &tx_msgs[i];
+        if (m->nsegs > 1 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+            gso_enabled = false; // sin soporte real (p.ej. la interfaz no hace checksum offload)
+            for (size_t o = 0; o < m->len; o += m->seg) {
+                size_t l = m->len - o < m->seg ? m->len - o : m->seg;
+                sendto(sock, tx_buf + m->off + o, l, 0, (struct sockaddr *)&m->to, m->to_len);
+                calls++;
+            }
+        }
+        i++;
+    }
+    log_debug("[broker] %zu paquete(s) en %zu mensaje(s), %zu llamada(s)\n", tx_pkts, tx_nmsgs, calls);
+    tx_used = 0;
+    tx_nmsgs = 0;
+    tx_pkts = 0;
+}
+
+// Lugar donde escribir el próximo paquete (con espacio para MAX_DATAGRAM_SIZE bytes).
+static uint8_t *tx_reserve(int sock) {
+    if (tx_used + MAX_DATAGRAM_SIZE > sizeof(tx_buf) || tx_nmsgs == TX_MAX_MSGS) tx_flush(sock);
+    return tx_buf + tx_used;
+}
+
+// Agrega el paquete recién escrito en tx_reserve(): se suma al último mensaje si va al
+// mismo destino y puede ser un segmento más de su super-buffer GSO.
+static void tx_commit(size_t len, const struct sockaddr_storage *to, socklen_t to_len) {
+    TxMsg *m = tx_nmsgs > 0 ? &tx_msgs[tx_nmsgs - 1] : NULL;
+    if (m && gso_enabled && !m->sealed && len <= m->seg && m->nsegs < UDP_GSO_MAX_SEGS &&
+        m->len + len <= UDP_GSO_MAX_BYTES && to_len == m->to_len && memcmp(to, &m->to, to_len) == 0) {
+        m->len += len;
+        m->nsegs++;
+        if (len < m->seg) m->sealed = true;
+    } else {
+        m = &tx_msgs[tx_nmsgs++];
+        m->off = tx_used;
+        m->len = len;
+        m->seg = (uint16_t)len;
+        m->nsegs = 1;
+        m->sealed = false;
+        memcpy(&m->to, to, to_len);
+        m->to_len = to_len;
+    }
+    tx_used += len;
+    tx_pkts++;
+}
+
+// Pasa a tx_buf los paquetes pendientes del cliente (salen en el próximo tx_flush).
+// Un paquete cuyo send_info.at todavía no llegó se retiene y sale cuando vence su plazo.
+static void pump_send(int sock, int idx) {
+    Client *cl = &clients[idx];
+    if (!cl->conn) return;
+    uint64_t now = mono_ns();
+
+    if (cl->held_len > 0) {
+        if (cl->held_at > now + PACING_SLACK_NS) {
+            client_schedule(idx); // todavía no: el timer lo despierta
+            return;
+        }
+        memcpy(tx_reserve(sock), cl->held, cl->held_len);
+        tx_commit(cl->held_len, &cl->held_to, cl->held_to_len);
+        cl->held_len = 0;
+    }
 
     for (;;) {
-        ssize_t n = quiche_conn_send(c, out, sizeof(out), &s_info);
-        if (n == QUICHE_ERR_DONE) break;
-        if (n < 0) break;
-        sendto(sock, out, n, 0, (struct sockaddr *)to, to_len);
+        quiche_send_info s_info; // lo completa quiche (destino, origen, instante)
+        uint8_t *out = tx_reserve(sock);
+        ssize_t n = quiche_conn_send(cl->conn, out, MAX_DATAGRAM_SIZE, &s_info);
+        if (n < 0) break; // QUICHE_ERR_DONE: no hay más
+        uint64_t at = timespec_ns(&s_info.at);
+        if (at > now + PACING_SLACK_NS && (cl->held || (cl->held = (uint8_t *)malloc(MAX_DATAGRAM_SIZE)))) {
+            // el control de congestión pide esperar: se retiene y se envía lo anterior
+            memcpy(cl->held, out, (size_t)n);
+            cl->held_len = (size_t)n;
+            cl->held_to = s_info.to;
+            cl->held_to_len = s_info.to_len;
+            cl->held_at = at;
+            break;
+        }
+        tx_commit((size_t)n, &s_info.to, s_info.to_len);
+    }
+    client_schedule(idx);
+}
+
+// Anota al cliente para vaciarlo al final de la ráfaga (una vez, aunque reciba muchos mensajes).
+static void mark_dirty(int idx) {
+    Client *cl = &clients[idx];
+    if (cl->dirty) return;
+    cl->dirty = true;
+    dirty[ndirty++] = idx;
+}
+
+// Vacía una vez cada conexión marcada durante la ráfaga.
+static void flush_dirty(int sock) {
+    for (size_t i = 0; i < ndirty; i++) {
+        Client *cl = &clients[dirty[i]];
+        cl->dirty = false;
+        pump_send(sock, dirty[i]);
+    }
+    ndirty = 0;
+}
+
+// Envía "<tema>: <texto>\n" a cada suscriptor del tema, por su stream, o como frame
+// DATAGRAM (sin el '\n') si el tema es de datagramas y el suscriptor los acepta.
+static void route_message(Topic *t, const char *text, size_t len) {
+    char out[TOPIC_MAX + MAX_LINE + 4];
+    int hdr = snprintf(out, sizeof(out), "%s: ", t->name);
+    if (len > sizeof(out) - (size_t)hdr - 1) len = sizeof(out) - (size_t)hdr - 1;
+    memcpy(out + hdr, text, len);
+    size_t total = (size_t)hdr + len;
+    out[total++] = '\n';
+    for (size_t i = 0; i < t->nsubs; i++) {
+        Subscriber *s = &t->subs[i];
+        Client *sub = &clients[s->client];
+        uint64_t err = 0;
+        if (t->dgram) {
+            ssize_t max = quiche_conn_dgram_max_writable_len(sub->conn);
+            if (max >= (ssize_t)(total - 1)) {
+                // cola llena (QUICHE_ERR_DONE): se descarta, como en UDP
+                quiche_conn_dgram_send(sub->conn, (const uint8_t *)out, total - 1);
+                mark_dirty(s->client);
+                continue;
+            }
+        }
+        // Solo líneas completas: sin crédito en el stream de este tema el mensaje se
+        // descarta para este suscriptor (los demás temas siguen su curso).
+        if (quiche_conn_stream_capacity(sub->conn, s->stream) < (ssize_t)total) {
+            sub->dropped++;
+            continue;
+        }
+        quiche_conn_stream_send(sub->conn, s->stream, (const uint8_t *)out, total, false, &err);
+        mark_dirty(s->client);
+    }
+}
+
+static void reply(Client *cl, uint64_t sid, const char *msg) {
+    uint64_t err = 0;
+    quiche_conn_stream_send(cl->conn, sid, (const uint8_t *)msg, strlen(msg), false, &err);
+}
+
+// Una línea completa (sin '\n') recibida del cliente 'idx' por el stream 'st'.
+static void handle_line(int idx, InStream *st, char *line, size_t len) {
+    Client *cl = &clients[idx];
+    char cmd[8] = {0}, topic[TOPIC_MAX] = {0};
+    int urgency = DEFAULT_URGENCY;
+    line[len] = '\0';
+    if (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+
+    if (st->pub) {
+        // Los datos 0-RTT pueden ser repetidos por un atacante: en early data solo se aceptan
+        // SUB y PUB (idempotentes); un MSG se rechaza y el cliente lo reenvía tras el handshake.
+        if (strncmp(line, "MSG ", 4) == 0 && quiche_conn_is_in_early_data(cl->conn)) {
+            log_warn("[broker] Cliente %d: MSG en 0-RTT rechazado ('%s')\n", idx, st->pub->name);
+            reply(cl, st->sid, "WARN: MSG en 0-RTT rechazado, reenviar tras el handshake\n");
+        } else if (strncmp(line, "MSG ", 4) == 0) {
+            log_info("[broker] Publicación en '%s': %s\n", st->pub->name, line + 4);
+            route_message(st->pub, line + 4, len - 4);
+        } else {
+            reply(cl, st->sid, "WARN: use 'MSG <texto>'\n");
+        }
+        return;
+    }
+    if (sscanf(line, "%7s %127s %d", cmd, topic, &urgency) < 2) {
+        reply(cl, st->sid, "ERR protocolo: use 'SUB <tema> [urgencia]' o 'PUB <tema>'\n");
+        return;
+    }
+    if (urgency < 0 || urgency > 7) urgency = DEFAULT_URGENCY;
+    if (strcmp(cmd, "SUB") == 0) {
+        subscribe(idx, topic, urgency);
+    } else if (strcmp(cmd, "PUB") == 0) {
+        Topic *t = find_topic(topic, true);
+        if (!t) return;
+        st->pub = t;
+        log_info("[broker] Cliente %d publica en '%s' (stream %" PRIu64 ")\n", idx, topic, st->sid);
+    } else {
+        reply(cl, st->sid, "ERR comando desconocido\n");
+    }
+}
+
+// Estado del stream 'sid' del cliente (se crea al primer dato). NULL si no hay memoria.
+static InStream *client_stream(Client *cl, uint64_t sid) {
+    for (size_t i = 0; i < cl->nin; i++) {
+        if (cl->in[i].sid == sid) return &cl->in[i];
+    }
+    if (cl->nin == cl->in_cap) {
+        size_t ncap = cl->in_cap ? cl->in_cap * 2 : 4;
+        InStream *ni = (InStream *)realloc(cl->in, ncap * sizeof(InStream));
+        if (!ni) return NULL;
+        cl->in = ni;
+        cl->in_cap = ncap;
     }
+    InStream *st = &cl->in[cl->nin];
+    memset(st, 0, sizeof(*st));
+    st->sid = sid;
+    if (!(st->line = (char *)malloc(MAX_LINE))) return NULL;
+    cl->nin++;
+    return st;
+}
+
+// Junta los datos de cada stream del cliente en líneas.
+static void handle_stream_data(int idx, uint64_t sid, const uint8_t *data, size_t len) {
+    InStream *st = client_stream(&clients[idx], sid);
+    if (!st) return;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            handle_line(idx, st, st->line, st->line_len);
+            st->line_len = 0;
+        } else if (st->line_len < MAX_LINE - 1) {
+            st->line[st->line_len++] = (char)data[i];
+        }
+    }
+}
+
+// Procesa un datagrama recibido: ubica (o crea) la conexión por DCID, se lo entrega
+// a quiche, atiende los streams legibles y marca la conexión para vaciarla.
+static void process_packet(int sock, quiche_config *config, const struct sockaddr_in *server_addr,
+                           uint8_t *in, ssize_t n, struct sockaddr_in peer, socklen_t peer_len) {
+    // El cliente se identifica por el DCID del paquete, no por IP:puerto.
+    uint8_t type;
+    uint32_t version;
+    uint8_t scid[QUICHE_MAX_CONN_ID_LEN], dcid[QUICHE_MAX_CONN_ID_LEN];
+    size_t scid_len = sizeof(scid), dcid_len = sizeof(dcid);
+    uint8_t token[256];
+    size_t token_len = sizeof(token);
+    if (quiche_header_info(in, (size_t)n, LOCAL_CONN_ID_LEN, &version, &type,
+                           scid, &scid_len, dcid, &dcid_len, token, &token_len) < 0) {
+        return; // no es QUIC
+    }
+
+    int idx = cid_lookup(dcid, dcid_len);
+    if (idx < 0) {
+        if (!quiche_version_is_supported(version)) {
+            uint8_t vn[MAX_DATAGRAM_SIZE];
+            ssize_t vlen = quiche_negotiate_version(scid, scid_len, dcid, dcid_len, vn, sizeof(vn));
+            if (vlen > 0) sendto(sock, vn, (size_t)vlen, 0, (struct sockaddr *)&peer, peer_len);
+            return;
+        }
+        // Solo un Initial puede abrir conexión (y debe venir con el relleno mínimo);
+        // otros paquetes con CID desconocido se descartan.
+        if (n < QUICHE_MIN_CLIENT_INITIAL_LEN) return;
+
+        idx = client_alloc();
+        if (idx < 0) {
+            log_warn("[broker] ❌ sin memoria para más clientes\n");
+            return;
+        }
+        uint8_t new_scid[LOCAL_CONN_ID_LEN];
+        RAND_bytes(new_scid, sizeof(new_scid));
+        quiche_conn *c = quiche_accept(
+            new_scid, sizeof(new_scid),
+            NULL, 0,
+            (const struct sockaddr *)server_addr, sizeof(*server_addr),
+            (const struct sockaddr *)&peer, peer_len,
+            config
+        );
+        if (!c) {
+            log_warn("[broker] ❌ quiche_accept falló\n");
+            client_free(idx);
+            return;
+        }
+
+        clients[idx].conn = c;
+        // Los paquetes siguientes usan nuestro SCID; los Initial retransmitidos,
+        // el DCID que eligió el cliente. Se registran los dos.
+        client_add_id(idx, new_scid, sizeof(new_scid));
+        client_add_id(idx, dcid, dcid_len);
+        log_info("[broker] nuevo cliente %I:%d (slot %d, %zu conectados)\n",
+                 peer.sin_addr.s_addr, ntohs(peer.sin_port), idx, clients_live);
+    }
+
+    Client *cl = &clients[idx];
+    cl->addr = peer; // si el cliente migró, quiche valida la ruta nueva
+    cl->addr_len = peer_len;
+
+    quiche_recv_info r_info = {
+        .from = (struct sockaddr *)&peer,
+        .from_len = peer_len,
+        .to = (struct sockaddr *)server_addr,
+        .to_len = sizeof(*server_addr),
+    };
+    quiche_conn_recv(cl->conn, in, n, &r_info);
+
+    // leer streams legibles
+    quiche_stream_iter *it = quiche_conn_readable(cl->conn);
+    if (it) {
+        uint64_t sid;
+        while (quiche_stream_iter_next(it, &sid)) {
+            for (;;) {
+                uint8_t sbuf[4096];
+                bool fin = false;
+                uint64_t err = 0;
+                ssize_t got = quiche_conn_stream_recv(cl->conn, sid, sbuf, sizeof(sbuf), &fin, &err);
+                if (got == QUICHE_ERR_DONE) break;
+                if (got < 0) break;
+                log_debug("[broker] sid=%" PRIu64 " <- %zd bytes\n", sid, got);
+                if (!cl->early_seen && quiche_conn_is_in_early_data(cl->conn)) {
+                    cl->early_seen = true;
+                    log_info("[broker] cliente del slot %d: datos 0-RTT aceptados\n", idx);
+                }
+                handle_stream_data(idx, sid, sbuf, (size_t)got);
+            }
+        }
+        quiche_stream_iter_free(it);
+    }
+
+    mark_dirty(idx);
+}
+
+// Atiende los clientes cuyo plazo venció: paquetes retenidos por pacing, timers de
+// quiche (pérdidas, ACK, inactividad) y conexiones cerradas, que se liberan.
+static void run_timers(int sock) {
+    uint64_t now = mono_ns();
+    size_t budget = heap_len; // cada cliente a lo sumo una vez por vuelta
+    while (heap_len > 0 && budget-- > 0) {
+        int idx = heap[0];
+        Client *cl = &clients[idx];
+        if (cl->deadline > now) break;
+        if (!quiche_conn_is_closed(cl->conn) && now >= cl->quiche_deadline) {
+            quiche_conn_on_timeout(cl->conn);
+        }
+        if (!quiche_conn_is_closed(cl->conn)) pump_send(sock, idx);
+        if (quiche_conn_is_closed(cl->conn)) {
+            log_info("[broker] cliente del slot %d cerrado%s (%zu conectados, %" PRIu64 " mensaje(s) descartados)\n",
+                     idx, quiche_conn_is_timed_out(cl->conn) ? " por inactividad" : "", clients_live - 1,
+                     cl->dropped);
+            client_free(idx);
+        }
+    }
+}
+
+// Arma el timerfd para el plazo más cercano (o lo desarma si no hay ninguno).
+static void arm_timer(int tfd) {
+    struct itimerspec its = {0};
+    if (heap_len > 0) {
+        uint64_t d = clients[heap[0]].deadline;
+        its.it_value.tv_sec = (time_t)(d / 1000000000ull);
+        its.it_value.tv_nsec = (long)(d % 1000000000ull);
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
 }
 
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s <puerto> <cert.pem> <key.pem>\n", argv[0]);
+    int level = LOGL_INFO;
+    int opt;
+    const char *ticket_key_file = NULL;
+    while ((opt = getopt(argc, argv, "L:D:K:")) != -1) {
+        if (opt == 'D' && ndgram_patterns < MAX_DGRAM_TOPICS) {
+            dgram_patterns[ndgram_patterns++] = optarg;
+            continue;
+        }
+        if (opt == 'K') {
+            ticket_key_file = optarg;
+            continue;
+        }
+        if (opt != 'L' || (level = log_parse_level(optarg)) < 0) {
+            fprintf(stderr, "Uso: %s [-L error|warn|info|debug] [-D tema|prefijo*]... [-K ticket.key] <puerto> <cert.pem> <key.pem>\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        fprintf(stderr, "Uso: %s [-L error|warn|info|debug] [-D tema|prefijo*]... [-K ticket.key] <puerto> <cert.pem> <key.pem>\n",
+                argv[0]);
         return 1;
     }
 
-    int port = atoi(argv[1]);
-    const char *cert_file = argv[2];
-    const char *key_file = argv[3];
+    int port = atoi(argv[optind]);
+    const char *cert_file = argv[optind + 1];
+    const char *key_file = argv[optind + 2];
+    if (log_init((LogLevel)level, LOG_RING_RECORDS) != 0) {
+        fprintf(stderr, "[broker] ❌ No se pudo iniciar el hilo de log\n");
+        return 1;
+    }
 
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
     if (sock < 0) { perror("socket"); return 1; }
 
     struct sockaddr_in server_addr = {0};
@@ -62,6 +903,7 @@ int main(int argc, char **argv) {
     if (bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         perror("bind"); return 1;
     }
+    gso_enabled = udp_gso_probe(sock);
 
     quiche_config *config = quiche_config_new(QUICHE_PROTOCOL_VERSION);
     if (!config) {
@@ -74,100 +916,96 @@ int main(int argc, char **argv) {
         return 1;
     }
     quiche_config_verify_peer(config, false);
+    quiche_config_set_max_idle_timeout(config, IDLE_TIMEOUT_MS);
+    quiche_config_enable_dgram(config, true, DGRAM_QUEUE_LEN, DGRAM_QUEUE_LEN);
+    // Créditos de flujo para los streams de los clientes. El cliente los recuerda con el
+    // ticket y los usa para escribir en 0-RTT antes de conocer los parámetros nuevos.
+    quiche_config_set_initial_max_data(config, 10 * 1024 * 1024);
+    quiche_config_set_initial_max_stream_data_bidi_local(config, 5 * 1024 * 1024);
+    quiche_config_set_initial_max_stream_data_bidi_remote(config, 5 * 1024 * 1024);
+    quiche_config_set_initial_max_streams_bidi(config, 100);
+    quiche_config_enable_early_data(config);
+
+    uint8_t ticket_key[TICKET_KEY_LEN];
+    if (ticket_key_file) {
+        FILE *kf = fopen(ticket_key_file, "rb");
+        size_t got = kf ? fread(ticket_key, 1, sizeof(ticket_key), kf) : 0;
+        if (kf) fclose(kf);
+        if (got != sizeof(ticket_key)) {
+            fprintf(stderr, "[broker] ❌ %s debe tener %d bytes (p.ej. head -c %d /dev/urandom)\n",
+                    ticket_key_file, TICKET_KEY_LEN, TICKET_KEY_LEN);
+            return 1;
+        }
+    } else {
+        RAND_bytes(ticket_key, sizeof(ticket_key));
+    }
+    if (quiche_config_set_ticket_key(config, ticket_key, sizeof(ticket_key)) < 0) {
+        fprintf(stderr, "[broker] ❌ clave de tickets inválida\n");
+        return 1;
+    }
     if (quiche_config_set_application_protos(config,
         (uint8_t*)"\x05hq-29\x08http/0.9", 14) < 0) {
         fprintf(stderr, "[broker] ❌ ALPN inválido\n");
         return 1;
     }
 
-    Client clients[MAX_CLIENTS] = {0};
+    int ep = epoll_create1(0);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (ep < 0 || tfd < 0) {
+        perror("epoll/timerfd");
+        return 1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = sock;
+    epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev);
+    ev.data.fd = tfd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev);
 
     printf("[broker] 🟢 Escuchando en %d\n", port);
 
+    static uint8_t rx_buf[RX_BATCH][MAX_DATAGRAM_SIZE];
+    static struct sockaddr_in rx_peer[RX_BATCH];
+    struct iovec rx_iov[RX_BATCH];
+    struct mmsghdr rx_msgs[RX_BATCH];
+    memset(rx_msgs, 0, sizeof(rx_msgs));
+
     for (;;) {
-        uint8_t in[MAX_DATAGRAM_SIZE];
-        struct sockaddr_in peer = {0};
-        socklen_t peer_len = sizeof(peer);
-
-        ssize_t n = recvfrom(sock, in, sizeof(in), 0, (struct sockaddr *)&peer, &peer_len);
-        if (n < 0) continue;
-
-        // buscar cliente
-        int idx = -1;
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (clients[i].in_use &&
-                clients[i].addr.sin_addr.s_addr == peer.sin_addr.s_addr &&
-                clients[i].addr.sin_port == peer.sin_port) {
-                idx = i;
-                break;
-            }
+        struct epoll_event evs[2];
+        int ne = epoll_wait(ep, evs, 2, -1);
+        if (ne < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return 1;
         }
-
-        if (idx < 0) {
-            for (int i = 0; i < MAX_CLIENTS; i++) {
-                if (!clients[i].in_use) { idx = i; break; }
-            }
-            if (idx < 0) continue;
-
-            uint8_t scid[16];
-            RAND_bytes(scid, sizeof(scid));
-            quiche_conn *c = quiche_accept(
-                scid, sizeof(scid),
-                NULL, 0,
-                (const struct sockaddr *)&server_addr, sizeof(server_addr),
-                (const struct sockaddr *)&peer, peer_len,
-                config
-            );
-            if (!c) {
-                fprintf(stderr, "[broker] ❌ quiche_accept falló\n");
+        for (int e = 0; e < ne; e++) {
+            if (evs[e].data.fd == tfd) {
+                uint64_t expirations;
+                ssize_t r = read(tfd, &expirations, sizeof(expirations));
+                (void)r;
                 continue;
             }
-
-            clients[idx].conn = c;
-            clients[idx].addr = peer;
-            clients[idx].addr_len = peer_len;
-            clients[idx].in_use = true;
-            printf("[broker] nuevo cliente %s:%d (slot %d)\n",
-                   inet_ntoa(peer.sin_addr), ntohs(peer.sin_port), idx);
-        }
-
-        Client *cl = &clients[idx];
-        if (!cl->conn) continue;
-
-        quiche_recv_info r_info = {
-            .from = (struct sockaddr *)&peer,
-            .from_len = peer_len,
-            .to = (struct sockaddr *)&server_addr,
-            .to_len = sizeof(server_addr),
-        };
-        quiche_conn_recv(cl->conn, in, n, &r_info);
-
-        // leer streams legibles
-        quiche_stream_iter *it = quiche_conn_readable(cl->conn);
-        if (!it) continue;
-        uint64_t sid;
-        while (quiche_stream_iter_next(it, &sid)) {
-            for (;;) {
-                uint8_t sbuf[4096];
-                bool fin = false;
-                uint64_t err = 0;
-                ssize_t got = quiche_conn_stream_recv(cl->conn, sid, sbuf, sizeof(sbuf), &fin, &err);
-                if (got == QUICHE_ERR_DONE) break;
-                if (got < 0) break;
-                printf("[broker] msg sid=%" PRIu64 " -> %.*s\n", sid, (int)got, sbuf);
-
-                for (int j = 0; j < MAX_CLIENTS; j++) {
-                    if (!clients[j].in_use || !clients[j].conn) continue;
-                    quiche_conn_stream_send(clients[j].conn, sid, sbuf, got, false, &err);
-                    pump_send(sock, clients[j].conn,
-                              &clients[j].addr, clients[j].addr_len,
-                              &server_addr, sizeof(server_addr));
+            // Socket: se leen hasta RX_BURST datagramas (de a RX_BATCH por recvmmsg),
+            // luego se vacían las conexiones afectadas y se atienden los timers.
+            for (int k = 0; k < RX_BURST; k += RX_BATCH) {
+                for (int j = 0; j < RX_BATCH; j++) {
+                    rx_iov[j].iov_base = rx_buf[j];
+                    rx_iov[j].iov_len = sizeof(rx_buf[j]);
+                    rx_msgs[j].msg_hdr.msg_name = &rx_peer[j];
+                    rx_msgs[j].msg_hdr.msg_namelen = sizeof(rx_peer[j]);
+                    rx_msgs[j].msg_hdr.msg_iov = &rx_iov[j];
+                    rx_msgs[j].msg_hdr.msg_iovlen = 1;
                 }
+                int got = recvmmsg(sock, rx_msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+                if (got <= 0) break; // EAGAIN: no hay más
+                for (int j = 0; j < got; j++) {
+                    process_packet(sock, config, &server_addr, rx_buf[j], (ssize_t)rx_msgs[j].msg_len,
+                                   rx_peer[j], rx_msgs[j].msg_hdr.msg_namelen);
+                }
+                if (got < RX_BATCH) break;
             }
         }
-        quiche_stream_iter_free(it);
-
-        pump_send(sock, cl->conn, &cl->addr, cl->addr_len,
-                  &server_addr, sizeof(server_addr));
+        flush_dirty(sock);
+        run_timers(sock);
+        tx_flush(sock);
+        arm_timer(tfd);
     }
 }
@@ -1,56 +1,269 @@
 // Broker TCP para pub/sub simple por temas con múltiples SUB por conexión.
 // Compilación: gcc -Wall -Wextra -O2 -pthread -o broker_tcp broker_tcp.c
-// Ejecución:   ./broker_tcp <puerto>
+//              (con -DTRACE: trazas por etapa de una muestra de publicaciones, ver más abajo)
+// Ejecución:   ./broker_tcp [-L nivel] [-p tema=prioridad]... [-W p0,p1,p2] [-c cpus [-I]] <puerto>
 //
 // Protocolo (línea inicial por cliente):
 //   SUB <tema>            -> registra el socket como suscriptor del <tema>.
-//   PUB <tema>            -> registra el socket como publicador de <tema>.
+//   PUB <tema> [prio]     -> registra el socket como publicador de <tema> (prioridad opcional).
 // Publicación (lado publisher):
 //   MSG <texto>           -> el broker reenvía "<tema>: <texto>\n" a todos los SUB del tema.
+//   MSGP <prio> <texto>   -> igual, con la prioridad indicada solo para este mensaje.
+// Control de flujo (broker -> publisher):
+//   SLOW <tema>           -> las colas del tema superaron el límite: el broker deja de leer
+//                            al publicador hasta que se vacíen por debajo de la marca baja.
+//   GO <tema>             -> se puede volver a publicar.
+//
+// Prioridades: 0 = alta, 1 = normal (por defecto), 2 = baja. La de un mensaje es la de
+// MSGP, si no la del PUB, si no la del tema (-p), si no 1.
 //
 // Concurrencia:
 //   - Un hilo por cliente (pthread). Acceso a la lista de temas/suscriptores protegido por mutex.
+//   - Cada suscriptor tiene además un hilo escritor con una cola por prioridad. Publicar solo
+//     encola (el mensaje se arma una vez y las colas comparten el mismo buffer); el escritor
+//     saca de la cola de mayor prioridad (o con reparto ponderado, -W) y envía.
+//   - TCP_NOTSENT_LOWAT limita lo que espera en el kernel sin enviar: el resto espera en las
+//     colas del broker, donde un mensaje de prioridad alta puede adelantarse a uno de baja.
 //   - Se eliminan suscriptores “muertos” al fallar send().
+//   - Con -c, cada conexión se asigna a una CPU de la lista (en ronda, o con -I la CPU que
+//     procesó sus paquetes al llegar, SO_INCOMING_CPU, si está en la lista) y su hilo y su
+//     escritor quedan fijados ahí. El estado de la conexión (suscriptor, colas, buffers de
+//     línea y de envío) se reserva y se toca primero desde esos hilos: con la política NUMA
+//     por defecto del kernel (primer acceso) es lo más probable que quede en el nodo de esa
+//     CPU, pero no está garantizado (malloc reutiliza memoria ya tocada por otros hilos y las
+//     colas que crecen las realoja el publicador). Es un intento, sin mbind().
 //
 // Notas de robustez:
 //   - read_line() lee de a 1 byte hasta '\n' (suficiente para práctica).
 //   - send_all() asegura enviar el buffer completo o reportar error.
 //   - SIGPIPE ignorado para evitar terminar el proceso si un peer cierra.
+//   - Cola por prioridad y suscriptor acotada (LANE_MAX_BYTES): si se llena, el mensaje se
+//     descarta para ese suscriptor y se cuenta.
+//   - Cada suscriptor lleva sus bytes encolados. Si el más atrasado de un tema pasa
+//     FLOW_HIGH_WATER (menos que LANE_MAX_BYTES), el hilo de cada publicador del tema avisa
+//     SLOW y deja de leer su socket (el publicador termina bloqueado por TCP aunque no
+//     entienda el aviso); sigue cuando todos bajan de FLOW_LOW_WATER. Si tras FLOW_STUCK_MS
+//     alguno no bajó, deja de frenar al tema: si no envió nada en ese lapso se lo
+//     desconecta; si avanza pero lento, queda "rezagado" y pierde lo que no entre en su
+//     cola hasta ponerse al día. Un suscriptor trabado no detiene a los demás.
+//   - Los mensajes del broker pasan por log_ring.h: cada hilo deja un registro binario en su
+//     anillo y un hilo de fondo los formatea y escribe (si el anillo se llena, se descartan).
+//
+// Trazas (-DTRACE; sin esa macro no queda nada en el binario):
+//   - Una de cada N publicaciones (-T N, 64 por defecto) se mide por etapa con el contador
+//     de ciclos (rdtsc, calibrado contra CLOCK_MONOTONIC; en otras arquitecturas,
+//     clock_gettime): lectura de la línea, parseo, espera de topics_mtx, encolado para
+//     los suscriptores, espera en la cola, envío y total (primer byte leído -> enviado).
+//     Las tres últimas son por suscriptor.
+//   - Ctrl+C (o SIGTERM) muestra un histograma por etapa y escribe los tramos en formato
+//     Chrome trace (-t archivo, broker_tcp_trace.json por defecto), que abren
+//     chrome://tracing y ui.perfetto.dev.
 
 #define _GNU_SOURCE         // Habilita extensiones no estándar de GNU en las librerías, a veces necesario para funciones avanzadas.
 #include <arpa/inet.h>      // Provee funciones para manipular direcciones IP, como inet_ntop() que convierte IPs de binario a texto.
+#include <dirent.h>         // Recorre /sys/devices/system/cpu/cpuN para saber el nodo NUMA de cada CPU.
 #include <errno.h>          // Permite el manejo de errores a través de la variable 'errno' y constantes como EINTR.
 #include <netinet/in.h>     // Define la estructura 'sockaddr_in' y constantes necesarias para la programación de sockets de Internet.
+#include <netinet/tcp.h>    // TCP_NOTSENT_LOWAT: límite de bytes sin enviar en el kernel por suscriptor.
+#include <poll.h>           // poll(): el escritor espera a que el socket admita más datos.
 #include <pthread.h>        // Proporciona la API POSIX para manejo de hilos, incluyendo funciones como pthread_create() y pthread_join().
+#include <sched.h>          // cpu_set_t para fijar hilos a CPUs (-c).
 #include <signal.h>         // Permite manejar señales del sistema como SIGINT o SIGTERM, útil para cerrar procesos de forma controlada.
+#include <stdatomic.h>      // Contadores de latencia por prioridad compartidos por los hilos escritores.
 #include <stdbool.h>        // Define el tipo de dato booleano 'bool' y los valores 'true' y 'false'.
+#include <stdint.h>         // Enteros de ancho fijo para tiempos en nanosegundos.
 #include <stdio.h>          // Librería estándar de Entrada/Salida para funciones como printf(), fprintf() y sscanf().
 #include <stdlib.h>         // Librería estándar que provee funciones de gestión de memoria (calloc, free) y conversión de tipos (atoi).
 #include <string.h>         // Provee funciones para la manipulación de cadenas de caracteres, como strcmp(), strncpy() y strlen().
 #include <sys/socket.h>     // Contiene las definiciones y estructuras principales para la API de sockets (socket(), bind(), sendto(), recvfrom()).
 #include <sys/types.h>      // Define tipos de datos primitivos usados en llamadas al sistema, como ssize_t y socklen_t.
+#include <time.h>           // clock_gettime() para medir el tiempo de cada mensaje en las colas.
 #include <unistd.h>         // Provee acceso a la API del sistema operativo POSIX, incluyendo la función close() para cerrar descriptores de archivo.
+#ifdef TRACE
+#include <sys/syscall.h>    // SYS_gettid: identificador de hilo para la traza.
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>      // __rdtsc(): marcas de tiempo en ciclos.
+#endif
+#endif
+
+#include "log_ring.h"       // Log asíncrono: los hilos de clientes no formatean ni escriben en stdout.
 
 
 #define BACKLOG 128
 #define MAX_LINE 4096
 #define TOPIC_MAX 128
+#define LOG_RING_RECORDS 256   // registros por hilo de cliente en el anillo de log
+#define PRIO_LEVELS 3          // 0 = alta, 1 = normal, 2 = baja
+#define DEFAULT_PRIO 1
+#define MAX_PRIO_RULES 32      // reglas -p
+#define LANE_MAX_BYTES (4 * 1024 * 1024) // cola por prioridad y suscriptor
+#define CHUNK_BYTES 16384      // bytes por send() del escritor
+#define CHUNK_MSGS 256
+#define NOTSENT_LOWAT 16384    // bytes sin enviar que se dejan en el kernel
+#define LAT_BUCKETS 256        // histograma log2 con 4 sub-cubetas por potencia (ns)
+#define STATS_INTERVAL_S 5
+#define LANE_INIT_CAP 64       // mensajes por cola reservados al crear el suscriptor
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49     // Linux >= 3.19
+#endif
+#define FLOW_HIGH_WATER (2 * 1024 * 1024)  // bytes encolados de un suscriptor que pausan a los publicadores
+#define FLOW_LOW_WATER (512 * 1024)        // ... y los que permiten reanudar
+#define FLOW_STUCK_MS 5000                 // pausa máxima antes de dejar de esperar a un suscriptor
+#define FLOW_POLL_MS 100                   // reevaluación periódica de un publicador pausado
+_Static_assert(FLOW_HIGH_WATER < LANE_MAX_BYTES, "la pausa debe llegar antes que el descarte");
+#ifdef TRACE
+#define TRACE_DEFAULT_SAMPLE 64
+#define TRACE_MAX_EVENTS (1 << 18)         // tramos guardados para el JSON (luego solo histogramas)
+#endif
+
+// Mensaje armado una vez ("<tema>: <texto>\n") y compartido por las colas de todos los
+// suscriptores; se libera cuando lo suelta la última.
+typedef struct {
+    atomic_int refs;
+    uint64_t enq_ns;        // cuándo se publicó (CLOCK_MONOTONIC)
+#ifdef TRACE
+    uint32_t tr_msg;        // número de muestra (0 = no se traza)
+    uint64_t tr_start;      // primer byte de la línea leído (ticks)
+    uint64_t tr_enq;        // comienzo del encolado (ticks)
+#endif
+    size_t len;
+    char data[];
+} Msg;
+
+// Cola FIFO de una prioridad: anillo de punteros que crece al doble.
+typedef struct {
+    Msg **ring;
+    size_t head, count, cap;
+    size_t bytes;
+    uint64_t vtime;         // tiempo virtual del reparto ponderado (-W)
+} Lane;
+
+// Suscriptor: colas por prioridad y su hilo escritor.
+typedef struct {
+    int fd;
+    pthread_mutex_t mtx;    // protege las colas y los estados
+    pthread_cond_t cv;      // avisa al escritor que hay mensajes o que debe terminar
+    Lane lanes[PRIO_LEVELS];
+    uint64_t vclock;        // tiempo virtual del último mensaje enviado (-W)
+    bool closing;           // el lector terminó: el escritor sale
+    bool dead;              // falló un envío (o se lo dio por trabado): no se encola más
+    bool lagging;           // no frena a los publicadores hasta bajar de FLOW_LOW_WATER
+    _Atomic size_t queued;  // bytes en sus colas (control de flujo)
+    _Atomic uint64_t progress_ns; // último envío, o cuando la cola dejó de estar vacía
+    uint64_t dropped[PRIO_LEVELS];
+    int cpu;                // CPU del escritor (-1 = sin fijar)
+    pthread_t writer;
+} Subscriber;
 
 // Lista enlazada de suscriptores por tema.
 typedef struct SubNode {
-    int fd;                 // descriptor del cliente suscriptor
+    Subscriber *sub;        // suscriptor (un mismo cliente en varios temas comparte el objeto)
     struct SubNode *next;
 } SubNode;
 
 // Nodo de tema con su lista de suscriptores.
 typedef struct Topic {
     char name[TOPIC_MAX];   // nombre del tema
+    int prio;               // prioridad por defecto de sus mensajes (-p)
     SubNode *subs;          // cabeza de la lista de suscriptores
     struct Topic *next;
 } Topic;
 
 static Topic *topics = NULL;                               // lista global de temas
 static pthread_mutex_t topics_mtx = PTHREAD_MUTEX_INITIALIZER; // protege 'topics'
+static pthread_mutex_t flow_mtx = PTHREAD_MUTEX_INITIALIZER;   // espera de publicadores pausados
+static pthread_cond_t flow_cv = PTHREAD_COND_INITIALIZER;      // avisa a esos publicadores
+static atomic_int flow_paused;                                 // cuántos hay
+
+// -p tema=prioridad ("prefijo*" vale para todos los temas que empiezan así).
+static struct {
+    char pattern[TOPIC_MAX];
+    int prio;
+} prio_rules[MAX_PRIO_RULES];
+static int nprio_rules = 0;
+static unsigned weights[PRIO_LEVELS]; // -W; todo 0 = prioridad estricta
+static bool weighted = false;
+
+// Métricas por prioridad: tiempo desde la publicación hasta que el escritor entregó el
+// mensaje al kernel.
+static _Atomic uint64_t lat_hist[PRIO_LEVELS][LAT_BUCKETS];
+static _Atomic uint64_t lat_max[PRIO_LEVELS];
+static _Atomic uint64_t drops[PRIO_LEVELS];
+
+// -c: CPUs para los hilos de las conexiones; -I: usar la CPU que recibe sus paquetes.
+static int cpu_list[CPU_SETSIZE];
+static int ncpus = 0;
+static bool cpu_in_list[CPU_SETSIZE];
+static bool rx_align = false;
+static unsigned next_cpu = 0;           // solo lo usa el hilo que acepta
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Cubeta del histograma para 'v' (mismo esquema que sub_output.h).
+static int lat_bucket(uint64_t v) {
+    int b = (int)v;
+    if (v >= 4) {
+        int lg = 63 - __builtin_clzll(v);
+        b = lg * 4 + (int)((v >> (lg - 2)) & 3);
+    }
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+#ifdef TRACE
+enum { TR_READ, TR_PARSE, TR_LOCK, TR_ENQUEUE, TR_QUEUE, TR_SEND, TR_TOTAL, TR_STAGES };
+static const char *trace_stage_names[TR_STAGES] = {
+    "lectura", "parseo", "lock", "encolado", "cola", "envío", "total"
+};
+
+typedef struct {
+    uint32_t msg;
+    uint32_t tid;
+    int stage;
+    uint64_t t0, t1;        // ticks
+} TraceEvent;
+
+static TraceEvent *trace_events;
+static _Atomic size_t trace_nevents;
+static _Atomic uint64_t trace_hist[TR_STAGES][LAT_BUCKETS];
+static unsigned trace_sample = TRACE_DEFAULT_SAMPLE;
+static const char *trace_path = "broker_tcp_trace.json";
+static double trace_ns_per_tick = 1.0;
+static uint64_t trace_t0;
+static _Atomic uint32_t trace_next_msg = 1;
+static __thread uint64_t tr_line_start;  // primer byte de la línea en curso (read_line)
+static __thread uint32_t tr_msg;         // muestra en curso del hilo publicador (0 = ninguna)
+static __thread uint32_t tr_tid;
+
+static inline uint64_t trace_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return mono_ns();
+#endif
+}
+
+// Registra la etapa 'stage' [t0, t1] de la muestra 'msg' (no hace nada si msg == 0).
+static void trace_span(int stage, uint32_t msg, uint64_t t0, uint64_t t1) {
+    if (msg == 0) return;
+    uint64_t ns = t1 > t0 ? (uint64_t)((double)(t1 - t0) * trace_ns_per_tick) : 0;
+    atomic_fetch_add_explicit(&trace_hist[stage][lat_bucket(ns)], 1, memory_order_relaxed);
+    size_t i = atomic_fetch_add_explicit(&trace_nevents, 1, memory_order_relaxed);
+    if (i >= TRACE_MAX_EVENTS) return;
+    if (tr_tid == 0) tr_tid = (uint32_t)syscall(SYS_gettid);
+    trace_events[i] = (TraceEvent){ msg, tr_tid, stage, t0, t1 };
+}
+
+#define TRACE_NOW(v) uint64_t v = trace_now()
+#define TRACE_SPAN(stage, msg, t0, t1) trace_span(stage, msg, t0, t1)
+#else
+#define TRACE_NOW(v)
+#define TRACE_SPAN(stage, msg, t0, t1)
+#endif
 
 // Envío confiable de 'len' bytes (maneja señales y envíos parciales).
 static ssize_t send_all(int fd, const void *buf, size_t len) {
@@ -84,12 +297,27 @@ static int read_line(int fd, char *out, size_t maxlen) {
             out[i] = '\0';
             return 1;
         }
+#ifdef TRACE
+        if (i == 0) tr_line_start = trace_now();
+#endif
         out[i++] = c;
     }
     out[maxlen - 1] = '\0';
     return 1;
 }
 
+// Prioridad por defecto de un tema según las reglas -p.
+static int topic_prio(const char *name) {
+    for (int i = 0; i < nprio_rules; i++) {
+        const char *pat = prio_rules[i].pattern;
+        size_t len = strlen(pat);
+        if (len > 0 && pat[len - 1] == '*' ? strncmp(name, pat, len - 1) == 0 : strcmp(name, pat) == 0) {
+            return prio_rules[i].prio;
+        }
+    }
+    return DEFAULT_PRIO;
+}
+
 // Busca un tema por nombre o lo crea si no existe.
 // PRE: se llama con el mutex tomado.
 static Topic *find_or_create_topic(const char *name) {
@@ -102,38 +330,258 @@ static Topic *find_or_create_topic(const char *name) {
     Topic *nt = (Topic *)calloc(1, sizeof(Topic));
     if (!nt) return NULL;
     strncpy(nt->name, name, TOPIC_MAX - 1);
+    nt->prio = topic_prio(name);
     nt->subs = NULL;
     nt->next = topics;
     topics = nt;
     return nt;
 }
 
-// Agrega un suscriptor (evita duplicados por fd).
-static void add_subscriber(const char *topic, int fd) {
+static void msg_unref(Msg *m) {
+    if (atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) == 1) free(m);
+}
+
+// Despierta a los publicadores pausados para que revisen sus temas (un suscriptor se vació,
+// murió o se fue). Se llama sin el mutex de ningún suscriptor tomado.
+static void flow_wake(void) {
+    if (atomic_load(&flow_paused) == 0) return;
+    pthread_mutex_lock(&flow_mtx);
+    pthread_cond_broadcast(&flow_cv);
+    pthread_mutex_unlock(&flow_mtx);
+}
+
+// Registra la latencia de un mensaje enviado (mismo histograma que sub_output.h).
+static void record_latency(int prio, uint64_t lat) {
+    atomic_fetch_add_explicit(&lat_hist[prio][lat_bucket(lat)], 1, memory_order_relaxed);
+    uint64_t cur = atomic_load_explicit(&lat_max[prio], memory_order_relaxed);
+    while (lat > cur &&
+           !atomic_compare_exchange_weak_explicit(&lat_max[prio], &cur, lat, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+// Próxima cola a atender: la de mayor prioridad con mensajes o, con -W, la de menor
+// tiempo virtual. -1 si todas están vacías.
+// PRE: mutex del suscriptor tomado.
+static int pick_lane(const Subscriber *s) {
+    int best = -1;
+    for (int p = 0; p < PRIO_LEVELS; p++) {
+        if (s->lanes[p].count == 0) continue;
+        if (!weighted) return p;
+        if (best < 0 || s->lanes[p].vtime < s->lanes[best].vtime) best = p;
+    }
+    return best;
+}
+
+// Hilo escritor de un suscriptor: arma bloques de hasta CHUNK_BYTES sacando un mensaje a
+// la vez de la cola elegida y los envía cuando el kernel tiene menos de NOTSENT_LOWAT
+// bytes pendientes, así un mensaje de prioridad alta espera como mucho un bloque.
+static void *writer_thread(void *arg) {
+    Subscriber *s = (Subscriber *)arg;
+    char chunk[CHUNK_BYTES + MAX_LINE + TOPIC_MAX + 4];
+    Msg *batch[CHUNK_MSGS];
+    int bprio[CHUNK_MSGS];
+
+    for (;;) {
+        pthread_mutex_lock(&s->mtx);
+        while (!s->closing && pick_lane(s) < 0) pthread_cond_wait(&s->cv, &s->mtx);
+        if (s->closing) {
+            pthread_mutex_unlock(&s->mtx);
+            break;
+        }
+        size_t used = 0;
+        int n = 0;
+        int p;
+        while (n < CHUNK_MSGS && (p = pick_lane(s)) >= 0) {
+            Lane *l = &s->lanes[p];
+            Msg *m = l->ring[l->head];
+            if (used > 0 && used + m->len > CHUNK_BYTES) break;
+            l->head = (l->head + 1) % l->cap;
+            l->count--;
+            l->bytes -= m->len;
+            atomic_fetch_sub(&s->queued, m->len);
+            if (weighted) {
+                s->vclock = l->vtime;
+                l->vtime += (uint64_t)m->len * 1024 / weights[p];
+            }
+            memcpy(chunk + used, m->data, m->len);
+            used += m->len;
+            batch[n] = m;
+            bprio[n++] = p;
+        }
+        if (s->lagging && atomic_load(&s->queued) < FLOW_LOW_WATER) s->lagging = false;
+        pthread_mutex_unlock(&s->mtx);
+        TRACE_NOW(t_deq);
+
+        struct pollfd pfd = { s->fd, POLLOUT, 0 };
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+        }
+        TRACE_NOW(t_send);
+        bool ok = send_all(s->fd, chunk, used) == (ssize_t)used;
+        TRACE_NOW(t_sent);
+        uint64_t now = mono_ns();
+        if (ok) atomic_store(&s->progress_ns, now);
+        for (int i = 0; i < n; i++) {
+            if (ok) record_latency(bprio[i], now - batch[i]->enq_ns);
+#ifdef TRACE
+            if (ok && batch[i]->tr_msg) {
+                trace_span(TR_QUEUE, batch[i]->tr_msg, batch[i]->tr_enq, t_deq);
+                trace_span(TR_SEND, batch[i]->tr_msg, t_send, t_sent);
+                trace_span(TR_TOTAL, batch[i]->tr_msg, batch[i]->tr_start, t_sent);
+            }
+#endif
+            msg_unref(batch[i]);
+        }
+        if (!ok) {
+            // desconexión: no encolar más y despertar al lector (recv() devuelve 0)
+            pthread_mutex_lock(&s->mtx);
+            s->dead = true;
+            pthread_mutex_unlock(&s->mtx);
+            shutdown(s->fd, SHUT_RDWR);
+            flow_wake();
+            break;
+        }
+        if (atomic_load(&s->queued) < FLOW_LOW_WATER) flow_wake();
+    }
+    return NULL;
+}
+
+// Crea un hilo fijado a 'cpu' (-1 = donde lo ponga el planificador).
+static int start_thread(pthread_t *th, void *(*fn)(void *), void *arg, int cpu) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    int r = pthread_create(th, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return r;
+}
+
+// Se llama desde el hilo de la conexión (ya fijado a 'cpu'): el suscriptor y sus colas
+// se tocan primero aquí y, si malloc entrega páginas nuevas, quedan en el nodo NUMA de esa CPU.
+static Subscriber *subscriber_new(int fd, int cpu) {
+    Subscriber *s = (Subscriber *)calloc(1, sizeof(Subscriber));
+    if (!s) return NULL;
+    s->fd = fd;
+    s->cpu = cpu;
+    for (int p = 0; p < PRIO_LEVELS; p++) {
+        s->lanes[p].ring = (Msg **)malloc(LANE_INIT_CAP * sizeof(Msg *));
+        if (!s->lanes[p].ring) {
+            while (p-- > 0) free(s->lanes[p].ring);
+            free(s);
+            return NULL;
+        }
+        memset(s->lanes[p].ring, 0, LANE_INIT_CAP * sizeof(Msg *));
+        s->lanes[p].cap = LANE_INIT_CAP;
+    }
+    pthread_mutex_init(&s->mtx, NULL);
+    pthread_cond_init(&s->cv, NULL);
+    int lowat = NOTSENT_LOWAT;
+    setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    if (start_thread(&s->writer, writer_thread, s, cpu) != 0) {
+        for (int p = 0; p < PRIO_LEVELS; p++) free(s->lanes[p].ring);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+// Detiene el escritor y libera las colas. PRE: ya no está en ninguna lista de temas.
+static void subscriber_free(Subscriber *s) {
+    pthread_mutex_lock(&s->mtx);
+    s->closing = true;
+    pthread_cond_signal(&s->cv);
+    pthread_mutex_unlock(&s->mtx);
+    pthread_join(s->writer, NULL);
+    for (int p = 0; p < PRIO_LEVELS; p++) {
+        Lane *l = &s->lanes[p];
+        for (size_t i = 0; i < l->count; i++) msg_unref(l->ring[(l->head + i) % l->cap]);
+        free(l->ring);
+    }
+    pthread_cond_destroy(&s->cv);
+    pthread_mutex_destroy(&s->mtx);
+    free(s);
+}
+
+// Bytes encolados que cuentan para el control de flujo (0 si el suscriptor no frena).
+// PRE: mutex del suscriptor tomado.
+static size_t flow_backlog(const Subscriber *s) {
+    return (s->dead || s->closing || s->lagging) ? 0 : atomic_load(&s->queued);
+}
+
+// Encola 'm' en la cola 'prio' del suscriptor (o lo descarta si está llena). Devuelve sus
+// bytes encolados según flow_backlog().
+static size_t enqueue(Subscriber *s, Msg *m, int prio) {
+    pthread_mutex_lock(&s->mtx);
+    Lane *l = &s->lanes[prio];
+    size_t backlog = flow_backlog(s);
+    if (s->dead || s->closing) {
+        pthread_mutex_unlock(&s->mtx);
+        return 0;
+    }
+    if (l->bytes + m->len > LANE_MAX_BYTES) {
+        s->dropped[prio]++;
+        atomic_fetch_add_explicit(&drops[prio], 1, memory_order_relaxed);
+        pthread_mutex_unlock(&s->mtx);
+        return backlog;
+    }
+    if (l->count == l->cap) {
+        size_t ncap = l->cap ? l->cap * 2 : 64;
+        Msg **nr = (Msg **)malloc(ncap * sizeof(Msg *));
+        if (!nr) {
+            pthread_mutex_unlock(&s->mtx);
+            return backlog;
+        }
+        for (size_t i = 0; i < l->count; i++) nr[i] = l->ring[(l->head + i) % l->cap];
+        free(l->ring);
+        l->ring = nr;
+        l->head = 0;
+        l->cap = ncap;
+    }
+    // Una cola que estaba vacía no acumula crédito del tiempo en que no tuvo mensajes.
+    if (weighted && l->count == 0 && l->vtime < s->vclock) l->vtime = s->vclock;
+    l->ring[(l->head + l->count) % l->cap] = m;
+    l->count++;
+    l->bytes += m->len;
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+    // Una cola que estaba vacía empieza a contar desde ahora para detectar si está trabado.
+    if (atomic_fetch_add(&s->queued, m->len) == 0) atomic_store(&s->progress_ns, mono_ns());
+    backlog = flow_backlog(s);
+    pthread_cond_signal(&s->cv);
+    pthread_mutex_unlock(&s->mtx);
+    return backlog;
+}
+
+// Agrega un suscriptor (evita duplicados).
+static void add_subscriber(const char *topic, Subscriber *s) {
     pthread_mutex_lock(&topics_mtx);
     Topic *t = find_or_create_topic(topic);
     if (t) {
         for (SubNode *n = t->subs; n; n = n->next) {
-            if (n->fd == fd) {
+            if (n->sub == s) {
                 pthread_mutex_unlock(&topics_mtx);
                 return; // ya estaba suscrito a ese tema
             }
         }
         SubNode *node = (SubNode *)calloc(1, sizeof(SubNode));
-        node->fd = fd;
+        node->sub = s;
         node->next = t->subs;
         t->subs = node;
     }
     pthread_mutex_unlock(&topics_mtx);
 }
 
-// Elimina un fd de todas las listas de suscriptores (cuando un cliente se va).
-static void remove_subscriber_fd(int fd) {
+// Elimina un suscriptor de todas las listas (cuando un cliente se va).
+static void remove_subscriber(Subscriber *s) {
     pthread_mutex_lock(&topics_mtx);
     for (Topic *t = topics; t; t = t->next) {
         SubNode **pp = &t->subs;
         while (*pp) {
-            if ((*pp)->fd == fd) {
+            if ((*pp)->sub == s) {
                 SubNode *dead = *pp;
                 *pp = (*pp)->next;
                 free(dead);
@@ -143,40 +591,241 @@ static void remove_subscriber_fd(int fd) {
         }
     }
     pthread_mutex_unlock(&topics_mtx);
+    flow_wake(); // un publicador pudo estar esperando a este suscriptor
 }
 
-// Reenvía 'msg' a todos los suscriptores del 'topic'.
-// Si un envío falla, se asume desconexión y se remueve el suscriptor.
-static void broadcast_to_topic(const char *topic, const char *msg) {
+// Encola 'msg' para todos los suscriptores del tema 't' con prioridad 'prio'
+// (-1 = la del tema). El envío lo hace el hilo escritor de cada suscriptor. Devuelve los
+// bytes encolados del suscriptor más atrasado (para flow_wait()).
+static size_t broadcast_to_topic(Topic *t, const char *msg, int prio) {
+    const char *topic = t->name;
+    size_t tlen = strlen(topic), mlen = strlen(msg);
+    Msg *m = (Msg *)malloc(sizeof(Msg) + tlen + mlen + 3);
+    if (!m) return 0;
+    atomic_init(&m->refs, 1); // referencia propia hasta terminar de encolar
+    m->enq_ns = mono_ns();
+    memcpy(m->data, topic, tlen);
+    memcpy(m->data + tlen, ": ", 2);
+    memcpy(m->data + tlen + 2, msg, mlen);
+    m->data[tlen + 2 + mlen] = '\n';
+    m->len = tlen + mlen + 3;
+
+    TRACE_NOW(t_lock);
     pthread_mutex_lock(&topics_mtx);
-    for (Topic *t = topics; t; t = t->next) {
-        if (strcmp(t->name, topic) == 0) {
-            SubNode **pp = &t->subs;
-            while (*pp) {
-                int fd = (*pp)->fd;
-                char line[MAX_LINE];
-                int n = snprintf(line, sizeof(line), "%s: %s\n", topic, msg);
-                if (n < 0) { pp = &(*pp)->next; continue; }
-
-                if (send_all(fd, line, (size_t)n) < 0) {
-                    // desconexión: limpiar nodo
-                    SubNode *dead = *pp;
-                    *pp = (*pp)->next;
-                    close(fd);
-                    free(dead);
-                } else {
-                    pp = &(*pp)->next;
-                }
+    TRACE_NOW(t_locked);
+#ifdef TRACE
+    m->tr_msg = tr_msg;
+    m->tr_start = tr_line_start;
+    m->tr_enq = t_locked;
+#endif
+    int p = prio >= 0 ? prio : t->prio;
+    size_t backlog = 0;
+    for (SubNode *n = t->subs; n; n = n->next) {
+        size_t b = enqueue(n->sub, m, p);
+        if (b > backlog) backlog = b;
+    }
+    TRACE_NOW(t_enqueued);
+    pthread_mutex_unlock(&topics_mtx);
+    TRACE_SPAN(TR_LOCK, tr_msg, t_lock, t_locked);
+    TRACE_SPAN(TR_ENQUEUE, tr_msg, t_locked, t_enqueued);
+    msg_unref(m);
+    return backlog;
+}
+
+// Bytes encolados del suscriptor más atrasado de 't' que todavía frena al tema. Con
+// 'release', los que siguen por encima de FLOW_LOW_WATER dejan de frenarlo: si no
+// enviaron nada en FLOW_STUCK_MS se los desconecta, si no quedan rezagados.
+static size_t topic_backlog(Topic *t, bool release) {
+    size_t max = 0;
+    uint64_t now = mono_ns();
+    pthread_mutex_lock(&topics_mtx);
+    for (SubNode *n = t->subs; n; n = n->next) {
+        Subscriber *s = n->sub;
+        pthread_mutex_lock(&s->mtx);
+        size_t b = flow_backlog(s);
+        if (release && b >= FLOW_LOW_WATER) {
+            if (now - atomic_load(&s->progress_ns) >= (uint64_t)FLOW_STUCK_MS * 1000000) {
+                s->dead = true;
+                shutdown(s->fd, SHUT_RDWR); // el escritor y el lector terminan solos
+                log_warn("[broker] Tema '%s': suscriptor %d trabado (%zu KB sin enviar), se lo desconecta\n",
+                         t->name, s->fd, b / 1024);
+            } else {
+                s->lagging = true;
+                log_warn("[broker] Tema '%s': suscriptor %d rezagado (%zu KB), ya no frena a los publicadores\n",
+                         t->name, s->fd, b / 1024);
             }
-            break;
+            b = 0;
         }
+        pthread_mutex_unlock(&s->mtx);
+        if (b > max) max = b;
     }
     pthread_mutex_unlock(&topics_mtx);
+    return max;
+}
+
+// Control de flujo de un publicador: si el suscriptor más atrasado del tema pasó
+// FLOW_HIGH_WATER ('backlog', de broadcast_to_topic()), avisa SLOW, espera (sin leer su
+// socket) a que todos bajen de FLOW_LOW_WATER y avisa GO. La espera dura como mucho
+// FLOW_STUCK_MS: después, los suscriptores que siguen atrasados dejan de contar.
+// Los errores de envío no cortan: el publicador pudo cerrar solo su lado de escritura y
+// lo que ya mandó se sigue leyendo.
+static void flow_wait(int fd, Topic *t, size_t backlog) {
+    if (backlog < FLOW_HIGH_WATER) return;
+
+    char line[TOPIC_MAX + 8];
+    int n = snprintf(line, sizeof(line), "SLOW %s\n", t->name);
+    send_all(fd, line, (size_t)n);
+    log_info("[broker] Tema '%s': %zu KB encolados, se pausa al publicador %d\n", t->name,
+             backlog / 1024, fd);
+
+    uint64_t start = mono_ns();
+    uint64_t deadline = start + (uint64_t)FLOW_STUCK_MS * 1000000;
+    atomic_fetch_add(&flow_paused, 1);
+    pthread_mutex_lock(&flow_mtx);
+    for (;;) {
+        bool expired = mono_ns() >= deadline;
+        if (topic_backlog(t, expired) < FLOW_LOW_WATER) break;
+        // flow_cv usa CLOCK_REALTIME: se reevalúa cada FLOW_POLL_MS y el plazo se mide aparte.
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += FLOW_POLL_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&flow_cv, &flow_mtx, &ts);
+    }
+    pthread_mutex_unlock(&flow_mtx);
+    atomic_fetch_sub(&flow_paused, 1);
+
+    log_info("[broker] Tema '%s': publicador %d reanudado tras %.1f ms\n", t->name, fd,
+             (mono_ns() - start) / 1e6);
+    n = snprintf(line, sizeof(line), "GO %s\n", t->name);
+    send_all(fd, line, (size_t)n);
+}
+
+// Límite inferior de la cubeta 'b', en ns.
+static uint64_t bucket_low(int b) {
+    if (b < 4) return (uint64_t)b;
+    int lg = b / 4;
+    return (1ull << lg) + (uint64_t)(b % 4) * (1ull << (lg - 2));
+}
+
+// Límite inferior del percentil 'p' (0..1) del histograma 'h' de 'total' muestras, en ns.
+static uint64_t percentile(const uint64_t *h, uint64_t total, double p) {
+    uint64_t want = (uint64_t)((double)total * p), acc = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        acc += h[b];
+        if (acc > want) return bucket_low(b);
+    }
+    return 0;
+}
+
+#ifdef TRACE
+// Calibra los ticks contra CLOCK_MONOTONIC y reserva el buffer de tramos.
+static int trace_init(void) {
+    trace_events = (TraceEvent *)malloc(TRACE_MAX_EVENTS * sizeof(TraceEvent));
+    if (!trace_events) return -1;
+    uint64_t n0 = mono_ns(), c0 = trace_now();
+    struct timespec ts = { 0, 50 * 1000000L };
+    nanosleep(&ts, NULL);
+    uint64_t n1 = mono_ns(), c1 = trace_now();
+    if (c1 > c0) trace_ns_per_tick = (double)(n1 - n0) / (double)(c1 - c0);
+    trace_t0 = trace_now();
+    return 0;
+}
+
+// Histogramas por etapa y archivo Chrome trace ("X" = tramo con duración, en µs).
+static void trace_dump(void) {
+    printf("[broker] Trazas: 1 de cada %u publicaciones, %.3f ns por tick\n", trace_sample, trace_ns_per_tick);
+    printf("[broker] %-9s %10s %12s %12s %12s %12s\n", "etapa", "muestras", "p50 us", "p99 us", "p99.9 us", "máx us");
+    for (int st = 0; st < TR_STAGES; st++) {
+        uint64_t h[LAT_BUCKETS], total = 0;
+        int top = 0;
+        for (int b = 0; b < LAT_BUCKETS; b++) {
+            h[b] = atomic_load(&trace_hist[st][b]);
+            total += h[b];
+            if (h[b]) top = b;
+        }
+        if (total == 0) continue;
+        printf("[broker] %-9s %10llu %12.2f %12.2f %12.2f %12.2f\n", trace_stage_names[st],
+               (unsigned long long)total, percentile(h, total, 0.50) / 1e3, percentile(h, total, 0.99) / 1e3,
+               percentile(h, total, 0.999) / 1e3, bucket_low(top) / 1e3);
+    }
+
+    FILE *f = fopen(trace_path, "w");
+    if (!f) {
+        perror(trace_path);
+        return;
+    }
+    size_t n = atomic_load(&trace_nevents);
+    if (n > TRACE_MAX_EVENTS) n = TRACE_MAX_EVENTS;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < n; i++) {
+        const TraceEvent *e = &trace_events[i];
+        double ts = e->t0 > trace_t0 ? (double)(e->t0 - trace_t0) * trace_ns_per_tick / 1e3 : 0;
+        double dur = e->t1 > e->t0 ? (double)(e->t1 - e->t0) * trace_ns_per_tick / 1e3 : 0;
+        fprintf(f, "{\"name\":\"%s\",\"cat\":\"publicación\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                   "\"pid\":1,\"tid\":%u,\"args\":{\"msg\":%u}}%s\n",
+                trace_stage_names[e->stage], ts, dur, e->tid, e->msg, i + 1 < n ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+    printf("[broker] %zu tramo(s) escritos en %s\n", n, trace_path);
+}
+
+// Espera SIGINT/SIGTERM (bloqueadas en los demás hilos), vuelca las trazas y termina.
+static void *trace_signal_thread(void *arg) {
+    sigset_t *set = (sigset_t *)arg;
+    int sig;
+    sigwait(set, &sig);
+    trace_dump();
+    fflush(stdout);
+    exit(0);
+}
+#endif
+
+// Cada STATS_INTERVAL_S informa por prioridad los mensajes enviados en el intervalo, la
+// latencia en el broker (p50/p99/máx) y los descartados por cola llena.
+static void *stats_thread(void *arg) {
+    (void)arg;
+    static uint64_t prev[PRIO_LEVELS][LAT_BUCKETS], prev_drops[PRIO_LEVELS];
+    for (;;) {
+        sleep(STATS_INTERVAL_S);
+        for (int p = 0; p < PRIO_LEVELS; p++) {
+            uint64_t h[LAT_BUCKETS], total = 0;
+            for (int b = 0; b < LAT_BUCKETS; b++) {
+                uint64_t v = atomic_load_explicit(&lat_hist[p][b], memory_order_relaxed);
+                h[b] = v - prev[p][b];
+                prev[p][b] = v;
+                total += h[b];
+            }
+            uint64_t d = atomic_load_explicit(&drops[p], memory_order_relaxed);
+            uint64_t dropped = d - prev_drops[p];
+            prev_drops[p] = d;
+            uint64_t max = atomic_exchange_explicit(&lat_max[p], 0, memory_order_relaxed);
+            if (total == 0 && dropped == 0) continue;
+            log_info("[broker] Prioridad %d: %llu enviados, latencia p50 %.2f ms, p99 %.2f ms, "
+                     "máx %.2f ms; %llu descartados\n", p, (unsigned long long)total,
+                     percentile(h, total, 0.50) / 1e6, percentile(h, total, 0.99) / 1e6, max / 1e6,
+                     (unsigned long long)dropped);
+        }
+    }
+    return NULL;
+}
+
+// Lee "MSGP <prio> <texto>": devuelve el texto y deja la prioridad en '*prio'.
+static const char *parse_msgp(const char *line, int *prio) {
+    const char *p = line + 5;
+    if (*p < '0' || *p >= '0' + PRIO_LEVELS || p[1] != ' ') return NULL;
+    *prio = *p - '0';
+    return p + 2;
 }
 
 // Info por cliente para el hilo.
 typedef struct {
     int fd;
+    int cpu;                // CPU a la que está fijado el hilo (-1 = sin fijar)
     struct sockaddr_in addr;
 } ClientInfo;
 
@@ -184,28 +833,36 @@ typedef struct {
 static void *client_thread(void *arg) {
     ClientInfo *ci = (ClientInfo *)arg;
     int fd = ci->fd;
+    int cpu = ci->cpu;
     free(ci);
 
     char line[MAX_LINE];
     char role[8] = {0};
     char topic[TOPIC_MAX] = {0};
+    int pub_prio = -1;
 
     // 1) Leer la primera línea para determinar el rol y el tema.
     if (read_line(fd, line, sizeof(line)) <= 0) {
         close(fd);
         return NULL;
     }
-    if (sscanf(line, "%7s %127s", role, topic) != 2) {
+    if (sscanf(line, "%7s %127s %d", role, topic, &pub_prio) < 2) {
         const char *err = "ERR protocolo: use 'SUB <tema>' o 'PUB <tema>'\n";
         send_all(fd, err, strlen(err));
         close(fd);
         return NULL;
     }
+    if (pub_prio >= PRIO_LEVELS) pub_prio = PRIO_LEVELS - 1;
 
     if (strcmp(role, "SUB") == 0) {
+        Subscriber *s = subscriber_new(fd, cpu);
+        if (!s) {
+            close(fd);
+            return NULL;
+        }
         // Suscripción inicial
-        add_subscriber(topic, fd);
-        printf("[broker] Cliente %d suscrito a '%s'\n", fd, topic);
+        add_subscriber(topic, s);
+        log_info("[broker] Cliente %d suscrito a '%s'\n", fd, topic);
 
         // Acepta múltiples SUB en la misma conexión.
         while (true) {
@@ -215,28 +872,59 @@ static void *client_thread(void *arg) {
             char cmd[8] = {0};
             char new_topic[TOPIC_MAX] = {0};
             if (sscanf(line, "%7s %127s", cmd, new_topic) == 2 && strcmp(cmd, "SUB") == 0) {
-                add_subscriber(new_topic, fd);
-                printf("[broker] Cliente %d suscrito a '%s'\n", fd, new_topic);
+                add_subscriber(new_topic, s);
+                log_info("[broker] Cliente %d suscrito a '%s'\n", fd, new_topic);
                 continue;
             }
             // Otras líneas de un SUB se ignoran.
         }
 
         // Limpieza al salir.
-        remove_subscriber_fd(fd);
+        remove_subscriber(s);
+        uint64_t dropped = s->dropped[0] + s->dropped[1] + s->dropped[2];
+        if (dropped) {
+            log_warn("[broker] Cliente %d: %llu mensaje(s) descartados por cola llena (alta %llu, normal %llu, baja %llu)\n",
+                     fd, (unsigned long long)dropped, (unsigned long long)s->dropped[0],
+                     (unsigned long long)s->dropped[1], (unsigned long long)s->dropped[2]);
+        }
+        subscriber_free(s);
         close(fd);
         return NULL;
 
     } else if (strcmp(role, "PUB") == 0) {
-        // Bucle de publicación: solo acepta "MSG <texto>"
+        pthread_mutex_lock(&topics_mtx);
+        Topic *t = find_or_create_topic(topic);
+        pthread_mutex_unlock(&topics_mtx);
+        if (!t) {
+            close(fd);
+            return NULL;
+        }
+        // Bucle de publicación: acepta "MSG <texto>" y "MSGP <prio> <texto>"
+#ifdef TRACE
+        unsigned sample_ctr = 0;
+#endif
         while (true) {
             int r = read_line(fd, line, sizeof(line));
             if (r <= 0) break;
+            TRACE_NOW(t_line);
+#ifdef TRACE
+            tr_msg = trace_sample && ++sample_ctr % trace_sample == 0 ? atomic_fetch_add(&trace_next_msg, 1) : 0;
+#endif
+            int prio = pub_prio;
+            const char *payload = NULL;
             if (strncmp(line, "MSG ", 4) == 0) {
-                const char *payload = line + 4;
-                broadcast_to_topic(topic, payload);
+                payload = line + 4;
+            } else if (strncmp(line, "MSGP ", 5) == 0) {
+                payload = parse_msgp(line, &prio);
+            }
+            if (payload) {
+                TRACE_NOW(t_parsed);
+                TRACE_SPAN(TR_READ, tr_msg, tr_line_start, t_line);
+                TRACE_SPAN(TR_PARSE, tr_msg, t_line, t_parsed);
+                size_t backlog = broadcast_to_topic(t, payload, prio);
+                flow_wait(fd, t, backlog);
             } else {
-                const char *warn = "WARN: use 'MSG <texto>'\n";
+                const char *warn = "WARN: use 'MSG <texto>' o 'MSGP <prioridad 0-2> <texto>'\n";
                 if (send_all(fd, warn, strlen(warn)) < 0) break;
             }
         }
@@ -251,14 +939,148 @@ static void *client_thread(void *arg) {
     }
 }
 
+// Nodo NUMA de una CPU según sysfs (0 si no se puede saber).
+static int cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *d = opendir(path);
+    if (!d) return 0;
+    int node = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "node", 4) == 0 && sscanf(e->d_name + 4, "%d", &node) == 1) break;
+    }
+    closedir(d);
+    return node;
+}
+
+// Lee "0-3,8,10-11" en cpu_list. Devuelve false si no es válida o incluye CPUs que
+// el proceso no puede usar.
+static bool parse_cpu_list(const char *arg) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) CPU_ZERO(&allowed);
+    const char *p = arg;
+    while (*p) {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p) return false;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p) return false;
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return false;
+        for (long c = lo; c <= hi; c++) {
+            if (!CPU_ISSET(c, &allowed)) {
+                fprintf(stderr, "La CPU %ld no está disponible para el proceso\n", c);
+                return false;
+            }
+            if (!cpu_in_list[c]) {
+                cpu_in_list[c] = true;
+                cpu_list[ncpus++] = (int)c;
+            }
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0') return false;
+        p = end;
+    }
+    return ncpus > 0;
+}
+
+// CPU para una conexión nueva: con -I la que procesó sus paquetes (si está en la lista),
+// si no la siguiente en ronda.
+static int choose_cpu(int fd) {
+    if (ncpus == 0) return -1;
+    if (rx_align) {
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0 && cpu >= 0 &&
+            cpu < CPU_SETSIZE && cpu_in_list[cpu]) {
+            return cpu;
+        }
+    }
+    return cpu_list[next_cpu++ % (unsigned)ncpus];
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-L error|warn|info|debug] [-p tema=prioridad]... [-W p0,p1,p2] [-c cpus [-I]] <puerto>\n", prog);
+    fprintf(stderr, "  -p  prioridad por defecto de un tema (0 alta, 1 normal, 2 baja); 'prefijo*=0' vale para varios\n");
+    fprintf(stderr, "  -W  reparto ponderado entre prioridades (p.ej. 8,2,1) en vez de prioridad estricta\n");
+    fprintf(stderr, "  -c  CPUs para los hilos de las conexiones (p.ej. 0-7,16-23); cada conexión queda fijada a una de ellas\n");
+    fprintf(stderr, "  -I  con -c, usar la CPU que recibe los paquetes de la conexión (cola RX / IRQ) si está en la lista\n");
+#ifdef TRACE
+    fprintf(stderr, "  -T  trazar 1 de cada N publicaciones (por defecto %d, 0 = ninguna)\n", TRACE_DEFAULT_SAMPLE);
+    fprintf(stderr, "  -t  archivo Chrome trace que se escribe al terminar (por defecto broker_tcp_trace.json)\n");
+#endif
+}
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Uso: %s <puerto>\n", argv[0]);
+    int level = LOGL_INFO;
+    int opt;
+#ifdef TRACE
+#define TRACE_OPTS "T:t:"
+#else
+#define TRACE_OPTS ""
+#endif
+    while ((opt = getopt(argc, argv, "L:p:W:c:I" TRACE_OPTS)) != -1) {
+        if (opt == 'L' && (level = log_parse_level(optarg)) >= 0) continue;
+        if (opt == 'c' && parse_cpu_list(optarg)) continue;
+        if (opt == 'I') {
+            rx_align = true;
+            continue;
+        }
+#ifdef TRACE
+        if (opt == 'T') {
+            trace_sample = (unsigned)atoi(optarg);
+            continue;
+        }
+        if (opt == 't') {
+            trace_path = optarg;
+            continue;
+        }
+#endif
+        if (opt == 'p' && nprio_rules < MAX_PRIO_RULES) {
+            const char *eq = strrchr(optarg, '=');
+            if (eq && eq != optarg && eq - optarg < TOPIC_MAX && eq[1] >= '0' && eq[1] < '0' + PRIO_LEVELS &&
+                eq[2] == '\0') {
+                snprintf(prio_rules[nprio_rules].pattern, TOPIC_MAX, "%.*s", (int)(eq - optarg), optarg);
+                prio_rules[nprio_rules++].prio = eq[1] - '0';
+                continue;
+            }
+        }
+        if (opt == 'W' && sscanf(optarg, "%u,%u,%u", &weights[0], &weights[1], &weights[2]) == 3 &&
+            weights[0] > 0 && weights[1] > 0 && weights[2] > 0) {
+            weighted = true;
+            continue;
+        }
+        usage(argv[0]);
+        return 1;
+    }
+    if (argc - optind != 1 || (rx_align && ncpus == 0)) {
+        usage(argv[0]);
         return 1;
     }
     signal(SIGPIPE, SIG_IGN); // evitar terminación por escritura a socket cerrado
 
-    int port = atoi(argv[1]);
+    int port = atoi(argv[optind]);
+#ifdef TRACE
+    // Antes de crear cualquier hilo: todos heredan SIGINT/SIGTERM bloqueadas y solo las
+    // recibe el hilo que vuelca las trazas.
+    static sigset_t trace_sigs;
+    sigemptyset(&trace_sigs);
+    sigaddset(&trace_sigs, SIGINT);
+    sigaddset(&trace_sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &trace_sigs, NULL);
+    pthread_t trace_th;
+    if (trace_init() != 0 || pthread_create(&trace_th, NULL, trace_signal_thread, &trace_sigs) != 0) {
+        fprintf(stderr, "No se pudieron iniciar las trazas\n");
+        return 1;
+    }
+#endif
+    if (log_init((LogLevel)level, LOG_RING_RECORDS) != 0) {
+        fprintf(stderr, "No se pudo iniciar el hilo de log\n");
+        return 1;
+    }
     int srv = socket(AF_INET, SOCK_STREAM, 0);
     if (srv < 0) { perror("socket"); return 1; }
 
@@ -280,6 +1102,18 @@ int main(int argc, char **argv) {
     }
 
     printf("[broker] Escuchando en puerto %d ...\n", port);
+    if (weighted) {
+        printf("[broker] Reparto ponderado entre prioridades %u:%u:%u\n", weights[0], weights[1], weights[2]);
+    }
+    if (ncpus > 0) {
+        printf("[broker] Conexiones fijadas a %d CPU(s)%s:", ncpus, rx_align ? " (según la CPU de recepción)" : "");
+        for (int i = 0; i < ncpus; i++) printf(" %d(nodo %d)", cpu_list[i], cpu_node(cpu_list[i]));
+        printf("\n");
+    }
+
+    pthread_t st;
+    pthread_create(&st, NULL, stats_thread, NULL);
+    pthread_detach(st);
 
     // Bucle principal: aceptar clientes y lanzar hilo.
     while (1) {
@@ -293,13 +1127,14 @@ int main(int argc, char **argv) {
         }
         ClientInfo *ci = (ClientInfo *)malloc(sizeof(ClientInfo));
         ci->fd = fd; ci->addr = cli;
+        ci->cpu = choose_cpu(fd);
+        if (ci->cpu >= 0) log_debug("[broker] Cliente %d en CPU %d\n", fd, ci->cpu);
 
         pthread_t th;
-        pthread_create(&th, NULL, client_thread, ci);
+        start_thread(&th, client_thread, ci, ci->cpu);
         pthread_detach(th); // no join; limpiará el SO al terminar
     }
 
     close(srv);
     return 0;
 }
-
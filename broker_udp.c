@@ -1,119 +1,1017 @@
 #define _GNU_SOURCE         // Habilita extensiones no estándar de GNU en las librerías, a veces necesario para funciones avanzadas.
 #include <arpa/inet.h>      // Provee funciones para manipular direcciones IP, como inet_ntop() que convierte IPs de binario a texto.
 #include <errno.h>          // Permite el manejo de errores a través de la variable 'errno' y constantes como EINTR.
+#include <limits.h>         // ULLONG_MAX: límite al leer números de secuencia de un NAK.
 #include <netinet/in.h>     // Define la estructura 'sockaddr_in' y constantes necesarias para la programación de sockets de Internet.
+#include <pthread.h>        // Hilos POSIX: un hilo por núcleo, cada uno con su propio socket.
+#include <stdatomic.h>      // Operaciones atómicas para leer el registro de suscriptores sin locks.
 #include <stdbool.h>        // Define el tipo de dato booleano 'bool' y los valores 'true' y 'false'.
 #include <stdio.h>          // Librería estándar de Entrada/Salida para funciones como printf(), fprintf() y sscanf().
 #include <stdlib.h>         // Librería estándar que provee funciones de gestión de memoria (calloc, free) y conversión de tipos (atoi).
 #include <string.h>         // Provee funciones para la manipulación de cadenas de caracteres, como strcmp(), strncpy() y strlen().
+#include <sys/epoll.h>      // epoll: cada hilo espera a la vez su socket y su cola de trabajos.
+#include <sys/eventfd.h>    // eventfd: despierta a un hilo cuando otro le delega envíos.
 #include <sys/socket.h>     // Contiene las definiciones y estructuras principales para la API de sockets (socket(), bind(), sendto(), recvfrom()).
 #include <sys/types.h>      // Define tipos de datos primitivos usados en llamadas al sistema, como ssize_t y socklen_t.
+#include <time.h>           // clock_gettime()/clock_nanosleep() para los ticks de la rueda de concesiones.
 #include <unistd.h>         // Provee acceso a la API del sistema operativo POSIX, incluyendo la función close() para cerrar descriptores de archivo.
 
+#include "log_ring.h"       // Log asíncrono: el camino caliente solo copia un registro binario a un anillo por hilo.
+#include "udp_gso.h"        // Envío con UDP_SEGMENT (GSO) y recepción coalescida (GRO), con respaldo a sendto().
+
 #define MAX_BUFFER 4096
 #define TOPIC_MAX 128
 #define MAX_SUBSCRIBERS 512 // Límite por tema
+#define RX_BATCH 16         // datagramas por recvmmsg()
+#define RX_BUF_SIZE 65536   // con GRO un datagrama puede traer varios segmentos pegados
+#define MAX_PENDING 1024    // publicaciones por lote antes de reenviar
+#define MAX_WORKERS 64
+#define TOPIC_BUCKETS 1024  // tabla hash de temas
+#define FANOUT_SPLIT 256    // a partir de cuántos suscriptores se reparte el envío entre hilos
+#define QS_OFFLINE UINT64_MAX
+#define TICK_MS 100         // resolución de la rueda de tiempo de las concesiones
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS) // ranuras por nivel
+#define WHEEL_LEVELS 4      // 64^4 ticks de 100 ms ≈ 19 días
+#define DEFAULT_LEASE_S 30  // duración por defecto de una suscripción sin renovar
+#define RTX_RING 1024       // mensajes recientes por tema guardados para retransmitir (-R)
+#define RTX_MAX_PER_NAK 256 // tope de retransmisiones por NAK (evita amplificación)
+#define FRAME_OVERHEAD (TOPIC_MAX + 32) // "DAT <seq> <tema> " delante de cada mensaje
+#define TXBUF_SIZE (RX_BATCH * RX_BUF_SIZE + MAX_PENDING * FRAME_OVERHEAD)
+#define MCAST_GROUPS 256    // grupos consecutivos desde la base de -m; luego se comparten
+#define LOG_RING_RECORDS 4096   // registros por hilo en el anillo de log (si se llena, se descartan)
+#define DEFAULT_MCAST_PORT 6000
+#define PUB_TABLE_SIZE 4096 // publicadores con límite de tasa seguidos por hilo (-p)
+#define PUB_PROBE 8         // posiciones que se prueban antes de reemplazar una entrada
+#define RATE_REPORT_TICKS 10 // cada cuántos ticks se informan los descartes por tasa
 
-// Estructura para almacenar la dirección de un suscriptor
-typedef struct SubNode {
-    struct sockaddr_in addr;
-    struct SubNode *next;
-} SubNode;
+// Conjunto de suscriptores de un tema. Es inmutable una vez publicado: los hilos
+// lo leen sin locks y los cambios (SUB) crean una copia nueva (copy-on-write).
+typedef struct SubSet {
+    size_t count;
+    struct sockaddr_in addrs[];
+} SubSet;
 
-// Estructura para un tema (partido) y sus suscriptores
+// Estructura para un tema (partido) y sus suscriptores.
+// Los temas nunca se liberan, así que un puntero a Topic es válido para siempre.
 typedef struct Topic {
     char name[TOPIC_MAX];
-    SubNode *subs;
-    struct Topic *next;
+    _Atomic(SubSet *) subs;
+    _Atomic(struct Topic *) next;
+    bool dirty;                          // hay concesiones vencidas por quitar (bajo registry_mtx)
+    // Modo confiable (-R): número de secuencia y anillo de retransmisión del tema.
+    pthread_mutex_t rtx_mtx;
+    uint64_t seq;                        // último número de secuencia asignado
+    struct RtxSlot *ring;                // RTX_RING mensajes recientes (se crea al primer PUB)
+    struct sockaddr_in group;            // modo multicast (-m): grupo y puerto del tema
+    _Atomic uint64_t tat;                // límite por tema (-r): instante teórico de llegada (ns)
+    _Atomic uint64_t limited;            // publicaciones descartadas por -r desde el último informe
 } Topic;
 
-static Topic *topics = NULL;
+// Mensaje guardado para retransmitir, ya con su encabezado "DAT <seq> <tema> ".
+typedef struct RtxSlot {
+    uint64_t seq;
+    size_t len;
+    size_t cap;
+    char *frame;
+} RtxSlot;
 
-// Busca un tema por su nombre. Si no existe, lo crea.
-static Topic *find_or_create_topic(const char *name) {
-    Topic *t = topics;
-    while (t) {
+static bool reliable = false;            // -R: secuencias por tema + NAK
+
+// Modo multicast (-m): cada tema se asigna a un grupo y cada publicación sale una
+// sola vez hacia el grupo, sin importar cuántos suscriptores tenga.
+static bool multicast = false;
+static struct in_addr mcast_base;        // primer grupo (p.ej. 239.1.1.0)
+static uint16_t mcast_port = DEFAULT_MCAST_PORT;
+static struct in_addr mcast_if;          // interfaz de salida (-i), INADDR_ANY = según rutas
+static int mcast_ttl = 1;                // 1 = no sale de la red local
+static unsigned topic_count = 0;         // temas creados (bajo registry_mtx)
+
+// Límites de tasa (-r por tema, -p por publicador): token bucket con ráfaga, llevado
+// como GCRA, que equivale a un balde de 'burst' fichas que se recarga a 'rate' por
+// segundo pero guarda un solo instante (TAT) por balde. Eso permite actualizarlo con un
+// compare-and-swap cuando varios hilos publican en el mismo tema.
+typedef struct {
+    double rate;                         // mensajes por segundo (0 = sin límite)
+    unsigned burst;                      // mensajes seguidos admitidos
+    uint64_t interval_ns;                // 1 / rate
+    uint64_t tolerance_ns;               // (burst - 1) * interval
+} RateLimit;
+
+static RateLimit topic_limit, pub_limit;
+
+// Estado del límite de un publicador (ip:puerto). Cada publicador cae siempre en el
+// mismo hilo (SO_REUSEPORT reparte por flujo), así que la tabla es por hilo y sin locks.
+typedef struct {
+    uint32_t ip;
+    uint16_t port;
+    bool warned;                         // ya se avisó que supera el límite
+    uint64_t tat;
+} PubRate;
+
+// Registro global de temas: lectura sin locks, escritura serializada por 'registry_mtx'.
+static _Atomic(Topic *) topic_buckets[TOPIC_BUCKETS];
+static pthread_mutex_t registry_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+// Recuperación diferida de memoria (QSBR): un SubSet reemplazado se libera recién
+// cuando todos los hilos pasaron por un estado quiescente posterior al reemplazo.
+typedef struct Retired {
+    SubSet *set;
+    uint64_t epoch;
+    struct Retired *next;
+} Retired;
+
+static _Atomic uint64_t global_epoch = 1;
+static Retired *retired = NULL;          // protegido por registry_mtx
+
+// Trabajo de reenvío delegado a otro hilo: copia de los mensajes y de un tramo de destinos.
+typedef struct FanoutJob {
+    size_t nmsgs;
+    size_t naddrs;
+    size_t *lens;
+    char *data;                          // mensajes concatenados
+    struct sockaddr_in *addrs;
+    struct FanoutJob *next;
+} FanoutJob;
+
+// Publicación pendiente de reenvío: apunta al buffer de recepción, que sigue vivo
+// hasta que se vacía el lote (antes del siguiente recvmmsg).
+typedef struct {
+    Topic *topic;
+    const char *msg;
+    size_t len;
+} PendingMsg;
+
+// Estado de cada hilo: su propio socket SO_REUSEPORT, buffers y cola de trabajos.
+typedef struct Worker {
+    int id;
+    int sockfd;
+    int epfd;
+    int evfd;                            // eventfd para despertar al hilo cuando recibe trabajos
+    bool gro;
+    bool gso;
+    _Atomic uint64_t quiescent;          // última época vista (QS_OFFLINE si está bloqueado)
+    pthread_mutex_t jobs_mtx;
+    FanoutJob *jobs_head, *jobs_tail;
+    PendingMsg pending[MAX_PENDING];
+    size_t pending_count;
+    char *txbuf;                         // mensajes con encabezado DAT/MSG del lote en curso (-R, -m)
+    size_t txused;
+    struct iovec iov[MAX_PENDING];
+    char (*bufs)[RX_BUF_SIZE];
+    uint64_t now_ns;                     // reloj del lote en curso (límites de tasa)
+    PubRate *pubs;                       // PUB_TABLE_SIZE entradas (solo con -p)
+    _Atomic uint64_t pub_limited;        // descartes por -p desde el último informe
+    pthread_t thread;
+} Worker;
+
+static Worker *workers[MAX_WORKERS];
+static int nworkers = 1;
+
+static uint32_t topic_hash(const char *name) {
+    uint32_t h = 2166136261u;            // FNV-1a
+    for (; *name; name++) h = (h ^ (uint8_t)*name) * 16777619u;
+    return h;
+}
+
+// Busca un tema existente (sin crearlo). Seguro sin locks.
+static Topic *find_topic(const char *name) {
+    Topic *t = atomic_load(&topic_buckets[topic_hash(name) % TOPIC_BUCKETS]);
+    for (; t; t = atomic_load(&t->next)) {
         if (strcmp(t->name, name) == 0) return t;
-        t = t->next;
     }
+    return NULL;
+}
+
+// Busca un tema por su nombre. Si no existe, lo crea.
+// PRE: se llama con registry_mtx tomado.
+static Topic *find_or_create_topic(const char *name) {
+    Topic *t = find_topic(name);
+    if (t) return t;
     // No encontrado, crear nuevo tema
     Topic *nt = (Topic *)calloc(1, sizeof(Topic));
     if (!nt) {
         perror("calloc para Topic");
         return NULL;
     }
-    strncpy(nt->name, name, TOPIC_MAX - 1);
-    nt->subs = NULL;
-    nt->next = topics;
-    topics = nt; // Agregar a la lista global
-    printf("[broker] Tema nuevo creado: '%s'\n", name);
+    snprintf(nt->name, sizeof(nt->name), "%s", name);
+    pthread_mutex_init(&nt->rtx_mtx, NULL);
+    if (multicast) {
+        nt->group.sin_family = AF_INET;
+        nt->group.sin_addr.s_addr = htonl(ntohl(mcast_base.s_addr) + topic_count % MCAST_GROUPS);
+        nt->group.sin_port = htons(mcast_port);
+    }
+    topic_count++;
+    _Atomic(Topic *) *bucket = &topic_buckets[topic_hash(name) % TOPIC_BUCKETS];
+    atomic_store(&nt->next, atomic_load(bucket));
+    atomic_store(bucket, nt); // publicar: los lectores ven el tema ya inicializado
+    log_info("[broker] Tema nuevo creado: '%s'\n", name);
     return nt;
 }
 
-// Agrega un suscriptor a la lista de un tema.
-static void add_subscriber(const char *topic_name, const struct sockaddr_in *sub_addr) {
+// Libera los conjuntos retirados que ya ningún hilo puede estar leyendo.
+// PRE: se llama con registry_mtx tomado.
+static void reclaim_retired(void) {
+    uint64_t min = QS_OFFLINE;
+    for (int i = 0; i < nworkers; i++) {
+        uint64_t q = atomic_load(&workers[i]->quiescent);
+        if (q < min) min = q;
+    }
+    Retired **pp = &retired;
+    while (*pp) {
+        if ((*pp)->epoch <= min) {
+            Retired *dead = *pp;
+            *pp = dead->next;
+            free(dead->set);
+            free(dead);
+        } else {
+            pp = &(*pp)->next;
+        }
+    }
+}
+
+// Reemplaza el conjunto de suscriptores de 't' y retira el anterior.
+// PRE: se llama con registry_mtx tomado.
+static void publish_subs(Topic *t, SubSet *nset) {
+    SubSet *old = atomic_exchange(&t->subs, nset);
+    if (old) {
+        Retired *r = (Retired *)malloc(sizeof(Retired));
+        if (r) {
+            r->set = old;
+            r->epoch = atomic_fetch_add(&global_epoch, 1) + 1;
+            r->next = retired;
+            retired = r;
+        }
+    }
+    reclaim_retired();
+}
+
+// ---------------------------------------------------------------------------
+// Concesiones (leases): una suscripción vence si el suscriptor no la renueva
+// reenviando "SUB <tema>" antes de 'lease_ticks'. Los vencimientos se llevan en
+// una rueda de tiempo jerárquica: cada tick cuesta O(vencidos + reubicados).
+// Todo este estado se protege con registry_mtx.
+// ---------------------------------------------------------------------------
+
+typedef struct Lease {
+    Topic *topic;
+    struct sockaddr_in addr;
+    uint64_t expires;                    // tick de vencimiento
+    struct Lease *wprev, *wnext;         // lista doble de la ranura de la rueda
+    struct Lease **wslot;                // ranura en la que está (para quitarla en O(1))
+    struct Lease *hnext;                 // cadena en la tabla hash
+} Lease;
+
+static uint64_t lease_ticks = (DEFAULT_LEASE_S * 1000) / TICK_MS; // 0 = sin vencimiento
+static Lease *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t wheel_tick = 0;          // último tick procesado
+static Lease **lease_table = NULL;
+static size_t lease_buckets = 0;
+static size_t lease_count = 0;
+static unsigned long long expired_total = 0;
+
+static size_t lease_hash(const Topic *t, const struct sockaddr_in *addr) {
+    uint64_t h = (uint64_t)(uintptr_t)t;
+    h ^= ((uint64_t)addr->sin_addr.s_addr << 16) ^ addr->sin_port;
+    h *= 0x9E3779B97F4A7C15ull;
+    return (size_t)(h >> 20);
+}
+
+static Lease *lease_find(const Topic *t, const struct sockaddr_in *addr) {
+    if (!lease_table) return NULL;
+    for (Lease *l = lease_table[lease_hash(t, addr) % lease_buckets]; l; l = l->hnext) {
+        if (l->topic == t && l->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            l->addr.sin_port == addr->sin_port) return l;
+    }
+    return NULL;
+}
+
+// Duplica la tabla hash cuando la carga supera 1.
+static bool lease_table_grow(void) {
+    size_t nb = lease_buckets ? lease_buckets * 2 : 1024;
+    Lease **nt = (Lease **)calloc(nb, sizeof(Lease *));
+    if (!nt) return false;
+    for (size_t i = 0; i < lease_buckets; i++) {
+        Lease *l = lease_table[i];
+        while (l) {
+            Lease *next = l->hnext;
+            size_t b = lease_hash(l->topic, &l->addr) % nb;
+            l->hnext = nt[b];
+            nt[b] = l;
+            l = next;
+        }
+    }
+    free(lease_table);
+    lease_table = nt;
+    lease_buckets = nb;
+    return true;
+}
+
+static void lease_unhash(Lease *l) {
+    Lease **pp = &lease_table[lease_hash(l->topic, &l->addr) % lease_buckets];
+    while (*pp && *pp != l) pp = &(*pp)->hnext;
+    if (*pp) *pp = l->hnext;
+}
+
+// Ubica la concesión en la rueda según cuánto falta para su vencimiento.
+static void wheel_insert(Lease *l) {
+    uint64_t delta = l->expires > wheel_tick ? l->expires - wheel_tick : 0;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_BITS * (level + 1)))) level++;
+    uint64_t when = l->expires;
+    if (level == WHEEL_LEVELS - 1 && delta >= (1ull << (WHEEL_BITS * WHEEL_LEVELS))) {
+        when = wheel_tick + (1ull << (WHEEL_BITS * WHEEL_LEVELS)) - 1; // fuera de rango: se reubica al cascadear
+    }
+    Lease **slot = &wheel[level][(when >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+    l->wprev = NULL;
+    l->wnext = *slot;
+    l->wslot = slot;
+    if (*slot) (*slot)->wprev = l;
+    *slot = l;
+}
+
+static void wheel_remove(Lease *l) {
+    if (l->wprev) l->wprev->wnext = l->wnext;
+    else *l->wslot = l->wnext;
+    if (l->wnext) l->wnext->wprev = l->wprev;
+    l->wprev = l->wnext = NULL;
+}
+
+// Avanza la rueda hasta 'now' y devuelve (encadenadas por wnext) las concesiones vencidas.
+static Lease *wheel_advance(uint64_t now) {
+    Lease *expired = NULL;
+    while (wheel_tick < now) {
+        wheel_tick++;
+        // Al completar una vuelta de un nivel se reubica la ranura actual del nivel superior.
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if ((wheel_tick & ((1ull << (WHEEL_BITS * level)) - 1)) != 0) break;
+            Lease **slot = &wheel[level][(wheel_tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+            Lease *l = *slot;
+            *slot = NULL;
+            while (l) {
+                Lease *next = l->wnext;
+                wheel_insert(l);
+                l = next;
+            }
+        }
+        Lease **slot = &wheel[0][wheel_tick & (WHEEL_SLOTS - 1)];
+        while (*slot) {
+            Lease *l = *slot;
+            *slot = l->wnext;
+            if (l->expires > wheel_tick) { // vuelta anticipada por rango: reubicar
+                wheel_insert(l);
+                continue;
+            }
+            l->wprev = NULL;
+            l->wnext = expired;
+            expired = l;
+        }
+    }
+    return expired;
+}
+
+// Crea o renueva la concesión de 'addr' en 't'. Devuelve true si ya existía.
+static bool lease_touch(Topic *t, const struct sockaddr_in *addr) {
+    Lease *l = lease_find(t, addr);
+    if (l) {
+        wheel_remove(l);
+        l->expires = wheel_tick + lease_ticks;
+        wheel_insert(l);
+        return true;
+    }
+    if (lease_count >= lease_buckets && !lease_table_grow()) return false;
+    l = (Lease *)calloc(1, sizeof(Lease));
+    if (!l) return false;
+    l->topic = t;
+    l->addr = *addr;
+    l->expires = wheel_tick + lease_ticks;
+    size_t b = lease_hash(t, addr) % lease_buckets;
+    l->hnext = lease_table[b];
+    lease_table[b] = l;
+    lease_count++;
+    wheel_insert(l);
+    return false;
+}
+
+// Rehace el conjunto de 't' dejando solo los suscriptores con concesión vigente.
+static void rebuild_live_subs(Topic *t) {
+    SubSet *cur = atomic_load(&t->subs);
+    size_t count = cur ? cur->count : 0;
+    SubSet *nset = (SubSet *)malloc(sizeof(SubSet) + count * sizeof(struct sockaddr_in));
+    if (!nset) return; // se reintenta en el próximo vencimiento del tema
+    nset->count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (lease_find(t, &cur->addrs[i])) nset->addrs[nset->count++] = cur->addrs[i];
+    }
+    publish_subs(t, nset);
+}
+
+// Procesa los vencimientos hasta 'now'. Devuelve cuántas suscripciones expiraron.
+static size_t expire_leases(uint64_t now) {
+    Lease *expired = wheel_advance(now);
+    size_t n = 0;
+    for (Lease *l = expired; l; l = l->wnext) {
+        lease_unhash(l);
+        lease_count--;
+        l->topic->dirty = true;
+        n++;
+    }
+    while (expired) {
+        Lease *l = expired;
+        expired = l->wnext;
+        if (l->topic->dirty) {
+            rebuild_live_subs(l->topic);
+            l->topic->dirty = false;
+        }
+        free(l);
+    }
+    expired_total += n;
+    return n;
+}
+
+// Agrega un suscriptor a la lista de un tema. Devuelve el tema (NULL si falló).
+static Topic *add_subscriber(const char *topic_name, const struct sockaddr_in *sub_addr) {
+    pthread_mutex_lock(&registry_mtx);
     Topic *t = find_or_create_topic(topic_name);
-    if (!t) return;
+    if (!t) {
+        pthread_mutex_unlock(&registry_mtx);
+        return NULL;
+    }
+
+    // Renovación de una concesión vigente: no cambia el conjunto de suscriptores.
+    if (lease_ticks > 0 && lease_touch(t, sub_addr)) {
+        pthread_mutex_unlock(&registry_mtx);
+        return t;
+    }
 
     // Verificar si el suscriptor ya existe para evitar duplicados
-    for (SubNode *current = t->subs; current != NULL; current = current->next) {
-        if (current->addr.sin_addr.s_addr == sub_addr->sin_addr.s_addr &&
-            current->addr.sin_port == sub_addr->sin_port) {
-            return;
+    SubSet *cur = atomic_load(&t->subs);
+    size_t count = cur ? cur->count : 0;
+    for (size_t i = 0; i < count; i++) {
+        if (cur->addrs[i].sin_addr.s_addr == sub_addr->sin_addr.s_addr &&
+            cur->addrs[i].sin_port == sub_addr->sin_port) {
+            pthread_mutex_unlock(&registry_mtx);
+            return t;
         }
     }
 
-    // Agregar nuevo suscriptor
-    SubNode *node = (SubNode *)calloc(1, sizeof(SubNode));
-    if (!node) {
-        perror("calloc para SubNode");
-        return;
+    // Agregar nuevo suscriptor (copia del conjunto actual + el nuevo)
+    SubSet *nset = (SubSet *)malloc(sizeof(SubSet) + (count + 1) * sizeof(struct sockaddr_in));
+    if (!nset) {
+        perror("malloc para SubSet");
+        pthread_mutex_unlock(&registry_mtx);
+        return NULL;
+    }
+    if (count) memcpy(nset->addrs, cur->addrs, count * sizeof(struct sockaddr_in));
+    nset->addrs[count] = *sub_addr;
+    nset->count = count + 1;
+    publish_subs(t, nset);
+    pthread_mutex_unlock(&registry_mtx);
+
+    log_info("[broker] Nuevo suscriptor %I:%d para el tema '%s'\n",
+             sub_addr->sin_addr.s_addr, ntohs(sub_addr->sin_port), topic_name);
+    return t;
+}
+
+// Entrega un trabajo de reenvío a otro hilo y lo despierta.
+static void push_job(Worker *w, FanoutJob *job) {
+    pthread_mutex_lock(&w->jobs_mtx);
+    if (w->jobs_tail) w->jobs_tail->next = job;
+    else w->jobs_head = job;
+    w->jobs_tail = job;
+    pthread_mutex_unlock(&w->jobs_mtx);
+    uint64_t one = 1;
+    ssize_t r = write(w->evfd, &one, sizeof(one));
+    (void)r;
+}
+
+// Crea un trabajo con copia de los mensajes iov[0..n) y de los destinos addrs[0..naddrs).
+static FanoutJob *make_job(const struct iovec *iov, size_t n,
+                           const struct sockaddr_in *addrs, size_t naddrs) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) total += iov[i].iov_len;
+    FanoutJob *job = (FanoutJob *)calloc(1, sizeof(FanoutJob));
+    if (!job) return NULL;
+    job->lens = (size_t *)malloc(n * sizeof(size_t));
+    job->data = (char *)malloc(total ? total : 1);
+    job->addrs = (struct sockaddr_in *)malloc(naddrs * sizeof(struct sockaddr_in));
+    if (!job->lens || !job->data || !job->addrs) {
+        free(job->lens); free(job->data); free(job->addrs); free(job);
+        return NULL;
     }
-    node->addr = *sub_addr;
-    node->next = t->subs;
-    t->subs = node;
-    char sub_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &(sub_addr->sin_addr), sub_ip, INET_ADDRSTRLEN);
-    printf("[broker] Nuevo suscriptor %s:%d para el tema '%s'\n", sub_ip, ntohs(sub_addr->sin_port), topic_name);
-}
-
-// Reenvía un mensaje a todos los suscriptores de un tema.
-static void broadcast_to_topic(int sockfd, const char *topic_name, const char *msg) {
-    Topic *t = topics;
-    while (t) {
-        if (strcmp(t->name, topic_name) == 0) {
-            for (SubNode *sub = t->subs; sub; sub = sub->next) {
-                // sendto(): Envía un datagrama UDP al suscriptor.
-                // - sockfd: descriptor de socket UDP del broker.
-                // - msg: buffer con el mensaje a reenviar.
-                // - strlen(msg): tamaño del mensaje.
-                // - 0: sin flags adicionales.
-                // - sub->addr: dirección IP y puerto del suscriptor.
-                // - sizeof(sub->addr): tamaño de la estructura sockaddr_in.
-                sendto(sockfd, msg, strlen(msg), 0, (const struct sockaddr *)&sub->addr, sizeof(sub->addr));
+    size_t off = 0;
+    for (size_t i = 0; i < n; i++) {
+        memcpy(job->data + off, iov[i].iov_base, iov[i].iov_len);
+        job->lens[i] = iov[i].iov_len;
+        off += iov[i].iov_len;
+    }
+    memcpy(job->addrs, addrs, naddrs * sizeof(struct sockaddr_in));
+    job->nmsgs = n;
+    job->naddrs = naddrs;
+    return job;
+}
+
+// Envía a cada destino de addrs[0..naddrs) la secuencia de mensajes iov[0..n).
+// Con GSO, la secuencia hacia un mismo suscriptor sale en un solo sendmsg().
+static void send_to_addrs(Worker *w, struct iovec *iov, size_t n,
+                          const struct sockaddr_in *addrs, size_t naddrs) {
+    for (size_t i = 0; i < naddrs; i++) {
+        udp_send_batch(w->sockfd, &w->gso, iov, n,
+                       (const struct sockaddr *)&addrs[i], sizeof(addrs[i]));
+    }
+}
+
+// Ejecuta los trabajos de reenvío que otros hilos delegaron en 'w'.
+static void run_jobs(Worker *w) {
+    uint64_t cnt;
+    ssize_t r = read(w->evfd, &cnt, sizeof(cnt));
+    (void)r;
+    pthread_mutex_lock(&w->jobs_mtx);
+    FanoutJob *job = w->jobs_head;
+    w->jobs_head = w->jobs_tail = NULL;
+    pthread_mutex_unlock(&w->jobs_mtx);
+
+    while (job) {
+        size_t off = 0;
+        for (size_t i = 0; i < job->nmsgs; i++) {
+            w->iov[i].iov_base = job->data + off;
+            w->iov[i].iov_len = job->lens[i];
+            off += job->lens[i];
+        }
+        send_to_addrs(w, w->iov, job->nmsgs, job->addrs, job->naddrs);
+        FanoutJob *next = job->next;
+        free(job->lens); free(job->data); free(job->addrs); free(job);
+        job = next;
+    }
+}
+
+// Reenvía todas las publicaciones pendientes, agrupadas por tema.
+// Para cada suscriptor, los mensajes del lote forman una secuencia de datagramas al
+// mismo destino: con GSO se entregan en un solo sendmsg(); sin GSO, un sendto() cada uno.
+// Los temas con muchos suscriptores se reparten en tramos entre todos los hilos.
+static void flush_pending(Worker *w) {
+    for (size_t i = 0; i < w->pending_count; i++) {
+        Topic *t = w->pending[i].topic;
+        if (!t) continue; // ya enviado junto con otro mensaje del mismo tema
+
+        size_t n = 0;
+        for (size_t j = i; j < w->pending_count; j++) {
+            if (w->pending[j].topic != t) continue;
+            w->iov[n].iov_base = (void *)w->pending[j].msg;
+            w->iov[n].iov_len = w->pending[j].len;
+            n++;
+            w->pending[j].topic = NULL;
+        }
+
+        SubSet *set = atomic_load(&t->subs);
+        if (!set || set->count == 0) continue;
+        if (multicast) {
+            // Una sola copia hacia el grupo del tema, no una por suscriptor.
+            udp_send_batch(w->sockfd, &w->gso, w->iov, n,
+                           (const struct sockaddr *)&t->group, sizeof(t->group));
+            continue;
+        }
+        size_t local = set->count;
+        if (nworkers > 1 && set->count >= FANOUT_SPLIT) {
+            // Tramos iguales: este hilo se queda con el primero, el resto se delega.
+            size_t chunk = (set->count + (size_t)nworkers - 1) / (size_t)nworkers;
+            local = chunk;
+            for (int k = 1; k < nworkers; k++) {
+                size_t lo = (size_t)k * chunk;
+                if (lo >= set->count) break;
+                size_t hi = lo + chunk < set->count ? lo + chunk : set->count;
+                Worker *dst = workers[(w->id + k) % nworkers];
+                FanoutJob *job = make_job(w->iov, n, &set->addrs[lo], hi - lo);
+                if (job) push_job(dst, job);
+                else send_to_addrs(w, w->iov, n, &set->addrs[lo], hi - lo);
+            }
+        }
+        send_to_addrs(w, w->iov, n, set->addrs, local);
+    }
+    w->pending_count = 0;
+    w->txused = 0;
+}
+
+// Modo confiable: asigna el siguiente número de secuencia del tema, arma la trama
+// "DAT <seq> <tema> <mensaje>" en 'out' y la guarda en el anillo de retransmisión.
+// Devuelve la longitud de la trama (0 si no hay memoria).
+static size_t stamp_message(Topic *t, const char *msg, size_t len, char *out) {
+    pthread_mutex_lock(&t->rtx_mtx);
+    if (!t->ring) {
+        t->ring = (RtxSlot *)calloc(RTX_RING, sizeof(RtxSlot));
+        if (!t->ring) {
+            pthread_mutex_unlock(&t->rtx_mtx);
+            return 0;
+        }
+    }
+    uint64_t seq = ++t->seq;
+    int hdr = snprintf(out, FRAME_OVERHEAD, "DAT %llu %s ", (unsigned long long)seq, t->name);
+    memcpy(out + hdr, msg, len);
+    size_t flen = (size_t)hdr + len;
+
+    RtxSlot *slot = &t->ring[seq % RTX_RING];
+    if (slot->cap < flen) {
+        char *nf = (char *)realloc(slot->frame, flen);
+        if (!nf) {
+            slot->seq = 0; // sin copia: ese número no podrá retransmitirse
+            pthread_mutex_unlock(&t->rtx_mtx);
+            return flen;
+        }
+        slot->frame = nf;
+        slot->cap = flen;
+    }
+    memcpy(slot->frame, out, flen);
+    slot->len = flen;
+    slot->seq = seq;
+    pthread_mutex_unlock(&t->rtx_mtx);
+    return flen;
+}
+
+// Modo multicast sin -R: antepone "MSG <tema> " para que el suscriptor pueda
+// filtrar (varios temas pueden compartir grupo). Devuelve la longitud de la trama.
+static size_t frame_message(Topic *t, const char *msg, size_t len, char *out) {
+    int hdr = snprintf(out, FRAME_OVERHEAD, "MSG %s ", t->name);
+    memcpy(out + hdr, msg, len);
+    return (size_t)hdr + len;
+}
+
+// Modo multicast: responde a cada SUB con "MCAST <tema> <grupo> <puerto>".
+static void send_mcast_info(Worker *w, Topic *t, const struct sockaddr_in *to) {
+    char group_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &t->group.sin_addr, group_ip, sizeof(group_ip));
+    char line[FRAME_OVERHEAD + INET_ADDRSTRLEN];
+    int n = snprintf(line, sizeof(line), "MCAST %s %s %u", t->name, group_ip, ntohs(t->group.sin_port));
+    sendto(w->sockfd, line, (size_t)n, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+// Modo confiable: informa al suscriptor el último número de secuencia del tema.
+// Se responde a cada SUB (alta y latidos), lo que además permite detectar la
+// pérdida de los últimos mensajes de una ráfaga sin tráfico extra de fan-out.
+static void send_seq(Worker *w, Topic *t, const struct sockaddr_in *to) {
+    pthread_mutex_lock(&t->rtx_mtx);
+    uint64_t seq = t->seq;
+    pthread_mutex_unlock(&t->rtx_mtx);
+    char line[FRAME_OVERHEAD];
+    int n = snprintf(line, sizeof(line), "SEQ %s %llu", t->name, (unsigned long long)seq);
+    sendto(w->sockfd, line, (size_t)n, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+// Modo confiable: atiende "NAK <tema> <a>-<b>[,<c>-<d>...]" reenviando solo al
+// solicitante los mensajes que siguen en el anillo; los demás se informan con LOST.
+// Lee un número decimal de [*p, end) y avanza *p. El datagrama no termina en '\0', así
+// que no se usa strtoull(). Devuelve false si no hay dígitos (o el número desborda).
+static bool parse_seq(const char **p, const char *end, unsigned long long *v) {
+    const char *q = *p;
+    unsigned long long x = 0;
+    while (q < end && *q >= '0' && *q <= '9') {
+        unsigned d = (unsigned)(*q - '0');
+        if (x > (ULLONG_MAX - d) / 10) return false;
+        x = x * 10 + d;
+        q++;
+    }
+    if (q == *p) return false;
+    *p = q;
+    *v = x;
+    return true;
+}
+
+static void handle_nak(Worker *w, const char *topic_name, const char *ranges, size_t len,
+                       const struct sockaddr_in *to) {
+    Topic *t = find_topic(topic_name);
+    if (!t) return;
+
+    static __thread char out[UDP_GSO_MAX_BYTES];
+    struct iovec iov[UDP_GSO_MAX_SEGS];
+    size_t n = 0, used = 0, budget = RTX_MAX_PER_NAK;
+    const char *p = ranges, *end = ranges + len;
+
+    while (p < end && budget > 0) {
+        unsigned long long a, b;
+        if (!parse_seq(&p, end, &a)) break;
+        b = a;
+        if (p < end && *p == '-') {
+            p++;
+            if (!parse_seq(&p, end, &b)) break;
+        }
+        p = (p < end && *p == ',') ? p + 1 : end;
+        if (b < a || a == 0) continue;
+
+        unsigned long long lost_from = 0, lost_to = 0;
+        for (unsigned long long seq = a; seq <= b && budget > 0; seq++, budget--) {
+            bool found = false;
+            pthread_mutex_lock(&t->rtx_mtx);
+            RtxSlot *slot = t->ring ? &t->ring[seq % RTX_RING] : NULL;
+            if (slot && slot->seq == seq && used + slot->len <= sizeof(out)) {
+                memcpy(out + used, slot->frame, slot->len);
+                iov[n].iov_base = out + used;
+                iov[n].iov_len = slot->len;
+                used += slot->len;
+                n++;
+                found = true;
+            }
+            pthread_mutex_unlock(&t->rtx_mtx);
+
+            if (!found) {
+                if (!lost_from) lost_from = seq;
+                lost_to = seq;
+            }
+            if (n == UDP_GSO_MAX_SEGS || used + FRAME_OVERHEAD + MAX_BUFFER > sizeof(out)) {
+                udp_send_batch(w->sockfd, &w->gso, iov, n, (const struct sockaddr *)to, sizeof(*to));
+                n = used = 0;
             }
+        }
+        if (lost_from) {
+            // Ya no están en el anillo: el suscriptor deja de pedirlos.
+            char line[FRAME_OVERHEAD + 48];
+            int ln = snprintf(line, sizeof(line), "LOST %s %llu-%llu", t->name, lost_from, lost_to);
+            sendto(w->sockfd, line, (size_t)ln, 0, (const struct sockaddr *)to, sizeof(*to));
+        }
+    }
+    if (n > 0) udp_send_batch(w->sockfd, &w->gso, iov, n, (const struct sockaddr *)to, sizeof(*to));
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// GCRA: admite un mensaje en 'now' si el balde de estado 'tat' tiene una ficha y la consume.
+static bool rate_admit(const RateLimit *rl, _Atomic uint64_t *tat, uint64_t now) {
+    uint64_t cur = atomic_load_explicit(tat, memory_order_relaxed);
+    for (;;) {
+        if (cur > now + rl->tolerance_ns) return false; // balde vacío
+        uint64_t next = (cur > now ? cur : now) + rl->interval_ns;
+        if (atomic_compare_exchange_weak_explicit(tat, &cur, next, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+// Límite por publicador (-p). Busca su entrada en la tabla del hilo; si no está, ocupa
+// una libre o reemplaza la de menor TAT (la que lleva más tiempo sin publicar; nunca la
+// de un publicador que está excedido, cuyo TAT queda en el futuro).
+static bool pub_admit(Worker *w, const struct sockaddr_in *from) {
+    uint32_t ip = from->sin_addr.s_addr;
+    uint16_t port = from->sin_port;
+    uint32_t h = (ip * 2654435761u) ^ ((uint32_t)port * 40503u);
+    PubRate *e = NULL, *victim = NULL;
+    for (int i = 0; i < PUB_PROBE; i++) {
+        PubRate *c = &w->pubs[(h + (uint32_t)i) % PUB_TABLE_SIZE];
+        if (c->ip == ip && c->port == port) {
+            e = c;
             break;
         }
-        t = t->next;
+        if (!victim || c->tat < victim->tat) victim = c;
+    }
+    if (!e) {
+        e = victim;
+        e->ip = ip;
+        e->port = port;
+        e->warned = false;
+        e->tat = 0;
+    }
+    uint64_t now = w->now_ns;
+    if (e->tat > now + pub_limit.tolerance_ns) {
+        atomic_fetch_add_explicit(&w->pub_limited, 1, memory_order_relaxed);
+        if (!e->warned) {
+            e->warned = true;
+            log_warn("[broker] Publicador %I:%d supera el límite de %g msg/s: se descarta el exceso\n",
+                     ip, ntohs(port), pub_limit.rate);
+        }
+        return false;
     }
+    e->tat = (e->tat > now ? e->tat : now) + pub_limit.interval_ns;
+    return true;
 }
 
-int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Uso: %s <puerto>\n", argv[0]);
-        return 1;
+// Encola un mensaje para todos los suscriptores de un tema.
+static void broadcast_to_topic(Worker *w, const char *topic_name, const char *msg, size_t len) {
+    Topic *t = find_topic(topic_name);
+    if (!t) return;
+    SubSet *set = atomic_load(&t->subs);
+    if (!set || set->count == 0) return;
+    // Límite por tema (-r), antes de asignar secuencia: con -R el exceso no deja huecos.
+    if (topic_limit.rate > 0 && !rate_admit(&topic_limit, &t->tat, w->now_ns)) {
+        atomic_fetch_add_explicit(&t->limited, 1, memory_order_relaxed);
+        return;
+    }
+    bool framed = reliable || multicast;
+    if (w->pending_count == MAX_PENDING ||
+        (framed && w->txused + FRAME_OVERHEAD + len > TXBUF_SIZE)) {
+        flush_pending(w);
+    }
+    if (framed) {
+        char *frame = w->txbuf + w->txused;
+        len = reliable ? stamp_message(t, msg, len, frame) : frame_message(t, msg, len, frame);
+        if (len == 0) return;
+        w->txused += len;
+        msg = frame;
+    }
+    w->pending[w->pending_count].topic = t;
+    w->pending[w->pending_count].msg = msg;
+    w->pending[w->pending_count].len = len;
+    w->pending_count++;
+}
+
+// Separa "<rol> <tema> <mensaje>" sin depender de un '\0' final
+// (con GRO los datagramas llegan pegados en un mismo buffer).
+static void parse_datagram(const char *p, size_t len, char *role, char *topic,
+                           const char **msg, size_t *msg_len) {
+    const char *end = p + len;
+    size_t i = 0;
+    while (p < end && *p == ' ') p++;
+    while (p < end && *p != ' ' && i < 7) role[i++] = *p++;
+    role[i] = '\0';
+    while (p < end && *p != ' ') p++; // rol demasiado largo: se descarta el resto
+    while (p < end && *p == ' ') p++;
+    i = 0;
+    while (p < end && *p != ' ' && *p != '\n' && i < TOPIC_MAX - 1) topic[i++] = *p++;
+    topic[i] = '\0';
+    if (p < end && *p == ' ') p++; // un único separador antes del mensaje
+    *msg = p;
+    *msg_len = (size_t)(end - p);
+}
+
+// Procesa un datagrama (SUB o PUB) recibido de 'cli_addr'.
+static void handle_datagram(Worker *w, const char *buffer, size_t n,
+                            const struct sockaddr_in *cli_addr) {
+    char role[8];
+    char topic[TOPIC_MAX];
+    const char *msg;
+    size_t msg_len;
+    parse_datagram(buffer, n, role, topic, &msg, &msg_len);
+
+    if (strcmp(role, "SUB") == 0 && topic[0] != '\0') {
+        Topic *t = add_subscriber(topic, cli_addr);
+        if (t && multicast) send_mcast_info(w, t, cli_addr);
+        if (t && reliable) send_seq(w, t, cli_addr);
+
+    } else if (reliable && strcmp(role, "NAK") == 0 && topic[0] != '\0') {
+        handle_nak(w, topic, msg, msg_len, cli_addr);
+
+    } else if (strcmp(role, "PUB") == 0 && topic[0] != '\0') {
+        if (msg_len > 0 && (pub_limit.rate == 0 || pub_admit(w, cli_addr))) {
+             log_info("[broker] Publicación de %I:%d para tema '%s': %.*s\n",
+                      cli_addr->sin_addr.s_addr, ntohs(cli_addr->sin_port), topic, (int)msg_len, msg);
+             broadcast_to_topic(w, topic, msg, msg_len);
+        }
+
+    } else {
+         log_warn("[broker] Mensaje inválido de %I:%d: %.*s\n",
+                  cli_addr->sin_addr.s_addr, ntohs(cli_addr->sin_port), (int)n, buffer);
     }
+}
 
-    int port = atoi(argv[1]);
+// Lee con recvmmsg() todo lo disponible en el socket del hilo (cada datagrama
+// puede traer varios segmentos pegados por GRO), lo procesa y vacía el lote.
+static void drain_socket(Worker *w) {
+    char ctrls[RX_BATCH][CMSG_SPACE(sizeof(int))];
+    struct mmsghdr msgs[RX_BATCH];
+    struct iovec iovs[RX_BATCH];
+    struct sockaddr_in addrs[RX_BATCH];
 
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < RX_BATCH; i++) {
+            iovs[i].iov_base = w->bufs[i];
+            iovs[i].iov_len = w->gro ? RX_BUF_SIZE : MAX_BUFFER - 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = ctrls[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrls[i]);
+        }
+
+        int got = recvmmsg(w->sockfd, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("recvmmsg");
+            return;
+        }
+        if (topic_limit.rate > 0 || pub_limit.rate > 0) w->now_ns = now_ns();
+
+        for (int i = 0; i < got; i++) {
+            size_t len = msgs[i].msg_len;
+            size_t seg = w->gro ? udp_gro_segment_size(&msgs[i].msg_hdr) : 0;
+            if (seg == 0) seg = len;
+            for (size_t off = 0; off < len; off += seg) {
+                size_t n = (len - off < seg) ? len - off : seg;
+                handle_datagram(w, w->bufs[i] + off, n, &addrs[i]);
+            }
+        }
+        flush_pending(w);
+        // Punto quiescente: el hilo ya no guarda referencias a ningún SubSet.
+        atomic_store(&w->quiescent, atomic_load(&global_epoch));
+        if (got < RX_BATCH) return;
+    }
+}
+
+// Bucle de cada hilo: espera datagramas en su socket o trabajos delegados.
+// Mientras está bloqueado se declara "fuera de línea" para la recuperación QSBR.
+static void *worker_main(void *arg) {
+    Worker *w = (Worker *)arg;
+    struct epoll_event evs[2];
+    for (;;) {
+        atomic_store(&w->quiescent, QS_OFFLINE);
+        int n = epoll_wait(w->epfd, evs, 2, -1);
+        atomic_store(&w->quiescent, atomic_load(&global_epoch));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data.fd == w->sockfd) drain_socket(w);
+            else run_jobs(w);
+        }
+    }
+    return NULL;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Informa las publicaciones descartadas por los límites de tasa desde el último informe.
+static void report_rate_limits(void) {
+    uint64_t by_pub = 0;
+    for (int i = 0; i < nworkers; i++) by_pub += atomic_exchange(&workers[i]->pub_limited, 0);
+    if (by_pub > 0) {
+        log_warn("[broker] Límite por publicador: %llu publicación(es) descartada(s)\n",
+                 (unsigned long long)by_pub);
+    }
+    if (topic_limit.rate == 0) return;
+    for (int b = 0; b < TOPIC_BUCKETS; b++) {
+        for (Topic *t = atomic_load(&topic_buckets[b]); t; t = atomic_load(&t->next)) {
+            uint64_t n = atomic_exchange(&t->limited, 0);
+            if (n > 0) {
+                log_warn("[broker] Límite del tema '%s': %llu publicación(es) descartada(s)\n", t->name,
+                         (unsigned long long)n);
+            }
+        }
+    }
+}
+
+// Hilo de mantenimiento: cada TICK_MS avanza la rueda de concesiones, quita de los
+// conjuntos a los suscriptores vencidos y libera los conjuntos retirados.
+static void *housekeeping_main(void *arg) {
+    (void)arg;
+    uint64_t start = now_ms();
+    unsigned ticks = 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (;;) {
+        next.tv_nsec += TICK_MS * 1000000L;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {}
+
+        size_t expired = 0, live = 0;
+        unsigned long long total = 0;
+        pthread_mutex_lock(&registry_mtx);
+        if (lease_ticks > 0) {
+            expired = expire_leases((now_ms() - start) / TICK_MS);
+            live = lease_count;
+            total = expired_total;
+        }
+        reclaim_retired();
+        pthread_mutex_unlock(&registry_mtx);
+
+        if (expired > 0) {
+            log_info("[broker] %zu suscripción(es) expirada(s) (vigentes: %zu, expiradas en total: %llu)\n",
+                     expired, live, total);
+        }
+        if (++ticks % RATE_REPORT_TICKS == 0) report_rate_limits();
+    }
+    return NULL;
+}
+
+// Crea el socket de un hilo. Con varios hilos, cada uno tiene su socket con
+// SO_REUSEPORT en el mismo puerto y el kernel reparte los flujos entre ellos.
+static int open_worker_socket(int port, bool reuseport) {
     // socket(): crea un socket UDP
     // - AF_INET: IPv4
     // - SOCK_DGRAM: socket de datagramas (UDP)
     // - 0: protocolo por defecto (UDP)
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    int sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
     if (sockfd < 0) {
         perror("socket");
-        return 1;
+        return -1;
+    }
+    if (reuseport) {
+        int yes = 1;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+            perror("setsockopt SO_REUSEPORT");
+            close(sockfd);
+            return -1;
+        }
     }
 
     // Configurar la dirección local del broker (puerto + IP)
@@ -123,64 +1021,206 @@ int main(int argc, char **argv) {
     srv_addr.sin_port = htons((uint16_t)port);
 
     // bind(): asocia el socket UDP a una dirección IP/puerto
-    // - sockfd: descriptor de socket
-    // - (sockaddr *)&srv_addr: estructura con IP y puerto local
-    // - sizeof(srv_addr): tamaño de la estructura
     if (bind(sockfd, (struct sockaddr *)&srv_addr, sizeof(srv_addr)) < 0) {
         perror("bind");
         close(sockfd);
-        return 1;
+        return -1;
     }
+    return sockfd;
+}
 
-    printf("[broker] Escuchando en puerto UDP %d ...\n", port);
+static Worker *create_worker(int id, int port, bool offload) {
+    Worker *w = (Worker *)calloc(1, sizeof(Worker));
+    if (!w) return NULL;
+    w->id = id;
+    w->sockfd = open_worker_socket(port, nworkers > 1);
+    if (w->sockfd < 0) return NULL;
+    if (offload) {
+        w->gso = udp_gso_probe(w->sockfd);
+        w->gro = udp_gro_enable(w->sockfd);
+    }
+    w->bufs = malloc(sizeof(*w->bufs) * RX_BATCH);
+    if (pub_limit.rate > 0) {
+        w->pubs = (PubRate *)calloc(PUB_TABLE_SIZE, sizeof(PubRate));
+        if (!w->pubs) {
+            perror("calloc pubs");
+            return NULL;
+        }
+    }
+    if (multicast) {
+        // Interfaz, alcance y copia local (para que también funcione en loopback)
+        unsigned char ttl = (unsigned char)mcast_ttl, loop = 1;
+        if (setsockopt(w->sockfd, IPPROTO_IP, IP_MULTICAST_IF, &mcast_if, sizeof(mcast_if)) < 0 ||
+            setsockopt(w->sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+            setsockopt(w->sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+            perror("setsockopt multicast");
+            return NULL;
+        }
+    }
+    if (reliable || multicast) {
+        w->txbuf = (char *)malloc(TXBUF_SIZE);
+        if (!w->txbuf) {
+            perror("malloc txbuf");
+            return NULL;
+        }
+    }
+    w->epfd = epoll_create1(0);
+    w->evfd = eventfd(0, EFD_NONBLOCK);
+    if (!w->bufs || w->epfd < 0 || w->evfd < 0) {
+        perror("worker");
+        return NULL;
+    }
+    pthread_mutex_init(&w->jobs_mtx, NULL);
+    atomic_store(&w->quiescent, QS_OFFLINE);
 
-    while (1) {
-        char buffer[MAX_BUFFER];
-        struct sockaddr_in cli_addr = {0};
-        socklen_t clilen = sizeof(cli_addr);
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = w->sockfd;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->sockfd, &ev);
+    ev.data.fd = w->evfd;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev);
+    return w;
+}
 
-        // recvfrom(): recibe un datagrama UDP de cualquier cliente (publisher o subscriber)
-        // - sockfd: socket UDP del broker
-        // - buffer: donde se almacena el mensaje recibido
-        // - sizeof(buffer)-1: tamaño máximo permitido
-        // - 0: flags (ninguno)
-        // - (sockaddr *)&cli_addr: almacena la IP/puerto de quien lo envió
-        // - &clilen: tamaño de la estructura anterior
-        ssize_t n = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0, (struct sockaddr *)&cli_addr, &clilen);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            perror("recvfrom");
-            continue;
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-G] [-R] [-m grupo[:puerto] [-i ip_interfaz] [-t ttl]] [-w hilos] [-l segundos] "
+                    "[-r tasa[:ráfaga]] [-p tasa[:ráfaga]] [-L nivel] <puerto>\n", prog);
+    fprintf(stderr, "  -G  modo offload: recepción por lotes con GRO y envío con GSO (UDP_SEGMENT)\n");
+    fprintf(stderr, "  -R  modo confiable: secuencia por tema, anillo de retransmisión y NAK de los suscriptores\n");
+    fprintf(stderr, "  -m  modo multicast: cada tema usa un grupo a partir de 'grupo' (puerto %d por defecto)\n",
+            DEFAULT_MCAST_PORT);
+    fprintf(stderr, "  -i  IP de la interfaz de salida multicast (p.ej. 127.0.0.1 para pruebas locales)\n");
+    fprintf(stderr, "  -t  TTL multicast (por defecto 1: solo la red local)\n");
+    fprintf(stderr, "  -w  cantidad de hilos, cada uno con su socket SO_REUSEPORT (0 = uno por núcleo; por defecto 1)\n");
+    fprintf(stderr, "  -l  duración de la concesión de cada suscripción sin renovar (0 = nunca vence; por defecto %d)\n",
+            DEFAULT_LEASE_S);
+    fprintf(stderr, "  -r  límite por tema en msg/s, con ráfaga opcional (por defecto, un segundo de tasa)\n");
+    fprintf(stderr, "  -p  límite por publicador (ip:puerto) en msg/s, con ráfaga opcional\n");
+    fprintf(stderr, "  -L  nivel de log: error, warn, info (por defecto) o debug\n");
+}
+
+// Lee "tasa[:ráfaga]" para -r/-p. Devuelve false si no es válido.
+static bool parse_rate(const char *arg, RateLimit *rl) {
+    double rate = 0;
+    unsigned burst = 0;
+    int n = sscanf(arg, "%lf:%u", &rate, &burst);
+    if (n < 1 || rate <= 0 || rate > 1e9 || (n == 2 && burst == 0)) return false;
+    if (n == 1) burst = rate < 1 ? 1 : (unsigned)rate;
+    rl->rate = rate;
+    rl->burst = burst;
+    rl->interval_ns = (uint64_t)(1e9 / rate);
+    rl->tolerance_ns = (uint64_t)(burst - 1) * rl->interval_ns;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    bool offload = false;
+    int level = LOGL_INFO;
+    int opt;
+    while ((opt = getopt(argc, argv, "GRm:i:t:w:l:r:p:L:")) != -1) {
+        switch (opt) {
+        case 'G': offload = true; break;
+        case 'R': reliable = true; break;
+        case 'm': {
+            char group[INET_ADDRSTRLEN] = {0};
+            unsigned port = DEFAULT_MCAST_PORT;
+            if (sscanf(optarg, "%15[^:]:%u", group, &port) < 1 ||
+                inet_pton(AF_INET, group, &mcast_base) != 1 ||
+                !IN_MULTICAST(ntohl(mcast_base.s_addr)) || port == 0 || port > 65535) {
+                fprintf(stderr, "Grupo multicast inválido: %s\n", optarg);
+                return 1;
+            }
+            mcast_port = (uint16_t)port;
+            multicast = true;
+            break;
         }
-        buffer[n] = '\0'; // Asegurar terminación null
+        case 'i':
+            if (inet_pton(AF_INET, optarg, &mcast_if) != 1) {
+                fprintf(stderr, "Interfaz inválida: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't': mcast_ttl = atoi(optarg); break;
+        case 'w': nworkers = atoi(optarg); break;
+        case 'l': lease_ticks = (uint64_t)(atof(optarg) * 1000.0) / TICK_MS; break;
+        case 'r':
+        case 'p':
+            if (!parse_rate(optarg, opt == 'r' ? &topic_limit : &pub_limit)) {
+                fprintf(stderr, "Límite inválido: %s (use tasa[:ráfaga])\n", optarg);
+                return 1;
+            }
+            break;
+        case 'L':
+            if ((level = log_parse_level(optarg)) < 0) {
+                fprintf(stderr, "Nivel de log inválido: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (nworkers <= 0) nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers <= 0) nworkers = 1;
+    if (nworkers > MAX_WORKERS) nworkers = MAX_WORKERS;
 
-        // Parsear mensaje entrante
-        char role[8] = {0};
-        char topic[TOPIC_MAX] = {0};
-        sscanf(buffer, "%7s %127s", role, topic);
+    int port = atoi(argv[optind]);
+    if (log_init((LogLevel)level, LOG_RING_RECORDS) != 0) {
+        fprintf(stderr, "No se pudo iniciar el hilo de log\n");
+        return 1;
+    }
 
-        if (strcmp(role, "SUB") == 0 && topic[0] != '\0') {
-            add_subscriber(topic, &cli_addr);
+    // Los sockets se crean todos antes de arrancar los hilos para que el kernel
+    // reparta entre el grupo SO_REUSEPORT completo desde el primer datagrama.
+    for (int i = 0; i < nworkers; i++) {
+        workers[i] = create_worker(i, port, offload);
+        if (!workers[i]) return 1;
+    }
 
-        } else if (strcmp(role, "PUB") == 0 && topic[0] != '\0') {
-            const char *msg = buffer + 4 + strlen(topic) + 1;
-            if (strlen(msg) > 0) {
-                 char pub_ip[INET_ADDRSTRLEN];
-                 inet_ntop(AF_INET, &(cli_addr.sin_addr), pub_ip, INET_ADDRSTRLEN);
-                 printf("[broker] Publicación de %s:%d para tema '%s': %s\n",
-                        pub_ip, ntohs(cli_addr.sin_port), topic, msg);
-                 broadcast_to_topic(sockfd, topic, msg);
-            }
+    printf("[broker] Escuchando en puerto UDP %d con %d hilo(s) ...\n", port, nworkers);
+    if (offload) {
+        printf("[broker] Modo offload: GSO %s, GRO %s\n",
+               workers[0]->gso ? "activo" : "no soportado (sendto por datagrama)",
+               workers[0]->gro ? "activo" : "no soportado (recvmmsg sin coalescer)");
+    }
 
-        } else {
-             char cli_ip[INET_ADDRSTRLEN];
-             inet_ntop(AF_INET, &(cli_addr.sin_addr), cli_ip, INET_ADDRSTRLEN);
-             fprintf(stderr, "[broker] Mensaje inválido de %s:%d: %s\n",
-                     cli_ip, ntohs(cli_addr.sin_port), buffer);
+    if (multicast) {
+        char base[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &mcast_base, base, sizeof(base));
+        printf("[broker] Modo multicast: temas en %s (+%d grupos), puerto %u, TTL %d\n",
+               base, MCAST_GROUPS, mcast_port, mcast_ttl);
+    }
+    if (reliable) {
+        printf("[broker] Modo confiable: mensajes 'DAT <seq> <tema> <texto>', %d por tema para retransmitir\n",
+               RTX_RING);
+    }
+    if (topic_limit.rate > 0) {
+        printf("[broker] Límite por tema: %g msg/s, ráfaga %u\n", topic_limit.rate, topic_limit.burst);
+    }
+    if (pub_limit.rate > 0) {
+        printf("[broker] Límite por publicador: %g msg/s, ráfaga %u\n", pub_limit.rate, pub_limit.burst);
+    }
+    if (lease_ticks > 0) {
+        printf("[broker] Las suscripciones vencen a los %llu ms sin renovación (SUB)\n",
+               (unsigned long long)(lease_ticks * TICK_MS));
+    }
+
+    pthread_t hk;
+    if (pthread_create(&hk, NULL, housekeeping_main, NULL) != 0) {
+        perror("pthread_create");
+        return 1;
+    }
+    for (int i = 1; i < nworkers; i++) {
+        if (pthread_create(&workers[i]->thread, NULL, worker_main, workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
         }
     }
+    worker_main(workers[0]); // el hilo principal es el hilo 0
 
-    // Cerrar el socket cuando se termine la ejecución
-    close(sockfd);
+    // Cerrar los sockets cuando se termine la ejecución
+    for (int i = 0; i < nworkers; i++) close(workers[i]->sockfd);
     return 0;
 }
@@ -0,0 +1,210 @@
+// cluster_map.h - Reparto de temas entre varios brokers por hashing consistente.
+//
+// Header "solo cabecera" (funciones static): se incluye desde publisher_tcp.c,
+// subscriber_tcp.c, publisher_udp.c y subscriber_udp.c con la opción -C <mapa>.
+//
+// Archivo del mapa: una línea por broker, "host:puerto [peso]" ('#' comienza un
+// comentario). Cada broker aporta CLUSTER_VNODES * peso puntos a un anillo de 32 bits;
+// el dueño de un tema es el broker del primer punto en o después del hash del tema.
+// Los clientes se conectan directo al dueño de cada tema: cada broker es independiente
+// y no hay saltos de reenvío entre ellos.
+//
+// Los puntos dependen solo del texto "host:puerto", no del orden ni de los otros
+// brokers: al agregar o quitar uno cambian de dueño solo los temas de los tramos que
+// ganó o perdió (≈1/N de los temas). Los clientes releen el archivo si cambió
+// (cluster_map_reload(), como mucho una vez por CLUSTER_RELOAD_MS) y mueven solo esos
+// temas. Para cambiarlo sin que un cliente lea un archivo a medias, escribir en un
+// temporal y renombrarlo.
+
+#ifndef CLUSTER_MAP_H
+#define CLUSTER_MAP_H
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define CLUSTER_MAX_NODES 64
+#define CLUSTER_VNODES 128        // puntos del anillo por broker (con peso 1)
+#define CLUSTER_MAX_WEIGHT 16
+#define CLUSTER_RELOAD_MS 1000    // cada cuánto se mira si el archivo cambió
+
+typedef struct {
+    char name[128];               // "host:puerto" tal como está en el archivo
+    struct sockaddr_in addr;
+} ClusterNode;
+
+typedef struct {
+    uint32_t hash;
+    uint16_t node;
+} ClusterPoint;
+
+typedef struct {
+    const char *path;
+    ClusterNode nodes[CLUSTER_MAX_NODES];
+    int nnodes;
+    ClusterPoint *ring;           // ordenado por hash
+    size_t npoints;
+    struct timespec mtime;        // del archivo cargado
+    long long checked_ms;         // última vez que se miró el archivo
+} ClusterMap;
+
+// FNV-1a con la mezcla final de murmur3: reparte bien también cadenas parecidas
+// ("tema_1", "tema_2", "host:5555#17", ...).
+static uint32_t cluster_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static long long cluster_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int cluster_point_cmp(const void *a, const void *b) {
+    uint32_t x = ((const ClusterPoint *)a)->hash, y = ((const ClusterPoint *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+// Resuelve "host:puerto" (IPv4).
+static bool cluster_resolve(const char *spec, struct sockaddr_in *out) {
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || colon - spec >= 100) return false;
+    char host[100];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, colon + 1, &hints, &res) != 0) return false;
+    memcpy(out, res->ai_addr, sizeof(*out));
+    freeaddrinfo(res);
+    return true;
+}
+
+// Lee el archivo en 'm' (que no se toca si hay un error). Devuelve 0 o -1.
+static int cluster_map_parse(ClusterMap *m, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    ClusterMap nm;
+    memset(&nm, 0, sizeof(nm));
+    nm.path = path;
+    int weights[CLUSTER_MAX_NODES];
+    char line[512];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char spec[128];
+        int weight = 1;
+        int fields = sscanf(line, "%127s %d", spec, &weight);
+        if (fields <= 0) continue; // línea vacía o comentario
+        if (nm.nnodes == CLUSTER_MAX_NODES || weight < 1 || weight > CLUSTER_MAX_WEIGHT ||
+            !cluster_resolve(spec, &nm.nodes[nm.nnodes].addr)) {
+            fprintf(stderr, "%s:%d: broker inválido '%s' (use host:puerto [peso 1-%d], hasta %d brokers)\n",
+                    path, lineno, spec, CLUSTER_MAX_WEIGHT, CLUSTER_MAX_NODES);
+            ok = false;
+            break;
+        }
+        snprintf(nm.nodes[nm.nnodes].name, sizeof(nm.nodes[0].name), "%s", spec);
+        weights[nm.nnodes++] = weight;
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) == 0) nm.mtime = st.st_mtim;
+    fclose(f);
+    if (!ok) return -1;
+    if (nm.nnodes == 0) {
+        fprintf(stderr, "%s: el mapa no tiene brokers\n", path);
+        return -1;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < nm.nnodes; i++) total += (size_t)weights[i] * CLUSTER_VNODES;
+    nm.ring = (ClusterPoint *)malloc(total * sizeof(ClusterPoint));
+    if (!nm.ring) {
+        perror("malloc");
+        return -1;
+    }
+    for (int i = 0; i < nm.nnodes; i++) {
+        for (int v = 0; v < weights[i] * CLUSTER_VNODES; v++) {
+            char key[160];
+            int n = snprintf(key, sizeof(key), "%s#%d", nm.nodes[i].name, v);
+            nm.ring[nm.npoints].hash = cluster_hash(key, (size_t)n);
+            nm.ring[nm.npoints++].node = (uint16_t)i;
+        }
+    }
+    qsort(nm.ring, nm.npoints, sizeof(ClusterPoint), cluster_point_cmp);
+
+    free(m->ring);
+    nm.checked_ms = cluster_now_ms();
+    *m = nm;
+    return 0;
+}
+
+// Carga inicial del mapa. Devuelve 0 o -1 (con el error en stderr).
+static int cluster_map_load(ClusterMap *m, const char *path) {
+    memset(m, 0, sizeof(*m));
+    return cluster_map_parse(m, path);
+}
+
+// Relee el archivo si cambió desde la última carga. Devuelve true si hay un mapa nuevo;
+// si el archivo nuevo es inválido se sigue con el anterior.
+static bool cluster_map_reload(ClusterMap *m) {
+    long long now = cluster_now_ms();
+    if (now - m->checked_ms < CLUSTER_RELOAD_MS) return false;
+    m->checked_ms = now;
+    struct stat st;
+    if (stat(m->path, &st) != 0) return false;
+    if (st.st_mtim.tv_sec == m->mtime.tv_sec && st.st_mtim.tv_nsec == m->mtime.tv_nsec) return false;
+    if (cluster_map_parse(m, m->path) != 0) {
+        m->mtime = st.st_mtim; // no reintentar el mismo archivo inválido
+        return false;
+    }
+    return true;
+}
+
+// Broker dueño del tema.
+static const ClusterNode *cluster_map_owner(const ClusterMap *m, const char *topic) {
+    uint32_t h = cluster_hash(topic, strlen(topic));
+    size_t lo = 0, hi = m->npoints; // primer punto con hash >= h (o el primero del anillo)
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (m->ring[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return &m->nodes[m->ring[lo == m->npoints ? 0 : lo].node];
+}
+
+static bool cluster_same_addr(const struct sockaddr_in *a, const struct sockaddr_in *b) {
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+static void cluster_map_free(ClusterMap *m) {
+    free(m->ring);
+    m->ring = NULL;
+    m->npoints = 0;
+}
+
+#endif // CLUSTER_MAP_H
@@ -0,0 +1,393 @@
+// log_ring.h - Registro (logging) asíncrono con niveles para los brokers.
+//
+// En el camino caliente no se formatea ni se escribe nada: log_info(...) solo copia
+// el puntero al formato y los argumentos (enteros y cadenas truncadas) en un
+// registro binario de tamaño fijo dentro de un anillo SPSC propio de cada hilo.
+// Un hilo de fondo recorre los anillos, formatea los registros en orden de tiempo
+// y los escribe por lotes. Si el anillo de un hilo está lleno, el registro se
+// descarta y se cuenta: publicar nunca espera por el log.
+//
+// Header "solo cabecera": se incluye desde broker_udp.c, broker_tcp.c y broker_quic.c.
+//
+// Formatos: los de printf para enteros (%d %u %x %ld %llu %zu ...), %c, %s, %.*s,
+// %f/%g, %p y %%, más %I: dirección IPv4 (uint32_t en orden de red), que se
+// convierte con inet_ntop() recién en el hilo de fondo.
+// El formato DEBE ser un literal (se guarda solo el puntero).
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+    LOGL_ERROR = 0,
+    LOGL_WARN = 1,
+    LOGL_INFO = 2,
+    LOGL_DEBUG = 3,
+} LogLevel;
+
+#define LOG_MAX_INTS 8
+#define LOG_REC_SIZE 256
+#define LOG_STR_SPACE (LOG_REC_SIZE - 24 - LOG_MAX_INTS * 8)
+#define LOG_IDLE_NS 5000000L       // el hilo de fondo duerme 5 ms si no hay registros
+#define LOG_OUT_BUF (256 * 1024)   // buffer de salida del hilo de fondo
+
+// Registro binario: se formatea recién en el hilo de fondo.
+typedef struct {
+    uint64_t ts_ns;
+    const char *fmt;
+    uint8_t level;
+    uint8_t nints;
+    uint16_t nstr;                 // bytes usados en 'strs'
+    uint32_t _pad;
+    uint64_t ints[LOG_MAX_INTS];   // enteros, dobles (bits) y punteros, en orden
+    char strs[LOG_STR_SPACE];      // cadenas terminadas en '\0', en orden
+} LogRecord;
+
+// Anillo de un solo productor (el hilo dueño) y un solo consumidor (el hilo de fondo).
+typedef struct LogRing {
+    _Alignas(64) _Atomic uint64_t head;   // próximo registro a escribir (productor)
+    _Alignas(64) _Atomic uint64_t tail;   // próximo registro a leer (consumidor)
+    _Atomic uint64_t dropped;             // descartados por anillo lleno
+    _Atomic bool orphaned;                // el hilo dueño terminó
+    uint64_t reported;                    // descartes ya informados (solo consumidor)
+    uint64_t mask;
+    LogRecord *recs;
+    struct LogRing *next;
+} LogRing;
+
+static _Atomic(LogRing *) log_rings = NULL;
+static pthread_mutex_t log_rings_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t log_ring_key;
+static __thread LogRing *log_my_ring = NULL;
+static _Atomic int log_level = LOGL_INFO;
+static size_t log_ring_records = 1024;
+static bool log_started = false;
+
+static uint64_t log_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Destructor de hilo: el anillo queda huérfano y el consumidor lo libera al vaciarlo.
+static void log_ring_orphan(void *p) {
+    atomic_store_explicit(&((LogRing *)p)->orphaned, true, memory_order_release);
+}
+
+static LogRing *log_ring_create(void) {
+    LogRing *r = (LogRing *)aligned_alloc(64, sizeof(LogRing));
+    if (!r) return NULL;
+    memset(r, 0, sizeof(*r));
+    r->recs = (LogRecord *)calloc(log_ring_records, sizeof(LogRecord));
+    if (!r->recs) {
+        free(r);
+        return NULL;
+    }
+    r->mask = log_ring_records - 1;
+    pthread_mutex_lock(&log_rings_mtx);
+    r->next = atomic_load(&log_rings);
+    atomic_store(&log_rings, r);      // publicado ya inicializado
+    pthread_mutex_unlock(&log_rings_mtx);
+    pthread_setspecific(log_ring_key, r);
+    return r;
+}
+
+static bool log_enabled(LogLevel level) {
+    return (int)level <= atomic_load_explicit(&log_level, memory_order_relaxed);
+}
+
+// Copia una cadena (hasta 'max' bytes, sin exigir '\0') al espacio de cadenas del registro.
+static void log_put_str(LogRecord *rec, const char *s, size_t max) {
+    if (!s) s = "(null)";
+    size_t room = sizeof(rec->strs) - rec->nstr;
+    if (room == 0) return;
+    size_t n = strnlen(s, max);
+    if (n > room - 1) n = room - 1;   // se trunca si no entra
+    memcpy(rec->strs + rec->nstr, s, n);
+    rec->strs[rec->nstr + n] = '\0';
+    rec->nstr = (uint16_t)(rec->nstr + n + 1);
+}
+
+static void log_put_int(LogRecord *rec, uint64_t v) {
+    if (rec->nints < LOG_MAX_INTS) rec->ints[rec->nints++] = v;
+}
+
+// Camino caliente: arma el registro binario en el anillo del hilo. Nunca bloquea.
+static void log_write(LogLevel level, const char *fmt, ...) {
+    if (!log_enabled(level)) return;
+    if (!log_started) {
+        // Sin hilo de fondo (log_init no llamado): se escribe directamente.
+        va_list ap;
+        va_start(ap, fmt);
+        vfprintf(level <= LOGL_WARN ? stderr : stdout, fmt, ap);
+        va_end(ap);
+        return;
+    }
+    LogRing *r = log_my_ring;
+    if (!r) {
+        r = log_my_ring = log_ring_create();
+        if (!r) return;
+    }
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (h - t > r->mask) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    LogRecord *rec = &r->recs[h & r->mask];
+    rec->ts_ns = log_now_ns();
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+    rec->nints = 0;
+    rec->nstr = 0;
+
+    va_list ap;
+    va_start(ap, fmt);
+    for (const char *p = fmt; *p; p++) {
+        if (*p != '%') continue;
+        p++;
+        while (*p && strchr("-+ #0", *p)) p++;
+        if (*p == '*') { log_put_int(rec, (uint64_t)(int64_t)va_arg(ap, int)); p++; }
+        while (*p >= '0' && *p <= '9') p++;
+        int prec = -1;
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                prec = va_arg(ap, int);
+                log_put_int(rec, (uint64_t)(int64_t)prec);
+                p++;
+            } else {
+                prec = 0;
+                while (*p >= '0' && *p <= '9') prec = prec * 10 + (*p++ - '0');
+            }
+        }
+        int lng = 0;                  // 0 int, 1 long, 2 long long, 3 size_t
+        while (*p && strchr("hlzjt", *p)) {
+            if (*p == 'l') lng++;
+            else if (*p == 'z' || *p == 'j' || *p == 't') lng = 3;
+            p++;
+        }
+        switch (*p) {
+        case 's': log_put_str(rec, va_arg(ap, const char *), prec < 0 ? SIZE_MAX : (size_t)prec); break;
+        case 'I': log_put_int(rec, va_arg(ap, uint32_t)); break;
+        case 'f': case 'g': case 'e': case 'F': case 'G': case 'E': {
+            double d = va_arg(ap, double);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            log_put_int(rec, bits);
+            break;
+        }
+        case 'p': log_put_int(rec, (uint64_t)(uintptr_t)va_arg(ap, void *)); break;
+        case 'c': case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            if (lng == 0) log_put_int(rec, (uint64_t)(int64_t)va_arg(ap, int));
+            else if (lng == 1) log_put_int(rec, (uint64_t)va_arg(ap, long));
+            else if (lng == 2) log_put_int(rec, (uint64_t)va_arg(ap, long long));
+            else log_put_int(rec, (uint64_t)va_arg(ap, size_t));
+            break;
+        case '\0': p--; break;
+        default: break;               // "%%"
+        }
+    }
+    va_end(ap);
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+// Hilo de fondo: formatea un registro en 'out' interpretando el formato de nuevo.
+static size_t log_format(const LogRecord *rec, char *out, size_t cap) {
+    size_t n = 0, ii = 0, si = 0;
+    char spec[32];
+    for (const char *p = rec->fmt; *p && n + 1 < cap; p++) {
+        if (*p != '%') {
+            out[n++] = *p;
+            continue;
+        }
+        const char *start = p++;
+        while (*p && strchr("-+ #0", *p)) p++;
+        bool star_w = false, star_p = false;
+        if (*p == '*') { star_w = true; p++; }
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p == '.') {
+            p++;
+            if (*p == '*') { star_p = true; p++; }
+            while (*p >= '0' && *p <= '9') p++;
+        }
+        int lng = 0;
+        while (*p && strchr("hlzjt", *p)) {
+            if (*p == 'l') lng++;
+            else if (*p == 'z' || *p == 'j' || *p == 't') lng = 3;
+            p++;
+        }
+        if (*p == '\0') break;
+        size_t speclen = (size_t)(p - start + 1);
+        if (speclen >= sizeof(spec)) continue;
+        memcpy(spec, start, speclen);
+        spec[speclen] = '\0';
+
+        int w = star_w && ii < rec->nints ? (int)(int64_t)rec->ints[ii++] : 0;
+        int pr = star_p && ii < rec->nints ? (int)(int64_t)rec->ints[ii++] : 0;
+        uint64_t v = 0;
+        const char *sv = "";
+        if (*p == 's') {
+            if (si < rec->nstr) {
+                sv = rec->strs + si;
+                si += strlen(sv) + 1;
+            }
+        } else if (*p != '%' && ii < rec->nints) {
+            v = rec->ints[ii++];
+        }
+
+        int k;
+        size_t room = cap - n;
+        char ip[INET_ADDRSTRLEN];
+        switch (*p) {
+        case '%': k = snprintf(out + n, room, "%%"); break;
+        case 'I': {
+            uint32_t a = (uint32_t)v;
+            inet_ntop(AF_INET, &a, ip, sizeof(ip));
+            k = snprintf(out + n, room, "%s", ip);
+            break;
+        }
+        case 's':
+            // la cadena ya viene truncada: la precisión puede ignorarse sin riesgo
+            if (star_w && star_p) k = snprintf(out + n, room, spec, w, pr, sv);
+            else if (star_w || star_p) k = snprintf(out + n, room, spec, star_w ? w : pr, sv);
+            else k = snprintf(out + n, room, spec, sv);
+            break;
+        case 'f': case 'g': case 'e': case 'F': case 'G': case 'E': {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            k = snprintf(out + n, room, spec, d);
+            break;
+        }
+        case 'p': k = snprintf(out + n, room, spec, (void *)(uintptr_t)v); break;
+        default:
+            if (lng == 0) k = snprintf(out + n, room, spec, (int)v);
+            else if (lng == 1) k = snprintf(out + n, room, spec, (long)v);
+            else if (lng == 2) k = snprintf(out + n, room, spec, (long long)v);
+            else k = snprintf(out + n, room, spec, (size_t)v);
+            break;
+        }
+        if (k < 0) continue;
+        n += (size_t)k < room ? (size_t)k : room - 1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// Escribe lo acumulado en los buffers de salida (stdout para info/debug, stderr para warn/error).
+static void log_flush_out(char *buf, size_t *len, FILE *f) {
+    if (*len == 0) return;
+    fwrite(buf, 1, *len, f);
+    fflush(f);
+    *len = 0;
+}
+
+// Vacía todos los anillos una vez, intercalando por marca de tiempo. Devuelve cuántos registros escribió.
+static size_t log_drain_once(char *obuf, size_t *olen, char *ebuf, size_t *elen) {
+    size_t written = 0;
+    for (;;) {
+        LogRing *best = NULL;
+        const LogRecord *best_rec = NULL;
+        for (LogRing *r = atomic_load(&log_rings); r; r = r->next) {
+            uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            if (t == atomic_load_explicit(&r->head, memory_order_acquire)) continue;
+            const LogRecord *rec = &r->recs[t & r->mask];
+            if (!best_rec || rec->ts_ns < best_rec->ts_ns) {
+                best = r;
+                best_rec = rec;
+            }
+        }
+        if (!best) break;
+
+        char *buf = best_rec->level <= LOGL_WARN ? ebuf : obuf;
+        size_t *len = best_rec->level <= LOGL_WARN ? elen : olen;
+        if (LOG_OUT_BUF - *len < LOG_REC_SIZE * 8) {
+            log_flush_out(buf, len, best_rec->level <= LOGL_WARN ? stderr : stdout);
+        }
+        *len += log_format(best_rec, buf + *len, LOG_OUT_BUF - *len);
+        atomic_store_explicit(&best->tail, atomic_load_explicit(&best->tail, memory_order_relaxed) + 1,
+                              memory_order_release);
+        written++;
+    }
+    return written;
+}
+
+static void *log_thread_main(void *arg) {
+    (void)arg;
+    static char obuf[LOG_OUT_BUF], ebuf[LOG_OUT_BUF];
+    size_t olen = 0, elen = 0;
+    for (;;) {
+        size_t written = log_drain_once(obuf, &olen, ebuf, &elen);
+        log_flush_out(obuf, &olen, stdout);
+        log_flush_out(ebuf, &elen, stderr);
+
+        // Descartes por anillo lleno y anillos de hilos terminados ya vacíos.
+        pthread_mutex_lock(&log_rings_mtx);
+        _Atomic(LogRing *) *pp = &log_rings;
+        LogRing *r;
+        while ((r = atomic_load(pp)) != NULL) {
+            uint64_t d = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+            if (d != r->reported) {
+                fprintf(stderr, "[log] %llu registro(s) descartado(s) por anillo lleno\n",
+                        (unsigned long long)(d - r->reported));
+                r->reported = d;
+            }
+            if (atomic_load_explicit(&r->orphaned, memory_order_acquire) &&
+                atomic_load(&r->tail) == atomic_load(&r->head)) {
+                atomic_store(pp, r->next);
+                free(r->recs);
+                free(r);
+                continue;
+            }
+            pp = (_Atomic(LogRing *) *)&r->next;
+        }
+        pthread_mutex_unlock(&log_rings_mtx);
+
+        if (written == 0) {
+            struct timespec idle = { 0, LOG_IDLE_NS };
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+// Convierte "error", "warn", "info" o "debug" a un nivel. Devuelve -1 si no es válido.
+static int log_parse_level(const char *s) {
+    if (strcmp(s, "error") == 0) return LOGL_ERROR;
+    if (strcmp(s, "warn") == 0) return LOGL_WARN;
+    if (strcmp(s, "info") == 0) return LOGL_INFO;
+    if (strcmp(s, "debug") == 0) return LOGL_DEBUG;
+    return -1;
+}
+
+// Arranca el hilo de fondo. 'records' es la capacidad del anillo de cada hilo
+// (se redondea a potencia de 2). Devuelve 0 si todo salió bien.
+static int log_init(LogLevel level, size_t records) {
+    size_t cap = 2;
+    while (cap < records) cap <<= 1;
+    log_ring_records = cap;
+    atomic_store(&log_level, (int)level);
+    if (pthread_key_create(&log_ring_key, log_ring_orphan) != 0) return -1;
+    pthread_t th;
+    if (pthread_create(&th, NULL, log_thread_main, NULL) != 0) return -1;
+    pthread_detach(th);
+    log_started = true;
+    return 0;
+}
+
+#define log_error(...) log_write(LOGL_ERROR, __VA_ARGS__)
+#define log_warn(...)  log_write(LOGL_WARN, __VA_ARGS__)
+#define log_info(...)  log_write(LOGL_INFO, __VA_ARGS__)
+#define log_debug(...) log_write(LOGL_DEBUG, __VA_ARGS__)
+
+#endif // LOG_RING_H
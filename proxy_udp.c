@@ -0,0 +1,469 @@
+// Proxy UDP con degradación de red: se ubica entre los clientes y un broker (UDP o
+// QUIC) y aplica pérdida, retardo, jitter, reordenamiento, duplicación y límite de
+// tasa en espacio de usuario, sin root ni netem. Sirve para medir con publisher_udp -r
+// y subscriber_udp -c (o los programas QUIC) cómo se comporta el broker en una red mala.
+//
+// Compilación: gcc -Wall -Wextra -O2 -o proxy_udp proxy_udp.c
+// Uso:         ./proxy_udp [opciones] <puerto_local> <host_broker> <puerto_broker>
+// Ejemplo:     ./proxy_udp -S 7 -l 2 -d 20 -j 5 -o 10 6000 127.0.0.1 5555
+//              (los clientes usan 127.0.0.1 6000 en lugar de 127.0.0.1 5555)
+//
+// Cada cliente (ip:puerto) tiene su propio socket hacia el broker, así el broker ve
+// un origen distinto por cliente y sus respuestas vuelven al cliente correcto. La
+// degradación se aplica en los dos sentidos, con el mismo perfil y un generador
+// pseudoaleatorio por sentido a partir de la semilla (-S): con la misma secuencia de
+// paquetes se repiten las mismas decisiones.
+//
+// Orden por paquete (como netem): pérdida -> duplicación -> cola del enlace (-b, -q)
+// -> retardo + jitter, salvo los reordenados (-o), que salen sin retardo y adelantan
+// a los demás. Sin -o el jitter no reordena: cada paquete sale después del anterior.
+
+#define _GNU_SOURCE         // recvmmsg() para leer de a lotes.
+#include <arpa/inet.h>      // inet_pton()/inet_ntop() para las direcciones del broker y de los clientes.
+#include <errno.h>          // Permite el manejo de errores a través de la variable 'errno' y constantes como EAGAIN.
+#include <netdb.h>          // getaddrinfo() para resolver el host del broker.
+#include <netinet/in.h>     // Define la estructura 'sockaddr_in' y constantes necesarias para la programación de sockets de Internet.
+#include <poll.h>           // ppoll() sobre el socket de clientes y los de cada sesión, con timeout (en ns) hasta el próximo envío.
+#include <signal.h>         // SIGINT muestra los totales y termina.
+#include <stdbool.h>        // Define el tipo de dato booleano 'bool' y los valores 'true' y 'false'.
+#include <stdint.h>         // Enteros de ancho fijo para tiempos en nanosegundos y el generador.
+#include <stdio.h>          // Librería estándar de Entrada/Salida para funciones como printf() y fprintf().
+#include <stdlib.h>         // Librería estándar que provee funciones de gestión de memoria (malloc, free) y conversión de tipos (atoi).
+#include <string.h>         // Provee funciones para la manipulación de memoria y cadenas, como memcpy() y strcmp().
+#include <sys/socket.h>     // Contiene las definiciones y estructuras principales para la API de sockets (socket(), bind(), sendto(), recvfrom()).
+#include <time.h>           // clock_gettime() para programar los envíos.
+#include <unistd.h>         // Provee acceso a la API del sistema operativo POSIX, incluyendo la función close() para cerrar descriptores de archivo.
+
+#define MAX_DGRAM 65536
+#define MAX_SESSIONS 256           // clientes simultáneos
+#define SESSION_IDLE_NS (60 * 1000000000ull) // sesión sin tráfico que se cierra
+#define DEFAULT_QUEUE_BYTES (256 * 1024)
+#define REPORT_NS 1000000000ull    // reporte cada segundo
+#define RX_BATCH 32
+
+enum { UP = 0, DOWN = 1 };         // cliente -> broker, broker -> cliente
+static const char *dir_names[2] = { "ida", "vuelta" };
+
+// Perfil de degradación (el mismo para los dos sentidos).
+typedef struct {
+    double loss;                   // probabilidad de pérdida (0..1)
+    double burst;                  // largo medio de las ráfagas de pérdida (1 = independientes)
+    double dup;                    // probabilidad de duplicar
+    double reorder;                // probabilidad de salir sin retardo (requiere -d)
+    uint64_t delay_ns;
+    uint64_t jitter_ns;            // uniforme en [-jitter, +jitter]
+    double rate_bps;               // 0 = sin límite
+    size_t queue_bytes;            // cola del enlace limitado (-q)
+} Profile;
+
+// Estado de un sentido: generador, enlace y contadores.
+typedef struct {
+    uint64_t rng;
+    bool in_burst;                 // pérdida en ráfagas (modelo de Gilbert)
+    uint64_t link_free_ns;         // cuándo termina de "transmitir" lo encolado (-b)
+    uint64_t last_release_ns;      // para no reordenar con jitter
+    uint64_t rx, lost, qdrop, dups, reordered, sent;
+} Direction;
+
+typedef struct {
+    bool used;
+    struct sockaddr_in client;
+    int fd;                        // socket conectado al broker
+    uint64_t last_ns;
+    uint32_t gen;                  // distingue una sesión nueva en el mismo lugar
+} Session;
+
+// Paquete programado: sale en 'at' hacia el broker (UP) o hacia el cliente de la sesión (DOWN).
+typedef struct {
+    uint64_t at;
+    uint64_t order;                // desempate estable entre paquetes con el mismo 'at'
+    int session;
+    uint32_t gen;
+    int dir;
+    size_t len;
+    char *data;
+} Pending;
+
+static Profile prof = { .queue_bytes = DEFAULT_QUEUE_BYTES, .burst = 1 };
+static Direction dirs[2];
+static Session sessions[MAX_SESSIONS];
+static int listen_fd;
+static struct sockaddr_in broker_addr;
+
+static Pending *heap = NULL;       // min-heap por 'at'
+static size_t heap_len = 0, heap_cap = 0;
+static uint64_t heap_order = 0;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_sigint(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*: mismo generador que publisher_udp, una secuencia por sentido.
+static uint64_t rng_next(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 2685821657736338717ull;
+}
+
+// Uniforme en [0, 1).
+static double rng_unit(uint64_t *s) {
+    return (double)(rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool heap_less(const Pending *a, const Pending *b) {
+    return a->at < b->at || (a->at == b->at && a->order < b->order);
+}
+
+static bool heap_push(Pending p) {
+    if (heap_len == heap_cap) {
+        size_t ncap = heap_cap ? heap_cap * 2 : 1024;
+        Pending *nh = (Pending *)realloc(heap, ncap * sizeof(Pending));
+        if (!nh) return false;
+        heap = nh;
+        heap_cap = ncap;
+    }
+    p.order = heap_order++;
+    size_t i = heap_len++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!heap_less(&p, &heap[parent])) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = p;
+    return true;
+}
+
+static Pending heap_pop(void) {
+    Pending top = heap[0];
+    Pending last = heap[--heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= heap_len) break;
+        if (c + 1 < heap_len && heap_less(&heap[c + 1], &heap[c])) c++;
+        if (!heap_less(&heap[c], &last)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    if (heap_len > 0) heap[i] = last;
+    return top;
+}
+
+// Sesión de un cliente; la crea (con su socket hacia el broker) si no existe.
+static int session_for(const struct sockaddr_in *client, uint64_t now) {
+    int free_slot = -1;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (!sessions[i].used) {
+            if (free_slot < 0) free_slot = i;
+            continue;
+        }
+        if (sessions[i].client.sin_addr.s_addr == client->sin_addr.s_addr &&
+            sessions[i].client.sin_port == client->sin_port) {
+            sessions[i].last_ns = now;
+            return i;
+        }
+    }
+    if (free_slot < 0) return -1;
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)&broker_addr, sizeof(broker_addr)) < 0) {
+        perror("socket hacia el broker");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    Session *s = &sessions[free_slot];
+    s->used = true;
+    s->client = *client;
+    s->fd = fd;
+    s->last_ns = now;
+    s->gen++;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client->sin_addr, ip, sizeof(ip));
+    printf("[proxy] Cliente nuevo %s:%d\n", ip, ntohs(client->sin_port));
+    return free_slot;
+}
+
+// Cierra las sesiones sin tráfico. Sus paquetes pendientes se descartan al salir (por 'gen').
+static void expire_sessions(uint64_t now) {
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].used && now - sessions[i].last_ns > SESSION_IDLE_NS) {
+            close(sessions[i].fd);
+            sessions[i].used = false;
+        }
+    }
+}
+
+// Decide si se pierde el próximo paquete. Con -l p:ráfaga usa el modelo de Gilbert
+// (dos estados) con la misma tasa media de pérdida 'p' y ráfagas de largo medio 'ráfaga'.
+static bool lose(Direction *d) {
+    if (prof.loss <= 0) return false;
+    double u = rng_unit(&d->rng);
+    if (prof.burst <= 1) return u < prof.loss;
+    double p_exit = 1.0 / prof.burst;                        // P(ráfaga -> sin pérdida)
+    double p_enter = prof.loss * p_exit / (1.0 - prof.loss); // P(sin pérdida -> ráfaga)
+    d->in_burst = d->in_burst ? u >= p_exit : u < p_enter;
+    return d->in_burst;
+}
+
+// Programa una copia del paquete según el perfil. Devuelve false si la cola la descartó.
+static bool schedule(int session, int dir, const char *data, size_t len, uint64_t now) {
+    Direction *d = &dirs[dir];
+    uint64_t depart = now;
+    if (prof.rate_bps > 0) {
+        uint64_t start = d->link_free_ns > now ? d->link_free_ns : now;
+        double backlog = (double)(start - now) * prof.rate_bps / 8e9; // bytes aún en la cola
+        if (backlog + (double)len > (double)prof.queue_bytes) {
+            d->qdrop++;
+            return false;
+        }
+        depart = start + (uint64_t)((double)len * 8e9 / prof.rate_bps);
+        d->link_free_ns = depart;
+    }
+
+    uint64_t at = depart;
+    if (prof.delay_ns > 0 && prof.reorder > 0 && rng_unit(&d->rng) < prof.reorder) {
+        d->reordered++; // sale sin retardo y adelanta a los que esperan
+    } else {
+        int64_t extra = (int64_t)prof.delay_ns;
+        if (prof.jitter_ns > 0) {
+            extra += (int64_t)(rng_unit(&d->rng) * (double)(2 * prof.jitter_ns)) - (int64_t)prof.jitter_ns;
+            if (extra < 0) extra = 0;
+        }
+        at = depart + (uint64_t)extra;
+        if (at < d->last_release_ns) at = d->last_release_ns; // el jitter no reordena
+        d->last_release_ns = at;
+    }
+
+    Pending p = { .at = at, .session = session, .gen = sessions[session].gen, .dir = dir, .len = len };
+    p.data = (char *)malloc(len ? len : 1);
+    if (!p.data) return false;
+    memcpy(p.data, data, len);
+    if (!heap_push(p)) {
+        free(p.data);
+        return false;
+    }
+    return true;
+}
+
+// Un paquete recibido en el sentido 'dir': pérdida, duplicación y programación.
+static void impair(int session, int dir, const char *data, size_t len, uint64_t now) {
+    Direction *d = &dirs[dir];
+    d->rx++;
+    if (lose(d)) {
+        d->lost++;
+        return;
+    }
+    schedule(session, dir, data, len, now);
+    if (prof.dup > 0 && rng_unit(&d->rng) < prof.dup) {
+        d->dups++;
+        schedule(session, dir, data, len, now);
+    }
+}
+
+// Envía los paquetes cuyo momento ya llegó.
+static void release_due(uint64_t now) {
+    while (heap_len > 0 && heap[0].at <= now) {
+        Pending p = heap_pop();
+        Session *s = &sessions[p.session];
+        if (s->used && s->gen == p.gen) {
+            ssize_t n = p.dir == UP
+                            ? send(s->fd, p.data, p.len, 0)
+                            : sendto(listen_fd, p.data, p.len, 0, (const struct sockaddr *)&s->client,
+                                     sizeof(s->client));
+            if (n >= 0) dirs[p.dir].sent++;
+        }
+        free(p.data);
+    }
+}
+
+// Lee todo lo disponible en 'fd' (el socket de clientes o el de una sesión).
+static void drain(int fd, int session, uint64_t now) {
+    static char bufs[RX_BATCH][MAX_DGRAM];
+    struct mmsghdr msgs[RX_BATCH];
+    struct iovec iovs[RX_BATCH];
+    struct sockaddr_in from[RX_BATCH];
+    for (;;) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < RX_BATCH; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = MAX_DGRAM;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+        int got = recvmmsg(fd, msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) perror("recvmmsg");
+            return;
+        }
+        for (int i = 0; i < got; i++) {
+            if (session < 0) {
+                int s = session_for(&from[i], now);
+                if (s >= 0) impair(s, UP, bufs[i], msgs[i].msg_len, now);
+            } else {
+                sessions[session].last_ns = now;
+                impair(session, DOWN, bufs[i], msgs[i].msg_len, now);
+            }
+        }
+        if (got < RX_BATCH) return;
+    }
+}
+
+static void report(const char *label) {
+    for (int d = 0; d < 2; d++) {
+        Direction *x = &dirs[d];
+        printf("[proxy] %s %-6s: recibidos %llu, perdidos %llu, descartados por cola %llu, duplicados %llu, "
+               "reordenados %llu, enviados %llu\n",
+               label, dir_names[d], (unsigned long long)x->rx, (unsigned long long)x->lost,
+               (unsigned long long)x->qdrop, (unsigned long long)x->dups, (unsigned long long)x->reordered,
+               (unsigned long long)x->sent);
+    }
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-S semilla] [-l pérdida%%[:ráfaga]] [-d ms] [-j ms] [-o reorden%%] [-u duplicado%%] "
+                    "[-b kbit/s] [-q bytes] <puerto_local> <host_broker> <puerto_broker>\n", prog);
+    fprintf(stderr, "  -S  semilla del generador (por defecto 1): misma semilla y tráfico = mismas decisiones\n");
+    fprintf(stderr, "  -l  pérdida en %%; con ':ráfaga' las pérdidas vienen en ráfagas de ese largo medio\n");
+    fprintf(stderr, "  -d  retardo fijo; -j jitter uniforme de ±ms (sin -o no reordena)\n");
+    fprintf(stderr, "  -o  %% de paquetes que salen sin retardo y adelantan a los demás (requiere -d)\n");
+    fprintf(stderr, "  -u  %% de paquetes duplicados\n");
+    fprintf(stderr, "  -b  tasa del enlace en kbit/s; -q tamaño de su cola (por defecto %d bytes, el resto se descarta)\n",
+            DEFAULT_QUEUE_BYTES);
+}
+
+int main(int argc, char **argv) {
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "S:l:d:j:o:u:b:q:")) != -1) {
+        switch (opt) {
+        case 'S': seed = strtoull(optarg, NULL, 10); break;
+        case 'l': {
+            double pct = 0, burst = 1;
+            if (sscanf(optarg, "%lf:%lf", &pct, &burst) < 1 || pct < 0 || pct >= 100 || burst < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+            prof.loss = pct / 100.0;
+            prof.burst = burst;
+            break;
+        }
+        case 'd': prof.delay_ns = (uint64_t)(atof(optarg) * 1e6); break;
+        case 'j': prof.jitter_ns = (uint64_t)(atof(optarg) * 1e6); break;
+        case 'o': prof.reorder = atof(optarg) / 100.0; break;
+        case 'u': prof.dup = atof(optarg) / 100.0; break;
+        case 'b': prof.rate_bps = atof(optarg) * 1000.0; break;
+        case 'q': prof.queue_bytes = (size_t)atol(optarg); break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(argv[optind + 1], argv[optind + 2], &hints, &res) != 0) {
+        fprintf(stderr, "No se pudo resolver %s:%s\n", argv[optind + 1], argv[optind + 2]);
+        return 1;
+    }
+    memcpy(&broker_addr, res->ai_addr, sizeof(broker_addr));
+    freeaddrinfo(res);
+
+    listen_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct sockaddr_in local = {0};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)atoi(argv[optind]));
+    if (bind(listen_fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    // Un generador por sentido, derivados de la semilla (nunca en 0).
+    dirs[UP].rng = seed * 0x9E3779B97F4A7C15ull + 1;
+    dirs[DOWN].rng = (seed + 1) * 0xBF58476D1CE4E5B9ull + 1;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("[proxy] Puerto %s -> broker %s:%s (semilla %llu)\n", argv[optind], argv[optind + 1],
+           argv[optind + 2], (unsigned long long)seed);
+    printf("[proxy] Pérdida %.2f%% (ráfaga %.1f), retardo %.1f ms ± %.1f ms, reorden %.1f%%, duplicado %.1f%%, "
+           "tasa %s\n", prof.loss * 100, prof.burst, prof.delay_ns / 1e6, prof.jitter_ns / 1e6,
+           prof.reorder * 100, prof.dup * 100, prof.rate_bps > 0 ? "limitada" : "sin límite");
+    if (prof.rate_bps > 0) {
+        printf("[proxy] Enlace de %.0f kbit/s con cola de %zu bytes\n", prof.rate_bps / 1000, prof.queue_bytes);
+    }
+    fflush(stdout);
+
+    struct pollfd pfds[MAX_SESSIONS + 1];
+    int idx[MAX_SESSIONS + 1];
+    uint64_t next_report = mono_ns() + REPORT_NS;
+    while (!stop) {
+        uint64_t now = mono_ns();
+        int n = 0;
+        pfds[n] = (struct pollfd){ listen_fd, POLLIN, 0 };
+        idx[n++] = -1;
+        for (int i = 0; i < MAX_SESSIONS; i++) {
+            if (!sessions[i].used) continue;
+            pfds[n] = (struct pollfd){ sessions[i].fd, POLLIN, 0 };
+            idx[n++] = i;
+        }
+        uint64_t wake = next_report;
+        if (heap_len > 0 && heap[0].at < wake) wake = heap[0].at;
+        uint64_t wait = wake > now ? wake - now : 0;
+        struct timespec timeout = { (time_t)(wait / 1000000000ull), (long)(wait % 1000000000ull) };
+
+        int r = ppoll(pfds, (nfds_t)n, &timeout, NULL);
+        if (r < 0 && errno != EINTR) {
+            perror("ppoll");
+            break;
+        }
+        now = mono_ns();
+        for (int i = 0; r > 0 && i < n; i++) {
+            if (pfds[i].revents & (POLLIN | POLLERR)) drain(pfds[i].fd, idx[i], now);
+        }
+        release_due(mono_ns());
+        if (now >= next_report) {
+            static uint64_t last_rx = 0;
+            if (dirs[UP].rx + dirs[DOWN].rx != last_rx) report("Acumulado"); // solo si hubo tráfico
+            last_rx = dirs[UP].rx + dirs[DOWN].rx;
+            expire_sessions(now);
+            next_report = now + REPORT_NS;
+        }
+    }
+
+    report("Total");
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (sessions[i].used) close(sessions[i].fd);
+    }
+    close(listen_fd);
+    return 0;
+}
@@ -1,5 +1,15 @@
 // ------------------------------------------------------------
 // publisher_quic.c (QUIC + TLS con quiche) - con control de flujo
+//
+//   ./publisher_quic [-s sesion.bin] <host> <puerto> <tema>[=urgencia] [<tema2> ...]
+// Cada tema va por su propio stream (0, 4, 8, ...) con prioridad propia (urgencia 0 =
+// máxima ... 7), así un tema con mucho volumen no demora a los críticos. Con un solo
+// tema cada línea de stdin es un mensaje; con varios, las líneas son "<tema>: <texto>".
+// Con -s guarda el ticket de sesión; al reconectar "PUB <tema>" sale en 0-RTT. Los
+// MSG se envían recién con el handshake completo (los datos 0-RTT pueden repetirse).
+//
+// Un solo bucle con poll() sobre el socket y stdin, con el timeout de quiche
+// (quiche_conn_on_timeout al vencer): sin handshake o sin crédito el proceso duerme.
 // ------------------------------------------------------------
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,34 +18,64 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <openssl/rand.h>
 #include <quiche.h>
 
+#include "quic_session.h"
+#include "udp_gso.h"
+
 #define MAX_DATAGRAM_SIZE 1350
+#define MSG_MAX 1024              // largo máximo de una línea de stdin
+#define PENDING_MAX (256 * 1024)  // bytes encolados sin crédito antes de dejar de leer stdin
+#define LINGER_MS 1000            // espera de ACK tras el fin de stdin antes de cerrar
+#define KEEPALIVE_MS 10000        // PING sin tráfico, bien dentro del idle timeout del broker (30 s)
+#define MAX_TOPICS 32
+#define DEFAULT_URGENCY 3
+
+static bool gso_enabled = false; // el kernel acepta UDP_SEGMENT en el socket
 
+static uint64_t mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Vacía los paquetes pendientes; con GSO salen juntos en un solo sendmsg().
 static void pump_send(int sock, quiche_conn *conn,
                       struct sockaddr_in *peer_addr,
                       struct sockaddr_in *local_addr) {
-    uint8_t out[MAX_DATAGRAM_SIZE];
-    quiche_send_info s_info = {
-        .to = (struct sockaddr *)peer_addr,
-        .to_len = sizeof(*peer_addr),
-        .from = (struct sockaddr *)local_addr,
-        .from_len = sizeof(*local_addr)
-    };
+    (void)local_addr;
+    static uint8_t out[UDP_GSO_MAX_BYTES];
+    struct iovec iov[UDP_GSO_MAX_SEGS];
+    size_t npkts = 0, used = 0;
 
     for (;;) {
-        ssize_t len = quiche_conn_send(conn, out, sizeof(out), &s_info);
+        quiche_send_info s_info; // lo completa quiche
+        ssize_t len = quiche_conn_send(conn, out + used, MAX_DATAGRAM_SIZE, &s_info);
         if (len == QUICHE_ERR_DONE) break;
         if (len < 0) {
             fprintf(stderr, "[publisher] quiche_conn_send error: %zd\n", len);
             break;
         }
-        sendto(sock, out, len, 0, (struct sockaddr *)peer_addr, sizeof(*peer_addr));
+        iov[npkts].iov_base = out + used;
+        iov[npkts].iov_len = (size_t)len;
+        npkts++;
+        used += (size_t)len;
+        if (npkts == UDP_GSO_MAX_SEGS || used + MAX_DATAGRAM_SIZE > sizeof(out)) {
+            udp_send_batch(sock, &gso_enabled, iov, npkts,
+                           (struct sockaddr *)peer_addr, sizeof(*peer_addr));
+            npkts = used = 0;
+        }
+    }
+    if (npkts > 0) {
+        udp_send_batch(sock, &gso_enabled, iov, npkts,
+                       (struct sockaddr *)peer_addr, sizeof(*peer_addr));
     }
 }
 
-static void pump_recv(int sock, quiche_conn *conn,
+static bool pump_recv(int sock, quiche_conn *conn,
                       struct sockaddr_in *peer_addr,
                       struct sockaddr_in *local_addr) {
     uint8_t in[MAX_DATAGRAM_SIZE];
@@ -53,17 +93,68 @@ static void pump_recv(int sock, quiche_conn *conn,
         };
         quiche_conn_recv(conn, in, n, &r_info);
     }
+    return n > 0;
+}
+
+// Un tema publicado: su stream y la cola de salida ("PUB <tema>\n" seguido de las líneas
+// "MSG <texto>\n" que todavía no entraron en el stream por falta de crédito o de handshake).
+typedef struct {
+    const char *name;
+    size_t name_len;
+    uint64_t sid;
+    int urgency;
+    bool prio_set;
+    char *pending;                // PENDING_MAX + 4 * MSG_MAX: una lectura de stdin agrega
+    size_t pend_len;              // como mucho 3 * MSG_MAX ("a\n" -> "MSG a\n")
+    size_t pub_left;              // bytes de "PUB" aún no escritos (los únicos que van en 0-RTT)
+} PubStream;
+
+// Milisegundos hasta el próximo timer de quiche, para poll() (-1 = sin timer).
+static int quic_poll_timeout(quiche_conn *conn) {
+    uint64_t ms = quiche_conn_timeout_as_millis(conn);
+    if (ms == UINT64_MAX) return -1;
+    return ms > 60000 ? 60000 : (int)ms;
 }
 
 int main(int argc, char **argv) {
-    if (argc < 4) {
-        fprintf(stderr, "Uso: %s <host> <puerto> <topic>\n", argv[0]);
+    const char *session_file = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            session_file = optarg;
+        } else {
+            fprintf(stderr, "Uso: %s [-s sesion.bin] <host> <puerto> <tema>[=urgencia] [<tema2> ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 3 || argc - optind - 2 > MAX_TOPICS) {
+        fprintf(stderr, "Uso: %s [-s sesion.bin] <host> <puerto> <tema>[=urgencia] [<tema2> ...]\n", argv[0]);
         return 1;
     }
 
-    const char *host = argv[1];
-    int port = atoi(argv[2]);
-    const char *topic = argv[3];
+    const char *host = argv[optind];
+    int port = atoi(argv[optind + 1]);
+
+    PubStream streams[MAX_TOPICS];
+    int nstreams = argc - optind - 2;
+    for (int i = 0; i < nstreams; i++) {
+        PubStream *ps = &streams[i];
+        const char *arg = argv[optind + 2 + i];
+        const char *eq = strchr(arg, '=');
+        memset(ps, 0, sizeof(*ps));
+        ps->name = arg;
+        ps->name_len = eq ? (size_t)(eq - arg) : strlen(arg);
+        ps->urgency = eq ? atoi(eq + 1) : DEFAULT_URGENCY;
+        ps->sid = 4 * (uint64_t)i; // streams bidireccionales del cliente: 0, 4, 8, ...
+        ps->pending = (char *)malloc(PENDING_MAX + 4 * MSG_MAX);
+        if (!ps->pending) { perror("malloc"); return 1; }
+        if (ps->name_len == 0 || ps->name_len > 200) {
+            fprintf(stderr, "[publisher] tema inválido: '%s'\n", arg);
+            return 1;
+        }
+        ps->pend_len = (size_t)sprintf(ps->pending, "PUB %.*s\n", (int)ps->name_len, ps->name);
+        ps->pub_left = ps->pend_len;
+    }
 
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) { perror("socket"); return 1; }
@@ -79,6 +170,7 @@ int main(int argc, char **argv) {
     }
     socklen_t l = sizeof(local_addr);
     getsockname(sock, (struct sockaddr *)&local_addr, &l);
+    gso_enabled = udp_gso_probe(sock);
 
     struct sockaddr_in peer_addr = {0};
     peer_addr.sin_family = AF_INET;
@@ -93,6 +185,8 @@ int main(int argc, char **argv) {
     quiche_config_set_initial_max_stream_data_bidi_local(config, 5 * 1024 * 1024);
     quiche_config_set_initial_max_stream_data_bidi_remote(config, 5 * 1024 * 1024);
     quiche_config_set_initial_max_streams_bidi(config, 100);
+    quiche_config_set_max_idle_timeout(config, 30000); // sin respuesta del broker, se cierra
+    quiche_config_enable_early_data(config); // sin esto el ticket no habilita 0-RTT
 
     static const uint8_t ALPN[] = "\x05hq-29\x08http/0.9";
     quiche_config_set_application_protos(config, ALPN, sizeof(ALPN)-1);
@@ -112,64 +206,194 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // --- handshake inicial ---
-    while (!quiche_conn_is_established(conn)) {
-        pump_send(sock, conn, &peer_addr, &local_addr);
-        pump_recv(sock, conn, &peer_addr, &local_addr);
-    }
-
-    printf("[publisher] Handshake QUIC completado.\n");
-
-    uint64_t stream_id = 0;
-    uint64_t err_code = 0;
-
-    // --- enviar tópico ---
-    size_t topic_len = strlen(topic);
-    int wr = quiche_conn_stream_writable(conn, stream_id, topic_len);
-    if (wr <= 0) {
-        pump_send(sock, conn, &peer_addr, &local_addr);
-        pump_recv(sock, conn, &peer_addr, &local_addr);
-    }
-    ssize_t sret = quiche_conn_stream_send(conn, stream_id,
-                                           (const uint8_t *)topic, topic_len,
-                                           false, &err_code);
-    if (sret < 0)
-        fprintf(stderr, "stream_send(topic) err=%zd code=%llu\n",
-                sret, (unsigned long long)err_code);
+    // Con sesión guardada, los "PUB" salen en 0-RTT detrás del primer paquete. quiche recién
+    // entra en early data al generar el ClientHello, así que se envía ese primer vuelo acá y
+    // el bucle vuelve a mirar quiche_conn_is_in_early_data() en cada vuelta.
+    quic_session_load(conn, session_file);
     pump_send(sock, conn, &peer_addr, &local_addr);
+    bool established = false, session_saved = false, blocked = false;
+    bool stdin_open = true;
+    bool interactive = isatty(STDIN_FILENO);
+    char inbuf[MSG_MAX];
+    size_t in_len = 0;
+    int linger_ms = -1;           // tras fin de stdin: tiempo para recibir los últimos ACK
+    uint64_t queued_msgs = 0, unknown = 0;
+    uint64_t next_ping = mono_ms() + KEEPALIVE_MS;
 
-    // --- loop de mensajes ---
+    // Bucle de eventos: poll() sobre el socket y stdin con el timeout de quiche. Sin
+    // crédito de flujo se deja de leer stdin (la presión llega hasta quien escribe).
     for (;;) {
-        char msg[1024];
-        printf("Mensaje a enviar ('exit' para salir): ");
-        if (!fgets(msg, sizeof(msg), stdin)) break;
-        msg[strcspn(msg, "\n")] = 0;
-        if (strcmp(msg, "exit") == 0) break;
-
-        size_t want = strlen(msg);
-        int writable = quiche_conn_stream_writable(conn, stream_id, want);
-
-        while (writable <= 0) {
-            fprintf(stderr, "[publisher] Stream bloqueado, bombeando...\n");
-            pump_send(sock, conn, &peer_addr, &local_addr);
-            pump_recv(sock, conn, &peer_addr, &local_addr);
-            writable = quiche_conn_stream_writable(conn, stream_id, want);
+        // 1) Pasar a cada stream lo que permita su crédito (antes del handshake, solo
+        //    los "PUB" en 0-RTT). Un tema sin crédito no frena a los demás.
+        bool full = false;
+        size_t unsent = 0;
+        for (int i = 0; i < nstreams; i++) {
+            PubStream *ps = &streams[i];
+            size_t can = established ? ps->pend_len : (quiche_conn_is_in_early_data(conn) ? ps->pub_left : 0);
+            if (can > 0) {
+                if (!ps->prio_set) {
+                    // incremental: los temas de igual urgencia se intercalan
+                    quiche_conn_stream_priority(conn, ps->sid, (uint8_t)ps->urgency, true);
+                    ps->prio_set = true;
+                }
+                uint64_t err_code = 0;
+                ssize_t w = quiche_conn_stream_send(conn, ps->sid, (const uint8_t *)ps->pending, can,
+                                                    false, &err_code);
+                if (w > 0) {
+                    memmove(ps->pending, ps->pending + w, ps->pend_len - (size_t)w);
+                    ps->pend_len -= (size_t)w;
+                    bool was_pub = ps->pub_left > 0;
+                    ps->pub_left = (size_t)w >= ps->pub_left ? 0 : ps->pub_left - (size_t)w;
+                    if (!established && was_pub && ps->pub_left == 0) {
+                        printf("[publisher] Sesión reanudada: 'PUB %.*s' enviado en 0-RTT.\n",
+                               (int)ps->name_len, ps->name);
+                    }
+                } else if (w < 0 && w != QUICHE_ERR_DONE) {
+                    fprintf(stderr, "[publisher] stream_send err=%zd code=%llu\n",
+                            w, (unsigned long long)err_code);
+                }
+            }
+            if (ps->pend_len >= PENDING_MAX) full = true;
+            unsent += ps->pend_len;
+        }
+        if (full != blocked) {
+            blocked = full;
+            fprintf(stderr, blocked ? "[publisher] Stream bloqueado, esperando crédito...\n"
+                                    : "[publisher] Stream desbloqueado.\n");
+        }
+        // Sin nada que escribir (p.ej. esperando al usuario), un PING mantiene viva la conexión.
+        uint64_t now = mono_ms();
+        if (now >= next_ping) {
+            if (established) quiche_conn_send_ack_eliciting(conn);
+            next_ping = now + KEEPALIVE_MS;
+        }
+        pump_send(sock, conn, &peer_addr, &local_addr);
+
+        if (quiche_conn_is_closed(conn)) {
+            fprintf(stderr, established ? "[publisher] Conexión cerrada.\n"
+                                        : "[publisher] ❌ El handshake falló.\n");
+            break;
+        }
+        if (!stdin_open && unsent == 0 && established && linger_ms < 0) {
+            linger_ms = LINGER_MS;
         }
 
-        ssize_t s = quiche_conn_stream_send(conn, stream_id,
-                                            (const uint8_t *)msg, want,
-                                            false, &err_code);
-        if (s == -12) {
-            fprintf(stderr, "[publisher] Bloqueado (-12), reintentando...\n");
+        // 2) Esperar: socket siempre; stdin solo si hay lugar en la cola.
+        struct pollfd pfds[2] = {
+            { .fd = sock, .events = POLLIN },
+            { .fd = STDIN_FILENO, .events = POLLIN },
+        };
+        nfds_t nfds = (stdin_open && !full) ? 2 : 1;
+        int timeout = quic_poll_timeout(conn);
+        if (linger_ms >= 0 && (timeout < 0 || timeout > linger_ms)) timeout = linger_ms;
+        int until_ping = (int)(next_ping - now);
+        if (timeout < 0 || timeout > until_ping) timeout = until_ping;
+        uint64_t t0 = mono_ms();
+        int r = poll(pfds, nfds, timeout);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if (linger_ms >= 0) {
+            linger_ms -= (int)(mono_ms() - t0);
+            if (linger_ms <= 0) {
+                quiche_conn_close(conn, true, 0, NULL, 0);
+                pump_send(sock, conn, &peer_addr, &local_addr);
+                break;
+            }
+        }
+        if (r == 0) {
+            quiche_conn_on_timeout(conn);
             continue;
-        } else if (s < 0) {
-            fprintf(stderr, "[publisher] stream_send err=%zd code=%llu\n",
-                    s, (unsigned long long)err_code);
         }
 
-        pump_send(sock, conn, &peer_addr, &local_addr);
+        if (pfds[0].revents & POLLIN) {
+            while (pump_recv(sock, conn, &peer_addr, &local_addr)) {}
+            if (!established && quiche_conn_is_established(conn)) {
+                established = true;
+                printf("[publisher] Handshake QUIC completado%s.\n",
+                       quiche_conn_is_resumed(conn) ? " (sesión reanudada)" : "");
+                if (interactive) printf("Mensaje a enviar ('exit' para salir): ");
+                fflush(stdout);
+            }
+            // El ticket de sesión llega después del handshake: se guarda en cuanto aparece.
+            if (established && !session_saved && quic_session_save(conn, session_file)) {
+                session_saved = true;
+                printf("[publisher] Sesión guardada en %s\n", session_file);
+            }
+        }
+
+        // 3) stdin: cada línea no vacía se encola como "MSG <texto>\n".
+        if (nfds == 2 && (pfds[1].revents & (POLLIN | POLLHUP))) {
+            ssize_t n = read(STDIN_FILENO, inbuf + in_len, sizeof(inbuf) - in_len);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                stdin_open = false;
+                continue;
+            }
+            in_len += (size_t)n;
+            size_t start = 0;
+            for (;;) {
+                char *nl = (char *)memchr(inbuf + start, '\n', in_len - start);
+                size_t len;
+                if (nl) {
+                    len = (size_t)(nl - (inbuf + start));
+                } else if (start == 0 && in_len == sizeof(inbuf)) {
+                    len = in_len; // línea más larga que el buffer: sale en pedazos
+                } else {
+                    break;
+                }
+                if (len == 4 && memcmp(inbuf + start, "exit", 4) == 0) {
+                    stdin_open = false;
+                    start = in_len;
+                    break;
+                }
+                // Con varios temas la línea es "<tema>: <texto>".
+                PubStream *ps = &streams[0];
+                const char *text = inbuf + start;
+                size_t tlen = len;
+                if (nstreams > 1 && len > 0) {
+                    const char *colon = (const char *)memchr(text, ':', len);
+                    ps = NULL;
+                    for (int i = 0; colon && i < nstreams; i++) {
+                        if (streams[i].name_len == (size_t)(colon - text) &&
+                            memcmp(streams[i].name, text, streams[i].name_len) == 0) {
+                            ps = &streams[i];
+                        }
+                    }
+                    if (ps) {
+                        tlen -= (size_t)(colon + 1 - text);
+                        text = colon + 1;
+                        if (tlen > 0 && *text == ' ') { text++; tlen--; }
+                    } else {
+                        unknown++;
+                        fprintf(stderr, "[publisher] línea sin tema conocido (use '<tema>: <texto>')\n");
+                    }
+                }
+                if (ps && tlen > 0) {
+                    memcpy(ps->pending + ps->pend_len, "MSG ", 4);
+                    memcpy(ps->pending + ps->pend_len + 4, text, tlen);
+                    ps->pend_len += 4 + tlen;
+                    ps->pending[ps->pend_len++] = '\n';
+                    queued_msgs++;
+                }
+                start += len + (nl ? 1 : 0);
+                if (interactive) printf("Mensaje a enviar ('exit' para salir): ");
+            }
+            memmove(inbuf, inbuf + start, in_len - start);
+            in_len -= start;
+            fflush(stdout);
+        }
     }
 
+    size_t unsent = 0;
+    for (int i = 0; i < nstreams; i++) {
+        unsent += streams[i].pend_len;
+        free(streams[i].pending);
+    }
+    printf("[publisher] %llu mensaje(s) encolados, %llu línea(s) sin tema, %zu bytes sin enviar.\n",
+           (unsigned long long)queued_msgs, (unsigned long long)unknown, unsent);
     quiche_conn_free(conn);
     close(sock);
     return 0;
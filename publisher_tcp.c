@@ -1,8 +1,11 @@
 // Publisher TCP: conecta al broker, envía "PUB <tema>" y luego publica líneas.
-// Si el usuario no escribe "MSG ", el programa lo antepone automáticamente.
+// Si el usuario no escribe "MSG " (o "MSGP <prioridad> "), el programa antepone "MSG ".
+// Si el broker responde "SLOW <tema>" deja de leer stdin hasta recibir "GO <tema>".
 //
 // Compilación: gcc -Wall -Wextra -O2 -o publisher_tcp publisher_tcp.c
 // Uso:         ./publisher_tcp <host> <puerto> "<tema>"
+//              ./publisher_tcp -C mapa.txt "<tema>"   (broker dueño del tema según cluster_map.h)
+//              ./publisher_tcp -p 0 <host> <puerto> "<tema>"   (prioridad de sus mensajes: 0 alta .. 2 baja)
 // Ejemplo:     ./publisher_tcp 127.0.0.1 5555 "Partido_AvsB"
 
 #include <arpa/inet.h>      // Provee funciones para manipular direcciones IP, como inet_ntop() que convierte IPs de binario a texto.
@@ -15,6 +18,7 @@
 #include <sys/socket.h>     // Contiene las definiciones y estructuras principales para la API de sockets (socket(), bind(), sendto(), recvfrom()).
 #include <unistd.h>         // Provee acceso a la API del sistema operativo POSIX, incluyendo la función close() para cerrar descriptores de archivo.
 
+#include "cluster_map.h"    // -C: tema -> broker dueño por hashing consistente.
 
 #define MAX_LINE 4096
 
@@ -34,35 +38,123 @@ static ssize_t send_all(int fd, const void *buf, size_t len) {
     return (ssize_t)sent;
 }
 
-int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s <host> <puerto> <tema>\n", argv[0]);
-        return 1;
+static char in[MAX_LINE];       // avisos del broker a medio leer (check_flow)
+static size_t inlen = 0;
+
+// Lee lo que haya mandado el broker (sin bloquear) y procesa sus líneas. Tras un "SLOW"
+// sigue leyendo, ya bloqueando, hasta el "GO". Devuelve -1 si el broker cerró.
+static int check_flow(int fd) {
+    bool paused = false;
+    for (;;) {
+        ssize_t n = recv(fd, in + inlen, sizeof(in) - 1 - inlen, paused ? 0 : MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            perror("recv");
+            return -1;
+        }
+        if (n == 0) {
+            fprintf(stderr, "[publisher] El broker cerró la conexión\n");
+            return -1;
+        }
+        inlen += (size_t)n;
+        in[inlen] = '\0';
+        char *line = in, *nl;
+        while ((nl = strchr(line, '\n')) != NULL) {
+            *nl = '\0';
+            if (strncmp(line, "SLOW ", 5) == 0) {
+                if (!paused) printf("[publisher] Broker saturado en '%s': en pausa\n", line + 5);
+                paused = true;
+            } else if (strncmp(line, "GO ", 3) == 0) {
+                if (paused) printf("[publisher] Reanudando '%s'\n", line + 3);
+                paused = false;
+            } else {
+                fprintf(stderr, "[publisher] Broker: %s\n", line);
+            }
+            line = nl + 1;
+        }
+        inlen = strlen(line);
+        memmove(in, line, inlen);
+        if (inlen == sizeof(in) - 1) inlen = 0; // línea demasiado larga: descartar
+        if (!paused) return 0;
     }
-    const char *host = argv[1];
-    int port = atoi(argv[2]);
-    const char *topic = argv[3];
+}
 
-    // Crear socket y conectarse al broker.
+// Conecta al broker y anuncia rol/tema. Devuelve el socket o -1.
+// 'prio' < 0: sin prioridad propia (el broker usa la del tema).
+static int connect_pub(const struct sockaddr_in *addr, const char *topic, int prio) {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) { perror("socket"); return 1; }
+    if (fd < 0) { perror("socket"); return -1; }
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    char first[MAX_LINE];
+    int n = prio >= 0 ? snprintf(first, sizeof(first), "PUB %s %d\n", topic, prio)
+                      : snprintf(first, sizeof(first), "PUB %s\n", topic);
+    if (send_all(fd, first, (size_t)n) < 0) { perror("send"); close(fd); return -1; }
+    return fd;
+}
 
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons((uint16_t)port);
-    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
-        perror("inet_pton");
-        return 1;
+// Cierra solo la escritura y espera a que el broker cierre: así procesa todo lo enviado
+// (un close() con avisos sin leer en el socket lo resetearía y se perdería lo pendiente).
+static void close_pub(int fd) {
+    char buf[MAX_LINE];
+    shutdown(fd, SHUT_WR);
+    while (recv(fd, buf, sizeof(buf), 0) > 0) {
     }
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("connect");
+    close(fd);
+    inlen = 0; // lo que quedó a medias era de esta conexión
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-p prioridad] <host> <puerto> <tema>\n", prog);
+    fprintf(stderr, "     %s [-p prioridad] -C mapa.txt <tema>   (se conecta al broker dueño del tema)\n", prog);
+    fprintf(stderr, "  -p  0 alta, 1 normal, 2 baja (por defecto, la que el broker asigna al tema)\n");
+}
+
+int main(int argc, char **argv) {
+    ClusterMap map;
+    const char *map_path = NULL;
+    int prio = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "C:p:")) != -1) {
+        switch (opt) {
+        case 'C': map_path = optarg; break;
+        case 'p':
+            prio = atoi(optarg);
+            if (prio < 0 || prio > 2) { usage(argv[0]); return 1; }
+            break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != (map_path ? 1 : 3)) {
+        usage(argv[0]);
         return 1;
     }
+    const char *topic = argv[argc - 1];
 
-    // Anunciar rol/tema al broker.
-    char first[MAX_LINE];
-    int n = snprintf(first, sizeof(first), "PUB %s\n", topic);
-    if (send_all(fd, first, (size_t)n) < 0) { perror("send"); close(fd); return 1; }
+    struct sockaddr_in addr = {0};
+    if (map_path) {
+        if (cluster_map_load(&map, map_path) != 0) return 1;
+        const ClusterNode *owner = cluster_map_owner(&map, topic);
+        addr = owner->addr;
+        printf("[publisher] Tema '%s' -> broker %s\n", topic, owner->name);
+    } else {
+        const char *host = argv[optind];
+        int port = atoi(argv[optind + 1]);
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
+            perror("inet_pton");
+            return 1;
+        }
+    }
+
+    // Crear socket, conectarse al broker y anunciar rol/tema.
+    int fd = connect_pub(&addr, topic, prio);
+    if (fd < 0) return 1;
 
     printf("[publisher] Conectado. Escribe mensajes.\n");
 
@@ -73,16 +165,33 @@ int main(int argc, char **argv) {
         size_t len = strlen(buf);
         if (len && buf[len-1] == '\n') buf[len-1] = '\0';
 
+        // Con -C: si el mapa cambió y el tema tiene otro dueño, pasar a ese broker.
+        if (map_path && cluster_map_reload(&map)) {
+            const ClusterNode *owner = cluster_map_owner(&map, topic);
+            if (!cluster_same_addr(&owner->addr, &addr)) {
+                int nfd = connect_pub(&owner->addr, topic, prio);
+                if (nfd >= 0) {
+                    close_pub(fd);
+                    fd = nfd;
+                    addr = owner->addr;
+                    printf("[publisher] Mapa actualizado: '%s' ahora en %s\n", topic, owner->name);
+                }
+            }
+        }
+
+        int n;
         char line[MAX_LINE];
-        if (strncmp(buf, "MSG ", 4) == 0) {
+        if (strncmp(buf, "MSG ", 4) == 0 || strncmp(buf, "MSGP ", 5) == 0) {
             n = snprintf(line, sizeof(line), "%s\n", buf);
         } else {
             n = snprintf(line, sizeof(line), "MSG %s\n", buf);
         }
         if (send_all(fd, line, (size_t)n) < 0) { perror("send"); break; }
+        if (check_flow(fd) < 0) break;
     }
 
-    close(fd);
+    close_pub(fd);
+    if (map_path) cluster_map_free(&map);
     return 0;
 }
 
@@ -1,23 +1,261 @@
+// Publisher UDP: modo interactivo (una línea de stdin = un mensaje) y modo generador
+// de carga (-r/-n): mensajes sintéticos a ritmo controlado con token bucket y sendmmsg().
+// Con -C mapa.txt (cluster_map.h) cada tema se envía a su broker dueño en vez de a
+// <host> <puerto>, y se sigue al mapa si cambia.
+
+#define _GNU_SOURCE         // sendmmsg() y struct mmsghdr.
 #include <arpa/inet.h>      // Provee funciones para manipular direcciones IP, como inet_pton() que convierte IPs de texto a binario.
 #include <errno.h>          // Permite el manejo de errores a través de la variable 'errno'.
 #include <netinet/in.h>     // Define la estructura 'sockaddr_in' y constantes para sockets de Internet (ej. AF_INET).
+#include <signal.h>         // SIGINT detiene el generador y muestra el reporte final.
+#include <stdint.h>         // Enteros de ancho fijo para secuencias y tiempos en nanosegundos.
 #include <stdbool.h>        // Define el tipo de dato booleano 'bool' y los valores 'true' y 'false'.
 #include <stdio.h>          // Librería estándar de Entrada/Salida para funciones como printf(), fprintf() y fgets().
 #include <stdlib.h>         // Librería estándar que provee funciones para conversión de tipos (atoi) y salida del programa (exit).
 #include <string.h>         // Provee funciones para la manipulación de cadenas de caracteres, como strlen() y snprintf().
 #include <sys/socket.h>     // Contiene las definiciones principales para la API de sockets, como la función socket() y sendto().
+#include <time.h>           // clock_gettime()/clock_nanosleep() para el ritmo del generador.
 #include <unistd.h>         // Provee acceso a la API del sistema operativo POSIX, incluyendo la función close() para cerrar el socket.
 
+#include "cluster_map.h"    // -C: tema -> broker dueño por hashing consistente.
+
 #define MAX_LINE 4096
+#define MAX_BATCH 256           // mensajes por sendmmsg() como máximo
+#define MAX_GEN_TOPICS 1024
+#define DEFAULT_BATCH 32
+#define DEFAULT_PAYLOAD 64
+#define REPORT_NS 1000000000ull // reporte parcial cada segundo
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_sigint(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Escribe 'v' en decimal en 'out' y devuelve la cantidad de dígitos (sin snprintf).
+static size_t put_u64(char *out, uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    for (size_t i = 0; i < n; i++) out[i] = tmp[n - 1 - i];
+    return n;
+}
+
+// xorshift64*: payload pseudoaleatorio reproducible a partir de la semilla.
+static uint64_t rng_next(uint64_t *st) {
+    uint64_t x = *st;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *st = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+typedef struct {
+    double rate;        // mensajes por segundo (0 = lo más rápido posible)
+    uint64_t count;     // mensajes a enviar (0 = hasta Ctrl+C)
+    size_t size;        // bytes de texto por mensaje (tras "PUB <tema> ")
+    int topics;         // cantidad de temas: <tema> o <tema>_0 .. <tema>_N-1
+    uint64_t seed;
+    int batch;          // mensajes por sendmmsg()
+} GenOpts;
+
+// Modo generador. Cada mensaje es "PUB <tema> G <seq> <ns_envío> <relleno>": el
+// suscriptor puede medir latencia con el reloj de la misma máquina. El ritmo lo da
+// un token bucket (capacidad = un lote) y se duerme con clock_nanosleep() absoluto
+// hasta que haya al menos un token; lo acumulado sale en un solo sendmmsg().
+// Con 'map' el socket no está conectado: cada mensaje lleva la dirección del dueño de
+// su tema, que se recalcula si el mapa cambia.
+static int run_generator(int sockfd, const char *topic, const GenOpts *o, ClusterMap *map) {
+    // Nombres de los temas y prefijos "PUB <tema> " armados una sola vez.
+    static char name[MAX_GEN_TOPICS][150];
+    static char prefix[MAX_GEN_TOPICS][160];
+    static size_t prefix_len[MAX_GEN_TOPICS];
+    static struct sockaddr_in dest[MAX_GEN_TOPICS];
+    for (int t = 0; t < o->topics; t++) {
+        int n = o->topics == 1 ? snprintf(name[t], sizeof(name[t]), "%s", topic)
+                               : snprintf(name[t], sizeof(name[t]), "%s_%d", topic, t);
+        if (n < 0 || (size_t)n >= sizeof(name[t])) {
+            fprintf(stderr, "Error: el tema es demasiado largo.\n");
+            return 1;
+        }
+        prefix_len[t] = (size_t)snprintf(prefix[t], sizeof(prefix[t]), "PUB %s ", name[t]);
+        if (map) dest[t] = cluster_map_owner(map, name[t])->addr;
+    }
+
+    // Relleno aleatorio: se toma una ventana distinta del mismo bloque para cada mensaje.
+    static char pool[2 * MAX_LINE];
+    uint64_t st = o->seed ? o->seed : 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < sizeof(pool); i++) pool[i] = (char)('a' + rng_next(&st) % 26);
+
+    static char bufs[MAX_BATCH][MAX_LINE];
+    struct iovec iov[MAX_BATCH];
+    struct mmsghdr msgs[MAX_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+
+    uint64_t seq = 0, sent = 0, calls = 0, errors = 0, bytes = 0;
+    uint64_t start = mono_ns(), last = start, next_report = start + REPORT_NS;
+    uint64_t last_report_sent = 0;
+    double tokens = o->batch; // el bucket arranca lleno
+    double interval_ns = o->rate > 0 ? 1e9 / o->rate : 0;
+
+    while (!stop && (o->count == 0 || sent < o->count)) {
+        uint64_t now = mono_ns();
+        int want = o->batch;
+        if (o->rate > 0) {
+            tokens += (double)(now - last) / interval_ns;
+            if (tokens > o->batch) tokens = o->batch;
+            last = now;
+            if (tokens < 1.0) {
+                // dormir hasta el instante exacto del próximo token
+                uint64_t wake = now + (uint64_t)((1.0 - tokens) * interval_ns);
+                struct timespec ts = { (time_t)(wake / 1000000000ull), (long)(wake % 1000000000ull) };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                continue;
+            }
+            want = (int)tokens;
+        }
+        if (o->count && (uint64_t)want > o->count - sent) want = (int)(o->count - sent);
+
+        uint64_t ts_ns = wall_ns();
+        for (int i = 0; i < want; i++, seq++) {
+            int t = (int)(seq % (uint64_t)o->topics);
+            char *b = bufs[i];
+            size_t n = prefix_len[t];
+            memcpy(b, prefix[t], n);
+            b[n++] = 'G';
+            b[n++] = ' ';
+            n += put_u64(b + n, seq);
+            b[n++] = ' ';
+            n += put_u64(b + n, ts_ns);
+            size_t text = n - prefix_len[t];
+            if (text < o->size) {
+                b[n++] = ' ';
+                size_t fill = o->size - text - 1;
+                memcpy(b + n, pool + seq % MAX_LINE, fill);
+                n += fill;
+            }
+            iov[i].iov_base = b;
+            iov[i].iov_len = n;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (map) {
+                msgs[i].msg_hdr.msg_name = &dest[t];
+                msgs[i].msg_hdr.msg_namelen = sizeof(dest[t]);
+            }
+        }
+
+        int done = 0;
+        while (done < want) {
+            calls++;
+            int r = sendmmsg(sockfd, msgs + done, (unsigned)(want - done), 0);
+            if (r < 0) {
+                if (errno == EINTR) {
+                    if (stop) break;
+                    continue;
+                }
+                if (errno == ENOBUFS || errno == EAGAIN || errno == ECONNREFUSED) {
+                    errors++; // el mensaje se pierde, como se perdería en la red
+                    done++;
+                    continue;
+                }
+                perror("sendmmsg");
+                stop = 1;
+                break;
+            }
+            for (int i = done; i < done + r; i++) bytes += msgs[i].msg_len;
+            sent += (uint64_t)r;
+            done += r;
+        }
+        if (o->rate > 0) tokens -= done;
+
+        now = mono_ns();
+        if (now >= next_report) {
+            printf("[publisher] %llu mensajes (%.0f msg/s)\n", (unsigned long long)sent,
+                   (double)(sent - last_report_sent) * 1e9 / (double)(now - next_report + REPORT_NS));
+            fflush(stdout);
+            last_report_sent = sent;
+            next_report = now + REPORT_NS;
+            if (map && cluster_map_reload(map)) {
+                int moved = 0;
+                for (int t = 0; t < o->topics; t++) {
+                    const ClusterNode *owner = cluster_map_owner(map, name[t]);
+                    if (!cluster_same_addr(&dest[t], &owner->addr)) moved++;
+                    dest[t] = owner->addr;
+                }
+                printf("[publisher] Mapa actualizado: %d de %d tema(s) cambiaron de broker\n", moved, o->topics);
+            }
+        }
+    }
+
+    double secs = (double)(mono_ns() - start) / 1e9;
+    if (secs <= 0) secs = 1e-9;
+    printf("[publisher] Enviados %llu mensajes en %.3f s: %.0f msg/s, %.2f MB/s", (unsigned long long)sent, secs,
+           (double)sent / secs, (double)bytes / secs / 1e6);
+    if (o->rate > 0) printf(" (objetivo %.0f msg/s)", o->rate);
+    printf("\n[publisher] %llu llamadas a sendmmsg (%.1f mensajes por llamada), %llu errores de envío\n",
+           (unsigned long long)calls, calls ? (double)sent / (double)calls : 0.0, (unsigned long long)errors);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-r msg/s] [-n cantidad] [-s bytes] [-T temas] [-S semilla] [-b lote] <host> <puerto> <tema>\n",
+            prog);
+    fprintf(stderr, "     %s [opciones] -C mapa.txt <tema>\n", prog);
+    fprintf(stderr, "  Sin -r ni -n: modo interactivo (cada línea de stdin es un mensaje).\n");
+    fprintf(stderr, "  -r  modo generador: mensajes por segundo (0 = lo más rápido posible)\n");
+    fprintf(stderr, "  -n  modo generador: cantidad de mensajes (0 = hasta Ctrl+C)\n");
+    fprintf(stderr, "  -s  bytes de texto por mensaje (por defecto %d)\n", DEFAULT_PAYLOAD);
+    fprintf(stderr, "  -T  cantidad de temas: <tema>_0 .. <tema>_N-1 en ronda (por defecto 1: solo <tema>)\n");
+    fprintf(stderr, "  -S  semilla del relleno aleatorio\n");
+    fprintf(stderr, "  -b  mensajes por sendmmsg (por defecto %d, máximo %d)\n", DEFAULT_BATCH, MAX_BATCH);
+    fprintf(stderr, "  -C  mapa del clúster (cluster_map.h): cada tema va a su broker dueño\n");
+}
 
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s <host> <puerto> <tema>\n", argv[0]);
+    GenOpts gen = { 0, 0, DEFAULT_PAYLOAD, 1, 0, DEFAULT_BATCH };
+    bool generator = false;
+    const char *map_path = NULL;
+    ClusterMap map;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:n:s:T:S:b:C:")) != -1) {
+        switch (opt) {
+        case 'r': gen.rate = atof(optarg); generator = true; break;
+        case 'n': gen.count = strtoull(optarg, NULL, 10); generator = true; break;
+        case 's': gen.size = (size_t)atol(optarg); break;
+        case 'T': gen.topics = atoi(optarg); break;
+        case 'S': gen.seed = strtoull(optarg, NULL, 0); break;
+        case 'b': gen.batch = atoi(optarg); break;
+        case 'C': map_path = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != (map_path ? 1 : 3)) {
+        usage(argv[0]);
         return 1;
     }
-    const char *host = argv[1];
-    int port = atoi(argv[2]);
-    const char *topic = argv[3];
+    if (gen.topics < 1 || gen.topics > MAX_GEN_TOPICS || gen.batch < 1 || gen.batch > MAX_BATCH ||
+        gen.rate < 0 || gen.size > MAX_LINE - 200) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *topic = argv[argc - 1];
 
     // Crear socket UDP
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -26,14 +264,48 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // Configurar la dirección del broker
+    // Configurar la dirección del broker (con -C, la del dueño del tema)
     struct sockaddr_in broker_addr = {0};
-    broker_addr.sin_family = AF_INET;
-    broker_addr.sin_port = htons((uint16_t)port);
-    if (inet_pton(AF_INET, host, &broker_addr.sin_addr) <= 0) {
-        perror("inet_pton: Dirección de host inválida");
+    if (map_path) {
+        if (cluster_map_load(&map, map_path) != 0) {
+            close(sockfd);
+            return 1;
+        }
+        const ClusterNode *owner = cluster_map_owner(&map, topic);
+        broker_addr = owner->addr;
+        if (!generator || gen.topics == 1) printf("[publisher] Tema '%s' -> broker %s\n", topic, owner->name);
+    } else {
+        broker_addr.sin_family = AF_INET;
+        broker_addr.sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+        if (inet_pton(AF_INET, argv[optind], &broker_addr.sin_addr) <= 0) {
+            perror("inet_pton: Dirección de host inválida");
+            close(sockfd);
+            return 1;
+        }
+    }
+
+    if (generator) {
+        // connect(): sendmmsg() sin dirección por mensaje (con -C cada mensaje lleva la suya).
+        if (!map_path && connect(sockfd, (const struct sockaddr *)&broker_addr, sizeof(broker_addr)) < 0) {
+            perror("connect");
+            close(sockfd);
+            return 1;
+        }
+        struct sigaction sa = {0};
+        sa.sa_handler = on_sigint; // sin SA_RESTART: despierta a clock_nanosleep()
+        sigaction(SIGINT, &sa, NULL);
+        char rate[32], count[32];
+        if (gen.rate > 0) snprintf(rate, sizeof(rate), "%.0f msg/s", gen.rate);
+        else snprintf(rate, sizeof(rate), "sin límite");
+        if (gen.count > 0) snprintf(count, sizeof(count), "%llu mensajes", (unsigned long long)gen.count);
+        else snprintf(count, sizeof(count), "hasta Ctrl+C");
+        printf("[publisher] Generando en %d tema(s) desde '%s': %s, %s, %zu bytes, lotes de %d\n",
+               gen.topics, topic, rate, count, gen.size, gen.batch);
+        fflush(stdout);
+        int rc = run_generator(sockfd, topic, &gen, map_path ? &map : NULL);
         close(sockfd);
-        return 1;
+        if (map_path) cluster_map_free(&map);
+        return rc;
     }
 
     printf("[publisher] Publicando en el tema '%s'. Escribe mensajes y presiona Enter.\n", topic);
@@ -51,6 +323,15 @@ int main(int argc, char **argv) {
         // Si el usuario no escribe nada, no enviar
         if(strlen(user_input) == 0) continue;
 
+        // Con -C: si el mapa cambió, el tema puede tener otro dueño
+        if (map_path && cluster_map_reload(&map)) {
+            const ClusterNode *owner = cluster_map_owner(&map, topic);
+            if (!cluster_same_addr(&owner->addr, &broker_addr)) {
+                broker_addr = owner->addr;
+                printf("[publisher] Mapa actualizado: '%s' ahora en %s\n", topic, owner->name);
+            }
+        }
+
         // Construir el mensaje final en el formato "PUB <tema> <mensaje>"
         char final_message[MAX_LINE];
         int n = snprintf(final_message, sizeof(final_message), "PUB %s %s", topic, user_input);
@@ -60,7 +341,7 @@ int main(int argc, char **argv) {
         }
 
         // Enviar el datagrama al broker
-        if (sendto(sockfd, final_message, strlen(final_message), 0,
+        if (sendto(sockfd, final_message, (size_t)n, 0,
                    (const struct sockaddr *)&broker_addr, sizeof(broker_addr)) < 0) {
             perror("sendto");
             break; // Salir del bucle si hay un error de envío
@@ -69,5 +350,6 @@ int main(int argc, char **argv) {
 
     printf("\n[publisher] Terminando.\n");
     close(sockfd);
+    if (map_path) cluster_map_free(&map);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+// quic_session.h - Reanudación de sesión TLS (tickets) y 0-RTT para los clientes QUIC.
+//
+// Header "solo cabecera" (funciones static), como udp_gso.h: lo incluyen
+// publisher_quic.c y subscriber_quic.c sin cambiar la forma de compilar.
+//
+// Tras un handshake completo el broker envía un ticket de sesión; quiche lo expone con
+// quiche_conn_session() y el cliente lo guarda en un archivo. En la próxima conexión se
+// carga con quiche_conn_set_session() antes del primer paquete: el handshake es
+// abreviado y, si el broker lo acepta, los datos escritos mientras
+// quiche_conn_is_in_early_data() es verdadero viajan en 0-RTT junto al Initial.
+// Si el ticket venció o el broker lo rechaza, quiche sigue con un handshake completo.
+
+#ifndef QUIC_SESSION_H
+#define QUIC_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <quiche.h>
+
+#define QUIC_SESSION_MAX 8192     // tamaño máximo de una sesión serializada
+
+// Carga la sesión guardada en 'path' en una conexión recién creada con quiche_connect().
+// Devuelve true si había una sesión válida (el handshake puede llevar 0-RTT).
+static bool quic_session_load(quiche_conn *conn, const char *path) {
+    if (!path) return false;
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    uint8_t buf[QUIC_SESSION_MAX];
+    size_t len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    return len > 0 && len < sizeof(buf) && quiche_conn_set_session(conn, buf, len) == 0;
+}
+
+// Guarda la sesión actual (si el broker ya envió un ticket). Escribe en un temporal y
+// lo renombra para no dejar un archivo a medias. Devuelve true si se guardó.
+static bool quic_session_save(const quiche_conn *conn, const char *path) {
+    if (!path) return false;
+    const uint8_t *buf = NULL;
+    size_t len = 0;
+    quiche_conn_session(conn, &buf, &len);
+    if (!buf || len == 0) return false;
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return false;
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return false;
+    bool ok = fwrite(buf, 1, len, f) == len;
+    ok = fclose(f) == 0 && ok;
+    return ok && rename(tmp, path) == 0;
+}
+
+#endif // QUIC_SESSION_H
@@ -0,0 +1,306 @@
+// sub_output.h - Salida de alto rendimiento para los suscriptores (UDP y TCP).
+//
+// Header "solo cabecera": se incluye desde subscriber_udp.c y subscriber_tcp.c.
+//
+// Modos:
+//   OUT_INTERACTIVE: printf() + fflush() por mensaje (comportamiento original).
+//   OUT_STDOUT:      las líneas se acumulan en un buffer grande y se escriben con write()
+//                    cuando se llena o cuando pasó el intervalo de vaciado.
+//   OUT_FILES:       un archivo <dir>/<tema>.log por tema, cada uno con su propio buffer.
+//   OUT_COUNT:       no escribe mensajes: cuenta mensajes y bytes por tema y, si el texto
+//                    empieza con "G <seq> <ns>" (publisher_udp -r/-n), mide la latencia
+//                    con el reloj de la máquina. Informa cada segundo y al terminar.
+
+#ifndef SUB_OUTPUT_H
+#define SUB_OUTPUT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OUT_STDOUT_BUF (1024 * 1024)   // buffer de stdout
+#define OUT_FILE_BUF (64 * 1024)       // buffer por archivo de tema
+#define OUT_MAX_TOPICS 256
+#define OUT_DEFAULT_FLUSH_MS 200
+#define OUT_REPORT_NS 1000000000ull
+#define OUT_LAT_BUCKETS 256            // histograma log2 con 4 sub-cubetas por potencia
+
+typedef enum { OUT_INTERACTIVE, OUT_STDOUT, OUT_FILES, OUT_COUNT } OutMode;
+
+typedef struct {
+    char name[128];
+    int fd;              // -1 en OUT_COUNT
+    char *buf;
+    size_t len, cap;
+    uint64_t msgs, bytes;
+} OutSink;
+
+typedef struct {
+    OutMode mode;
+    const char *dir;
+    uint64_t flush_ns;
+    uint64_t last_flush;
+    OutSink out;                       // stdout en OUT_STDOUT
+    OutSink topics[OUT_MAX_TOPICS];    // OUT_FILES y OUT_COUNT
+    int ntopics;
+    int last_hit;
+    // OUT_COUNT
+    uint64_t total, total_bytes, gen_msgs;
+    uint64_t window_start, window_msgs;
+    uint64_t lat_min, lat_max, lat_sum;
+    uint64_t lat_hist[OUT_LAT_BUCKETS];
+} SubOutput;
+
+static uint64_t out_mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void out_init(SubOutput *o, OutMode mode, const char *dir, int flush_ms) {
+    memset(o, 0, sizeof(*o));
+    o->mode = mode;
+    o->dir = dir;
+    o->flush_ns = (uint64_t)(flush_ms > 0 ? flush_ms : OUT_DEFAULT_FLUSH_MS) * 1000000ull;
+    o->last_flush = o->window_start = out_mono_ns();
+    o->lat_min = UINT64_MAX;
+    o->last_hit = -1;
+    o->out.fd = STDOUT_FILENO;
+    if (mode == OUT_STDOUT) {
+        o->out.buf = (char *)malloc(OUT_STDOUT_BUF);
+        o->out.cap = o->out.buf ? OUT_STDOUT_BUF : 0;
+    }
+    if (mode == OUT_FILES) mkdir(dir, 0755); // si ya existe, se usa tal cual
+}
+
+// Escribe todo el buffer de un destino (reintenta escrituras parciales).
+static void out_sink_flush(OutSink *s) {
+    size_t off = 0;
+    while (off < s->len) {
+        ssize_t w = write(s->fd, s->buf + off, s->len - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break; // disco lleno o stdout cerrado: se descarta lo pendiente
+        }
+        off += (size_t)w;
+    }
+    s->len = 0;
+}
+
+static void out_sink_append(OutSink *s, const char *p, size_t n) {
+    if (s->len + n > s->cap) out_sink_flush(s);
+    if (n > s->cap) { // no entra ni vacío: directo
+        ssize_t w = write(s->fd, p, n);
+        (void)w;
+        return;
+    }
+    memcpy(s->buf + s->len, p, n);
+    s->len += n;
+}
+
+// Busca (o crea) el destino de un tema. NULL si se superó OUT_MAX_TOPICS o no se pudo abrir.
+static OutSink *out_topic(SubOutput *o, const char *topic, size_t tlen) {
+    if (tlen >= sizeof(o->topics[0].name)) tlen = sizeof(o->topics[0].name) - 1;
+    if (o->last_hit >= 0) {
+        OutSink *s = &o->topics[o->last_hit];
+        if (strncmp(s->name, topic, tlen) == 0 && s->name[tlen] == '\0') return s;
+    }
+    for (int i = 0; i < o->ntopics; i++) {
+        if (strncmp(o->topics[i].name, topic, tlen) == 0 && o->topics[i].name[tlen] == '\0') {
+            o->last_hit = i;
+            return &o->topics[i];
+        }
+    }
+    if (o->ntopics == OUT_MAX_TOPICS) return NULL;
+    OutSink *s = &o->topics[o->ntopics];
+    memcpy(s->name, topic, tlen);
+    s->name[tlen] = '\0';
+    s->fd = -1;
+    if (o->mode == OUT_FILES) {
+        char path[512];
+        // '/' en el tema no debe escapar del directorio
+        char safe[sizeof(s->name)];
+        for (size_t i = 0; i <= tlen; i++) safe[i] = s->name[i] == '/' ? '_' : s->name[i];
+        snprintf(path, sizeof(path), "%s/%s.log", o->dir, safe);
+        s->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        s->buf = (char *)malloc(OUT_FILE_BUF);
+        if (s->fd < 0 || !s->buf) {
+            perror(path);
+            if (s->fd >= 0) close(s->fd);
+            free(s->buf);
+            return NULL;
+        }
+        s->cap = OUT_FILE_BUF;
+    }
+    o->last_hit = o->ntopics++;
+    return s;
+}
+
+// Latencia de un mensaje "G <seq> <ns_envío> ..." del generador de publisher_udp.
+static void out_latency(SubOutput *o, const char *text, size_t len) {
+    if (len < 4 || text[0] != 'G' || text[1] != ' ') return;
+    size_t i = 2;
+    while (i < len && text[i] >= '0' && text[i] <= '9') i++; // seq
+    if (i == 2 || i >= len || text[i] != ' ') return;
+    i++;
+    uint64_t sent = 0;
+    size_t start = i;
+    while (i < len && text[i] >= '0' && text[i] <= '9') sent = sent * 10 + (uint64_t)(text[i++] - '0');
+    if (i == start) return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    uint64_t lat = now > sent ? now - sent : 0;
+    o->gen_msgs++;
+    o->lat_sum += lat;
+    if (lat < o->lat_min) o->lat_min = lat;
+    if (lat > o->lat_max) o->lat_max = lat;
+    int b = 0;
+    if (lat >= 4) {
+        int lg = 63 - __builtin_clzll(lat);
+        b = lg * 4 + (int)((lat >> (lg - 2)) & 3);
+    } else {
+        b = (int)lat;
+    }
+    if (b >= OUT_LAT_BUCKETS) b = OUT_LAT_BUCKETS - 1;
+    o->lat_hist[b]++;
+}
+
+// Límite inferior del percentil 'p' (0..1) según el histograma, en ns.
+static uint64_t out_percentile(const SubOutput *o, double p) {
+    uint64_t want = (uint64_t)((double)o->gen_msgs * p), acc = 0;
+    for (int b = 0; b < OUT_LAT_BUCKETS; b++) {
+        acc += o->lat_hist[b];
+        if (acc > want) {
+            if (b < 4) return (uint64_t)b;
+            int lg = b / 4;
+            return (1ull << lg) + (uint64_t)(b % 4) * (1ull << (lg - 2));
+        }
+    }
+    return o->lat_max;
+}
+
+// Un mensaje recibido. En modo interactivo/stdout se imprime
+// "<prefijo><tema><sep><texto>\n"; en archivos va solo "<texto>\n" al archivo del tema.
+static void out_message(SubOutput *o, const char *prefix, const char *topic, size_t tlen,
+                        const char *sep, const char *text, size_t len) {
+    switch (o->mode) {
+    case OUT_INTERACTIVE:
+        printf("%s%.*s%s%.*s\n", prefix, (int)tlen, topic, sep, (int)len, text);
+        fflush(stdout);
+        break;
+    case OUT_STDOUT:
+        out_sink_append(&o->out, prefix, strlen(prefix));
+        out_sink_append(&o->out, topic, tlen);
+        out_sink_append(&o->out, sep, strlen(sep));
+        out_sink_append(&o->out, text, len);
+        out_sink_append(&o->out, "\n", 1);
+        break;
+    case OUT_FILES: {
+        OutSink *s = out_topic(o, topic, tlen);
+        if (!s) break;
+        out_sink_append(s, text, len);
+        out_sink_append(s, "\n", 1);
+        s->msgs++;
+        break;
+    }
+    case OUT_COUNT: {
+        OutSink *s = out_topic(o, topic, tlen);
+        if (s) {
+            s->msgs++;
+            s->bytes += len;
+        }
+        o->total++;
+        o->window_msgs++;
+        o->total_bytes += len;
+        out_latency(o, text, len);
+        break;
+    }
+    }
+}
+
+// Mensaje sin tema visible (UDP unicast sin -R/-m): se imprime "<prefijo><texto>\n";
+// 'topic' solo decide el archivo o el contador.
+static void out_raw(SubOutput *o, const char *prefix, const char *topic, const char *text, size_t len) {
+    if (o->mode == OUT_INTERACTIVE || o->mode == OUT_STDOUT) {
+        out_message(o, prefix, "", 0, "", text, len);
+    } else {
+        out_message(o, prefix, topic, strlen(topic), "", text, len);
+    }
+}
+
+static void out_flush(SubOutput *o) {
+    if (o->mode == OUT_STDOUT) out_sink_flush(&o->out);
+    if (o->mode == OUT_FILES) {
+        for (int i = 0; i < o->ntopics; i++) out_sink_flush(&o->topics[i]);
+    }
+    o->last_flush = out_mono_ns();
+}
+
+static void out_report(SubOutput *o, uint64_t now) {
+    double secs = (double)(now - o->window_start) / 1e9;
+    printf("[subscriber] %llu mensajes (%.0f msg/s)", (unsigned long long)o->total,
+           secs > 0 ? (double)o->window_msgs / secs : 0.0);
+    if (o->gen_msgs) {
+        printf(", latencia p50 %.1f us, p99 %.1f us, máx %.1f us", out_percentile(o, 0.50) / 1e3,
+               out_percentile(o, 0.99) / 1e3, o->lat_max / 1e3);
+    }
+    printf("\n");
+    fflush(stdout);
+    o->window_start = now;
+    o->window_msgs = 0;
+}
+
+// Milisegundos hasta el próximo vaciado o reporte (-1 = no hace falta despertar).
+static int out_timeout_ms(const SubOutput *o) {
+    if (o->mode == OUT_INTERACTIVE) return -1;
+    uint64_t due = o->mode == OUT_COUNT ? o->window_start + OUT_REPORT_NS : o->last_flush + o->flush_ns;
+    uint64_t now = out_mono_ns();
+    return due > now ? (int)((due - now + 999999) / 1000000) : 0;
+}
+
+// Llamar después de cada lote recibido y al despertar de poll().
+static void out_tick(SubOutput *o) {
+    if (o->mode == OUT_INTERACTIVE) return;
+    uint64_t now = out_mono_ns();
+    if (o->mode == OUT_COUNT) {
+        if (now - o->window_start >= OUT_REPORT_NS) out_report(o, now);
+    } else if (now - o->last_flush >= o->flush_ns) {
+        out_flush(o);
+    }
+}
+
+// Vacía todo, informa los totales (OUT_COUNT) y cierra los archivos.
+static void out_close(SubOutput *o) {
+    out_flush(o);
+    if (o->mode == OUT_COUNT) {
+        printf("[subscriber] Total: %llu mensajes, %llu bytes\n", (unsigned long long)o->total,
+               (unsigned long long)o->total_bytes);
+        for (int i = 0; i < o->ntopics; i++) {
+            printf("[subscriber]   '%s': %llu mensajes\n", o->topics[i].name,
+                   (unsigned long long)o->topics[i].msgs);
+        }
+        if (o->gen_msgs) {
+            printf("[subscriber] Latencia (%llu con marca de tiempo): mín %.1f us, media %.1f us, p50 %.1f us, "
+                   "p99 %.1f us, p99.9 %.1f us, máx %.1f us\n",
+                   (unsigned long long)o->gen_msgs, o->lat_min / 1e3, (double)o->lat_sum / (double)o->gen_msgs / 1e3,
+                   out_percentile(o, 0.50) / 1e3, out_percentile(o, 0.99) / 1e3, out_percentile(o, 0.999) / 1e3,
+                   o->lat_max / 1e3);
+        }
+    }
+    for (int i = 0; i < o->ntopics; i++) {
+        if (o->topics[i].fd >= 0) close(o->topics[i].fd);
+        free(o->topics[i].buf);
+    }
+    free(o->out.buf);
+}
+
+#endif // SUB_OUTPUT_H
@@ -5,7 +5,12 @@
 //     -I./quiche/quiche/include ./quiche/target/release/libquiche.a \
 //     -lssl -lcrypto -lpthread -ldl -lm -lrt
 // Ejecutar:
-//   ./subscriber_quic 127.0.0.1 4444 topic
+//   ./subscriber_quic [-s sesion.bin] 127.0.0.1 4444 topic[=urgencia] [topic2 ...]
+// Al completar el handshake envía "SUB <tema> <urgencia>\n" por cada tema en el stream 0;
+// con -s guarda el ticket de sesión y, al reconectar, manda los SUB en 0-RTT;
+// el broker abre un stream unidireccional por tema (urgencia 0 = máxima ... 7) y manda
+// por él líneas "<tema>: <texto>\n", o frames QUIC DATAGRAM "<tema>: <texto>" para
+// los temas que el broker entrega así (-D).
 // ------------------------------------------------------------
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,45 +19,122 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <stdbool.h>
 #include <inttypes.h>
 #include <quiche.h>
 
+#include "quic_session.h"
+#include "udp_gso.h"
+
 #define MAX_DATAGRAM_SIZE 1350
+#define MAX_LINE 4096
+#define DGRAM_QUEUE_LEN 1024
+#define DEFAULT_URGENCY 3
+#define MAX_STREAMS 128           // streams de temas abiertos por el broker (uno por SUB)
+
+// Línea en armado de cada stream: los datos de cada tema llegan en pedazos propios.
+typedef struct {
+    uint64_t sid;
+    size_t len;
+    char line[MAX_LINE];
+} StreamLine;
+
+static StreamLine lines[MAX_STREAMS];
+static int nlines = 0;
+
+static StreamLine *stream_line(uint64_t sid) {
+    for (int i = 0; i < nlines; i++) {
+        if (lines[i].sid == sid) return &lines[i];
+    }
+    if (nlines == MAX_STREAMS) return NULL;
+    lines[nlines].sid = sid;
+    lines[nlines].len = 0;
+    return &lines[nlines++];
+}
+
+#define KEEPALIVE_MS 10000        // PING sin tráfico, bien dentro del idle timeout del broker (30 s)
+
+static bool gso_enabled = false; // el kernel acepta UDP_SEGMENT en el socket
+
+static uint64_t mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
 
+// Vacía los paquetes pendientes; con GSO salen juntos en un solo sendmsg().
 static void pump_send(int sock, quiche_conn *c,
                       struct sockaddr_in *to, socklen_t to_len,
                       struct sockaddr_in *from, socklen_t from_len)
 {
-    uint8_t out[MAX_DATAGRAM_SIZE];
-
-    quiche_send_info s_info = {
-        .to      = (struct sockaddr *)to,
-        .to_len  = to_len,
-        .from    = (struct sockaddr *)from,
-        .from_len= from_len,
-    };
+    (void)from; (void)from_len;
+    static uint8_t out[UDP_GSO_MAX_BYTES];
+    struct iovec iov[UDP_GSO_MAX_SEGS];
+    size_t npkts = 0, used = 0;
 
     for (;;) {
-        ssize_t n = quiche_conn_send(c, out, sizeof(out), &s_info);
+        quiche_send_info s_info; // lo completa quiche
+        ssize_t n = quiche_conn_send(c, out + used, MAX_DATAGRAM_SIZE, &s_info);
         if (n == QUICHE_ERR_DONE) break;
         if (n < 0) {
             fprintf(stderr, "[subscriber] quiche_conn_send err=%zd\n", n);
             break;
         }
-        sendto(sock, out, n, 0, (struct sockaddr *)to, to_len);
+        iov[npkts].iov_base = out + used;
+        iov[npkts].iov_len = (size_t)n;
+        npkts++;
+        used += (size_t)n;
+        if (npkts == UDP_GSO_MAX_SEGS || used + MAX_DATAGRAM_SIZE > sizeof(out)) {
+            udp_send_batch(sock, &gso_enabled, iov, npkts, (struct sockaddr *)to, to_len);
+            npkts = used = 0;
+        }
+    }
+    if (npkts > 0) {
+        udp_send_batch(sock, &gso_enabled, iov, npkts, (struct sockaddr *)to, to_len);
+    }
+}
+
+// Envía "SUB <tema> <urgencia>\n" por cada argumento "tema[=urgencia]" en el stream 0
+// (en 0-RTT si 'early').
+static void send_subscriptions(quiche_conn *conn, char **topics, int ntopics, bool early) {
+    for (int i = 0; i < ntopics; i++) {
+        const char *eq = strchr(topics[i], '=');
+        int tlen = eq ? (int)(eq - topics[i]) : (int)strlen(topics[i]);
+        int urgency = eq ? atoi(eq + 1) : DEFAULT_URGENCY;
+        char sub[256];
+        int sl = snprintf(sub, sizeof(sub), "SUB %.*s %d\n", tlen, topics[i], urgency);
+        uint64_t err = 0;
+        if (sl > 0 && (size_t)sl < sizeof(sub) &&
+            quiche_conn_stream_send(conn, 0, (const uint8_t *)sub, (size_t)sl, false, &err) == sl) {
+            printf("[subscriber] Suscrito a '%.*s' (urgencia %d)%s\n", tlen, topics[i], urgency,
+                   early ? " (0-RTT)" : "");
+        }
     }
+    fflush(stdout);
 }
 
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s <host> <puerto> <topic>\n", argv[0]);
+    const char *session_file = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            session_file = optarg;
+        } else {
+            fprintf(stderr, "Uso: %s [-s sesion.bin] <host> <puerto> <topic>[=urgencia] [<topic2> ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 3) {
+        fprintf(stderr, "Uso: %s [-s sesion.bin] <host> <puerto> <topic>[=urgencia] [<topic2> ...]\n", argv[0]);
         return 1;
     }
 
-    const char *server_ip = argv[1];
-    int port = atoi(argv[2]);
-    const char *topic = argv[3];
+    const char *server_ip = argv[optind];
+    int port = atoi(argv[optind + 1]);
+    char **topics = &argv[optind + 2];
+    int ntopics = argc - optind - 2;
 
     // Crear socket UDP
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
@@ -66,6 +148,7 @@ int main(int argc, char **argv) {
         perror("bind");
         return 1;
     }
+    gso_enabled = udp_gso_probe(sock);
 
     struct sockaddr_in peer_addr = {0};
     peer_addr.sin_family = AF_INET;
@@ -89,6 +172,11 @@ int main(int argc, char **argv) {
     quiche_config_set_initial_max_stream_data_bidi_local(config, 5 * 1024 * 1024);
     quiche_config_set_initial_max_stream_data_bidi_remote(config, 5 * 1024 * 1024);
     quiche_config_set_initial_max_streams_bidi(config, 100);
+    // streams unidireccionales que abre el broker, uno por tema suscripto
+    quiche_config_set_initial_max_stream_data_uni(config, 5 * 1024 * 1024);
+    quiche_config_set_initial_max_streams_uni(config, MAX_STREAMS);
+    quiche_config_enable_dgram(config, true, DGRAM_QUEUE_LEN, DGRAM_QUEUE_LEN);
+    quiche_config_enable_early_data(config); // sin esto el ticket no habilita 0-RTT
 
     // ID de conexión local (random)
     uint8_t scid[16];
@@ -108,14 +196,60 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    printf("[subscriber] Conectando a %s:%d...\n", server_ip, port);
+
+    // Con una sesión guardada los SUB salen en 0-RTT, justo detrás del Initial. quiche
+    // recién entra en early data al generar el primer vuelo (ClientHello con el ticket),
+    // así que se decide después de enviarlo y se vuelve a mirar en cada vuelta.
+    bool subscribed = false;
+    bool session_saved = false;
+    quic_session_load(conn, session_file);
+
     // Inicializar handshake
     pump_send(sock, conn, &peer_addr, sizeof(peer_addr),
               &local_addr, sizeof(local_addr));
+    if (quiche_conn_is_in_early_data(conn)) {
+        send_subscriptions(conn, topics, ntopics, true);
+        subscribed = true;
+        pump_send(sock, conn, &peer_addr, sizeof(peer_addr),
+                  &local_addr, sizeof(local_addr));
+    }
 
-    printf("[subscriber] Conectando a %s:%d...\n", server_ip, port);
 
-    // Bucle principal
+    // Bucle principal: poll() con el timer de quiche (pérdidas, ACK, inactividad) y el del
+    // keepalive; en un tema sin mensajes, un PING cada KEEPALIVE_MS evita que el broker
+    // cierre la conexión por inactividad y, si se cierra igual, el timer lo detecta.
+    uint64_t next_ping = mono_ms() + KEEPALIVE_MS;
     for (;;) {
+        uint64_t now = mono_ms();
+        if (now >= next_ping) {
+            if (quiche_conn_is_established(conn)) {
+                quiche_conn_send_ack_eliciting(conn);
+                pump_send(sock, conn, &peer_addr, sizeof(peer_addr),
+                          &local_addr, sizeof(local_addr));
+            }
+            next_ping = now + KEEPALIVE_MS;
+        }
+        uint64_t wait = quiche_conn_timeout_as_millis(conn);
+        if (wait > next_ping - now) wait = next_ping - now;
+        struct pollfd pfd = { .fd = sock, .events = POLLIN };
+        int pr = poll(&pfd, 1, (int)wait);
+        if (pr < 0) {
+            if (errno == EINTR) continue;
+            perror("[subscriber] poll");
+            break;
+        }
+        if (pr == 0) {
+            quiche_conn_on_timeout(conn);
+            pump_send(sock, conn, &peer_addr, sizeof(peer_addr),
+                      &local_addr, sizeof(local_addr));
+            if (quiche_conn_is_closed(conn)) {
+                fprintf(stderr, "[subscriber] Conexión cerrada.\n");
+                break;
+            }
+            continue;
+        }
+
         // Recibir datagrama
         uint8_t buf[MAX_DATAGRAM_SIZE];
         struct sockaddr_in recv_addr;
@@ -142,7 +276,17 @@ int main(int argc, char **argv) {
             continue;
         }
 
-        // Verificar si handshake completado
+        // Verificar si handshake completado (o si recién ahora se puede usar 0-RTT)
+        if (!subscribed && (quiche_conn_is_established(conn) || quiche_conn_is_in_early_data(conn))) {
+            send_subscriptions(conn, topics, ntopics, !quiche_conn_is_established(conn));
+            subscribed = true;
+        }
+        // El ticket llega después del handshake; se guarda en cuanto está disponible.
+        if (!session_saved && quiche_conn_is_established(conn) && quic_session_save(conn, session_file)) {
+            session_saved = true;
+            printf("[subscriber] Sesión guardada en %s%s\n", session_file,
+                   quiche_conn_is_resumed(conn) ? " (conexión reanudada)" : "");
+        }
         if (quiche_conn_is_established(conn)) {
             // ✅ Leer streams legibles
             quiche_stream_iter *it = quiche_conn_readable(conn);
@@ -162,11 +306,31 @@ int main(int argc, char **argv) {
                         break;
                     }
 
-                    printf("[subscriber] Mensaje recibido (sid=%" PRIu64 "): %.*s\n",
-                           sid, (int)got, (char *)sbuf);
+                    // El stream trae líneas "<tema>: <texto>\n" en pedazos arbitrarios.
+                    StreamLine *sl = stream_line(sid);
+                    if (!sl) continue;
+                    for (ssize_t k = 0; k < got; k++) {
+                        if (sbuf[k] == '\n') {
+                            printf("[subscriber] Mensaje recibido (sid=%" PRIu64 "): %.*s\n",
+                                   sid, (int)sl->len, sl->line);
+                            sl->len = 0;
+                        } else if (sl->len < sizeof(sl->line)) {
+                            sl->line[sl->len++] = (char)sbuf[k];
+                        }
+                    }
+                    fflush(stdout);
                 }
             }
             quiche_stream_iter_free(it);
+
+            // Frames DATAGRAM: cada uno es un mensaje completo (puede faltar alguno).
+            for (;;) {
+                uint8_t dbuf[MAX_DATAGRAM_SIZE];
+                ssize_t got = quiche_conn_dgram_recv(conn, dbuf, sizeof(dbuf));
+                if (got < 0) break; // QUICHE_ERR_DONE: no hay más
+                printf("[subscriber] Datagrama recibido: %.*s\n", (int)got, (char *)dbuf);
+            }
+            fflush(stdout);
         }
 
         // Bombear ACKs y ventana de flujo
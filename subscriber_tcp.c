@@ -2,12 +2,22 @@
 // Envia una línea "SUB <tema>" por cada argumento recibido.
 //
 // Compilación: gcc -Wall -Wextra -O2 -o subscriber_tcp subscriber_tcp.c
-// Uso:         ./subscriber_tcp <host> <puerto> <tema1> [<tema2> ...]
+// Uso:         ./subscriber_tcp [-o destino | -c] [-F ms] <host> <puerto> <tema1> [<tema2> ...]
+//              ./subscriber_tcp -C mapa.txt [...] <tema1> [<tema2> ...]
 // Ejemplo:     ./subscriber_tcp 127.0.0.1 5555 "Partido_AvsB" "Partido_CvsD"
+//
+// Con -C (cluster_map.h) cada tema se pide al broker dueño: una conexión por broker
+// dueño de algún tema. Si el mapa cambia, los temas que cambian de dueño se piden al
+// nuevo y se cierran las conexiones que quedaron sin temas.
+//
+// Lectura: recv() de bloques grandes y corte por '\n' en memoria (no un recv() por byte).
+// Salida: por defecto una línea por mensaje con fflush(); con -o/-c ver sub_output.h.
 
 #include <arpa/inet.h>      // Provee funciones para manipular direcciones IP, como inet_ntop() que convierte IPs de binario a texto.
 #include <errno.h>          // Permite el manejo de errores a través de la variable 'errno' y constantes como EINTR.
 #include <netinet/in.h>     // Define la estructura 'sockaddr_in' y constantes necesarias para la programación de sockets de Internet.
+#include <poll.h>           // poll(): espera datos como máximo hasta el próximo vaciado de la salida.
+#include <signal.h>         // SIGINT: vaciar los buffers de salida e informar antes de salir.
 #include <stdbool.h>        // Define el tipo de dato booleano 'bool' y los valores 'true' y 'false'.
 #include <stdio.h>          // Librería estándar de Entrada/Salida para funciones como printf(), fprintf() y sscanf().
 #include <stdlib.h>         // Librería estándar que provee funciones de gestión de memoria (calloc, free) y conversión de tipos (atoi).
@@ -15,28 +25,43 @@
 #include <sys/socket.h>     // Contiene las definiciones y estructuras principales para la API de sockets (socket(), bind(), sendto(), recvfrom()).
 #include <unistd.h>         // Provee acceso a la API del sistema operativo POSIX, incluyendo la función close() para cerrar descriptores de archivo.
 
+#include "cluster_map.h"    // -C: tema -> broker dueño por hashing consistente.
+#include "sub_output.h"     // Salida con buffer grande, archivos por tema o solo conteo (-o/-c).
 
 #define MAX_LINE 4096
+#define RX_BUF (256 * 1024)    // bytes por recv(): muchas líneas por llamada
 
-// Lee una línea terminada en '\n'; 1: ok, 0: peer cerró, -1: error.
-static int read_line(int fd, char *out, size_t maxlen) {
-    size_t i = 0;
-    while (i + 1 < maxlen) {
-        char c;
-        ssize_t n = recv(fd, &c, 1, 0);
-        if (n == 0) return 0;          // conexión cerrada
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            return -1;
-        }
-        if (c == '\n') {
-            out[i] = '\0';
-            return 1;
-        }
-        out[i++] = c;
+// Conexión con un broker (sin -C hay una sola).
+typedef struct {
+    struct sockaddr_in addr;
+    char name[128];
+    int fd;                    // -1 = cerrada
+    char *rx;                  // buffer de recepción (RX_BUF bytes)
+    size_t have;
+} BrokerConn;
+
+static BrokerConn conns[CLUSTER_MAX_NODES];
+static int nconns = 0;
+static int *topic_conn;        // conexión por la que llega cada tema
+static char **topics;
+static int ntopics;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_sigint(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+// Entrega una línea "<tema>: <texto>" (sin '\n') a la salida.
+static void deliver_line(SubOutput *out, const char *line, size_t len) {
+    const char *colon = (const char *)memchr(line, ':', len);
+    if (colon && (size_t)(colon - line) + 1 < len && colon[1] == ' ') {
+        size_t tlen = (size_t)(colon - line);
+        out_message(out, "[mensaje] ", line, tlen, ": ", colon + 2, len - tlen - 2);
+    } else {
+        out_raw(out, "[mensaje] ", "mensajes", line, len);
     }
-    out[maxlen - 1] = '\0';
-    return 1;
 }
 
 // Envío confiable de buffers.
@@ -55,57 +80,234 @@ static ssize_t send_all(int fd, const void *buf, size_t len) {
     return (ssize_t)sent;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 4) {
-        fprintf(stderr, "Uso: %s <host> <puerto> <tema1> [<tema2> ...]\n", argv[0]);
-        return 1;
+// Devuelve la conexión abierta con 'addr' o abre una nueva. -1 si no se pudo.
+static int conn_open(const struct sockaddr_in *addr, const char *name) {
+    int slot = -1;
+    for (int c = 0; c < nconns; c++) {
+        if (conns[c].fd >= 0 && cluster_same_addr(&conns[c].addr, addr)) return c;
+    }
+    for (int c = 0; c < nconns && slot < 0; c++) {
+        bool used = conns[c].fd >= 0;
+        for (int t = 0; t < ntopics && !used; t++) used = topic_conn[t] == c;
+        if (!used) slot = c;
+    }
+    if (slot < 0) {
+        if (nconns == CLUSTER_MAX_NODES) return -1;
+        slot = nconns++;
+        conns[slot].fd = -1;
+        conns[slot].rx = NULL;
+    }
+    BrokerConn *bc = &conns[slot];
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
     }
+    if (!bc->rx && !(bc->rx = (char *)malloc(RX_BUF))) {
+        close(fd);
+        return -1;
+    }
+    bc->fd = fd;
+    bc->addr = *addr;
+    bc->have = 0;
+    snprintf(bc->name, sizeof(bc->name), "%s", name);
+    return slot;
+}
 
-    const char *host = argv[1];
-    int port = atoi(argv[2]);
+// Envía "SUB <tema>" por la conexión 'c'.
+static int subscribe(int c, const char *topic) {
+    char first[MAX_LINE];
+    int n = snprintf(first, sizeof(first), "SUB %s\n", topic);
+    if (send_all(conns[c].fd, first, (size_t)n) < 0) {
+        perror("send");
+        return -1;
+    }
+    return 0;
+}
 
-    // Crear socket y conectar al broker.
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) { perror("socket"); return 1; }
+static void conn_close(int c) {
+    close(conns[c].fd);
+    conns[c].fd = -1;
+}
 
-    struct sockaddr_in addr = {0};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons((uint16_t)port);
-    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
-        perror("inet_pton");
-        return 1;
+// Con -C: pide cada tema que cambió de dueño al broker nuevo y cierra las conexiones
+// que quedaron sin temas.
+static void remap(const ClusterMap *map) {
+    for (int t = 0; t < ntopics; t++) {
+        const ClusterNode *owner = cluster_map_owner(map, topics[t]);
+        if (topic_conn[t] >= 0 && cluster_same_addr(&conns[topic_conn[t]].addr, &owner->addr)) continue;
+        int c = conn_open(&owner->addr, owner->name);
+        if (c < 0 || subscribe(c, topics[t]) < 0) continue; // se reintenta en el próximo cambio
+        topic_conn[t] = c;
+        printf("[subscriber] Mapa actualizado: '%s' ahora en %s\n", topics[t], owner->name);
     }
+    for (int c = 0; c < nconns; c++) {
+        bool used = false;
+        for (int t = 0; t < ntopics && !used; t++) used = topic_conn[t] == c;
+        if (!used && conns[c].fd >= 0) conn_close(c);
+    }
+    fflush(stdout);
+}
 
-    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("connect");
+// Lee lo disponible en la conexión 'c' y entrega las líneas completas: cada recv() trae
+// todas las líneas "<tema>: <texto>\n" disponibles; una línea incompleta al final queda
+// al principio del buffer para el próximo recv(). Devuelve false si se cerró.
+static bool conn_read(int c, SubOutput *out) {
+    BrokerConn *bc = &conns[c];
+    ssize_t n = recv(bc->fd, bc->rx + bc->have, RX_BUF - bc->have, 0);
+    if (n == 0) return false;          // conexión cerrada
+    if (n < 0) {
+        if (errno == EINTR) return true;
+        perror("recv");
+        return false;
+    }
+    bc->have += (size_t)n;
+
+    size_t start = 0;
+    for (;;) {
+        char *nl = (char *)memchr(bc->rx + start, '\n', bc->have - start);
+        if (!nl) break;
+        size_t len = (size_t)(nl - (bc->rx + start));
+        if (len > MAX_LINE - 1) len = MAX_LINE - 1; // mismo límite que antes
+        deliver_line(out, bc->rx + start, len);
+        start = (size_t)(nl - bc->rx) + 1;
+    }
+    if (start == 0 && bc->have == RX_BUF) {
+        deliver_line(out, bc->rx, MAX_LINE - 1); // línea absurdamente larga: se corta
+        bc->have = 0;
+    } else if (start > 0) {
+        memmove(bc->rx, bc->rx + start, bc->have - start);
+        bc->have -= start;
+    }
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-o destino | -c] [-F ms] [-C mapa] <host> <puerto> <tema1> [<tema2> ...]\n", prog);
+    fprintf(stderr, "  -o  salida con buffer: '-' = stdout, si no un directorio con un archivo <tema>.log por tema\n");
+    fprintf(stderr, "  -c  solo contar mensajes (y latencia si el texto es 'G <seq> <ns> ...')\n");
+    fprintf(stderr, "  -F  intervalo máximo entre vaciados de la salida con buffer (por defecto %d ms)\n",
+            OUT_DEFAULT_FLUSH_MS);
+    fprintf(stderr, "  -C  mapa del clúster (cluster_map.h): cada tema se pide a su broker; sin <host> <puerto>\n");
+}
+
+int main(int argc, char **argv) {
+    OutMode out_mode = OUT_INTERACTIVE;
+    const char *out_dir = NULL;
+    int flush_ms = OUT_DEFAULT_FLUSH_MS;
+    const char *map_path = NULL;
+    ClusterMap map;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:cF:C:")) != -1) {
+        switch (opt) {
+        case 'o':
+            out_mode = strcmp(optarg, "-") == 0 ? OUT_STDOUT : OUT_FILES;
+            out_dir = optarg;
+            break;
+        case 'c': out_mode = OUT_COUNT; break;
+        case 'F': flush_ms = atoi(optarg); break;
+        case 'C': map_path = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    int first_topic = optind + (map_path ? 0 : 2);
+    if (argc - first_topic < 1) {
+        usage(argv[0]);
         return 1;
     }
+    topics = &argv[first_topic];
+    ntopics = argc - first_topic;
+    topic_conn = (int *)malloc((size_t)ntopics * sizeof(int));
+    if (!topic_conn) { perror("malloc"); return 1; }
+    for (int t = 0; t < ntopics; t++) topic_conn[t] = -1;
 
-    // Enviar una línea SUB por cada tema (permite múltiples suscripciones).
-    for (int i = 3; i < argc; i++) {
-        char first[MAX_LINE];
-        int n = snprintf(first, sizeof(first), "SUB %s\n", argv[i]);
-        if (send_all(fd, first, (size_t)n) < 0) {
-            perror("send");
-            close(fd);
+    if (map_path) {
+        // Un SUB por tema al broker dueño (una conexión por broker).
+        if (cluster_map_load(&map, map_path) != 0) return 1;
+        for (int t = 0; t < ntopics; t++) {
+            const ClusterNode *owner = cluster_map_owner(&map, topics[t]);
+            int c = conn_open(&owner->addr, owner->name);
+            if (c < 0 || subscribe(c, topics[t]) < 0) return 1;
+            topic_conn[t] = c;
+            printf("[subscriber] Suscrito a '%s' en %s\n", topics[t], owner->name);
+        }
+    } else {
+        // Crear socket y conectar al broker.
+        const char *host = argv[optind];
+        int port = atoi(argv[optind + 1]);
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
+            perror("inet_pton");
             return 1;
         }
-        printf("[subscriber] Suscrito a '%s'\n", argv[i]);
+        int c = conn_open(&addr, host);
+        if (c < 0) return 1;
+
+        // Enviar una línea SUB por cada tema (permite múltiples suscripciones).
+        for (int t = 0; t < ntopics; t++) {
+            if (subscribe(c, topics[t]) < 0) {
+                conn_close(c);
+                return 1;
+            }
+            topic_conn[t] = c;
+            printf("[subscriber] Suscrito a '%s'\n", topics[t]);
+        }
     }
 
     printf("[subscriber] Esperando mensajes...\n");
+    fflush(stdout);
+
+    SubOutput out;
+    out_init(&out, out_mode, out_dir, flush_ms);
+    struct sigaction sa = {0};
+    sa.sa_handler = on_sigint; // sin SA_RESTART: poll() vuelve con EINTR
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
 
-    // Bucle de lectura de mensajes reenviados por el broker.
-    char line[MAX_LINE];
-    while (1) {
-        int r = read_line(fd, line, sizeof(line));
-        if (r <= 0) break;                 // desconexión o error
-        printf("[mensaje] %s\n", line);    // formato "<tema>: <texto>"
-        fflush(stdout);
+    while (!stop) {
+        struct pollfd pfds[CLUSTER_MAX_NODES];
+        int idx[CLUSTER_MAX_NODES];
+        int npfds = 0;
+        for (int c = 0; c < nconns; c++) {
+            if (conns[c].fd < 0) continue;
+            pfds[npfds].fd = conns[c].fd;
+            pfds[npfds].events = POLLIN;
+            pfds[npfds].revents = 0;
+            idx[npfds++] = c;
+        }
+        if (npfds == 0) break;         // no queda ninguna conexión
+        int timeout = out_timeout_ms(&out);
+        if (map_path && (timeout < 0 || timeout > CLUSTER_RELOAD_MS)) timeout = CLUSTER_RELOAD_MS;
+        int pr = poll(pfds, (nfds_t)npfds, timeout);
+        out_tick(&out);
+        if (pr < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (map_path && cluster_map_reload(&map)) remap(&map);
+        if (pr <= 0) continue;
+
+        for (int p = 0; p < npfds; p++) {
+            int c = idx[p];
+            if (!(pfds[p].revents & (POLLIN | POLLHUP | POLLERR)) || conns[c].fd != pfds[p].fd) continue;
+            if (!conn_read(c, &out)) {
+                if (map_path) printf("[subscriber] Conexión con %s cerrada.\n", conns[c].name);
+                conn_close(c);
+            }
+        }
     }
 
+    out_close(&out);
     printf("[subscriber] Conexión cerrada.\n");
-    close(fd);
+    for (int c = 0; c < nconns; c++) {
+        if (conns[c].fd >= 0) close(conns[c].fd);
+        free(conns[c].rx);
+    }
+    free(topic_conn);
+    if (map_path) cluster_map_free(&map);
     return 0;
 }
-
@@ -1,46 +1,74 @@
+#define _GNU_SOURCE         // recvmmsg() y struct mmsghdr.
 #include <arpa/inet.h>      // Provee funciones para manipular direcciones IP, como inet_pton() que convierte IPs de texto a binario.
 #include <errno.h>          // Permite el manejo de errores a través de la variable 'errno'.
 #include <netinet/in.h>     // Define la estructura 'sockaddr_in' y constantes para sockets de Internet (ej. AF_INET).
+#include <poll.h>           // poll(): espera mensajes con un tiempo límite para renovar las suscripciones.
+#include <signal.h>         // SIGINT: vaciar los buffers de salida e informar antes de salir.
 #include <stdbool.h>        // Define el tipo de dato booleano 'bool' y los valores 'true' y 'false'.
 #include <stdio.h>          // Librería estándar de Entrada/Salida para funciones como printf() y fprintf().
 #include <stdlib.h>         // Librería estándar que provee funciones para conversión de tipos (atoi) y salida del programa (exit).
 #include <string.h>         // Provee funciones para la manipulación de cadenas de caracteres, como strlen() y snprintf().
 #include <sys/socket.h>     // Contiene las definiciones principales para la API de sockets, como socket(), sendto() y recvfrom().
+#include <time.h>           // clock_gettime() para programar los latidos (SUB periódicos).
 #include <unistd.h>         // Provee acceso a la API del sistema operativo POSIX, incluyendo la función close() para cerrar el socket.
 
+#include "cluster_map.h"    // -C: tema -> broker dueño por hashing consistente.
+#include "sub_output.h"     // Salida con buffer grande, archivos por tema o solo conteo (-o/-c).
+
 #define MAX_LINE 4096
+#define DEFAULT_HEARTBEAT_S 10 // el broker vence las suscripciones a los 30 s por defecto
+#define MAX_GAPS 64            // huecos de secuencia pendientes por tema (-R)
+#define NAK_DELAY_MS 10        // espera mínima por si el hueco es solo reordenamiento
+#define NAK_RETRY_MS 100       // reintento de NAK si la retransmisión no llegó
+#define NAK_MAX_TRIES 5        // después se da el hueco por perdido
+#define MAX_MCAST_SOCKS 8      // un socket por puerto multicast distinto
+#define MAX_GROUPS 64          // grupos multicast a los que se puede unir
+#define RX_BATCH 64            // datagramas por recvmmsg()
 
-int main(int argc, char **argv) {
-    if (argc < 4) {
-        fprintf(stderr, "Uso: %s <host> <puerto> <tema1> [<tema2> ...]\n", argv[0]);
-        return 1;
-    }
+// Rango de números de secuencia faltantes [from, to], cuántos NAK se enviaron y
+// cuándo se detectó.
+typedef struct {
+    unsigned long long from, to;
+    int tries;
+    long long since;
+} Gap;
 
-    const char *host = argv[1];
-    int port = atoi(argv[2]);
+// Estado de recepción confiable de un tema (-R).
+typedef struct {
+    const char *name;
+    bool synced;                   // ya se conoce la secuencia (por SEQ o por el primer DAT)
+    unsigned long long next;       // próximo número de secuencia esperado
+    Gap gaps[MAX_GAPS];
+    size_t ngaps;
+    long long nak_due;             // cuándo enviar el próximo NAK (0 = nada pendiente)
+    double reorder_ms, reorder_var; // demora media (y su desvío) de los huecos que se llenan solos
+    unsigned long long recovered, reordered, lost;
+} TopicState;
 
-    // Crear socket UDP
-    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("socket");
-        return 1;
-    }
+static SubOutput out;                   // destino de los mensajes recibidos
+static int nak_delay_ms = -1;           // -N: espera fija antes del primer NAK (-1 = adaptativa)
+static volatile sig_atomic_t stop = 0;
 
-    // Configurar la dirección del broker
-    struct sockaddr_in broker_addr = {0};
-    broker_addr.sin_family = AF_INET;
-    broker_addr.sin_port = htons((uint16_t)port);
-    if (inet_pton(AF_INET, host, &broker_addr.sin_addr) <= 0) {
-        perror("inet_pton: Dirección de host inválida");
-        close(sockfd);
-        return 1;
-    }
+static void on_sigint(int sig) {
+    (void)sig;
+    stop = 1;
+}
 
-    // Enviar solicitudes de suscripción para cada tópico recibido por línea de comandos
-    for (int i = 3; i < argc; i++) {
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Envía "SUB <tema>" para cada tema a su broker (dests[i]; sin -C todos iguales). Se usa
+// para suscribirse y, periódicamente, como latido que renueva la concesión en el broker.
+static int send_subscriptions(int sockfd, const struct sockaddr_in *dests,
+                              char **topics, int ntopics) {
+    for (int i = 0; i < ntopics; i++) {
+        const struct sockaddr_in *broker_addr = &dests[i];
         char sub_message[MAX_LINE];
         // snprintf() construye el comando SUB de forma segura
-        int n = snprintf(sub_message, sizeof(sub_message), "SUB %s", argv[i]);
+        int n = snprintf(sub_message, sizeof(sub_message), "SUB %s", topics[i]);
 
         // sendto() envía un datagrama UDP al broker
         // - sockfd: descriptor del socket UDP
@@ -50,42 +78,493 @@ int main(int argc, char **argv) {
         // - broker_addr: dirección del broker
         // - sizeof(): tamaño de la estructura sockaddr_in
         if (sendto(sockfd, sub_message, (size_t)n, 0,
-                   (const struct sockaddr *)&broker_addr, sizeof(broker_addr)) < 0) {
+                   (const struct sockaddr *)broker_addr, sizeof(*broker_addr)) < 0) {
             perror("sendto: no se pudo enviar la suscripción");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Modo multicast: el broker responde a SUB con "MCAST <tema> <grupo> <puerto>" y
+// el suscriptor se une al grupo; los datos llegan como "MSG <tema> <texto>" (o DAT con -R).
+typedef struct {
+    int fd;
+    uint16_t port;
+} McastSock;
+
+static McastSock msocks[MAX_MCAST_SOCKS];
+static int nmsocks = 0;
+static struct sockaddr_in joined[MAX_GROUPS];
+static int njoined = 0;
+static struct in_addr mcast_if;         // -i: interfaz por la que unirse (INADDR_ANY = según rutas)
+
+// Socket ligado al puerto multicast 'port' (se crea la primera vez).
+static int mcast_socket(uint16_t port) {
+    for (int i = 0; i < nmsocks; i++) {
+        if (msocks[i].port == port) return msocks[i].fd;
+    }
+    if (nmsocks == MAX_MCAST_SOCKS) return -1;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)); // varios suscriptores por host
+#ifdef IP_MULTICAST_ALL
+    int no = 0;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &no, sizeof(no)); // solo los grupos propios
+#endif
+    struct sockaddr_in local = {0};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind multicast");
+        close(fd);
+        return -1;
+    }
+    msocks[nmsocks].fd = fd;
+    msocks[nmsocks].port = port;
+    nmsocks++;
+    return fd;
+}
+
+// Se une al grupo indicado por el broker (una sola vez por grupo y puerto).
+static void join_group(const char *topic, const char *group, unsigned port) {
+    struct sockaddr_in g = {0};
+    if (inet_pton(AF_INET, group, &g.sin_addr) != 1 || port == 0 || port > 65535) return;
+    g.sin_port = htons((uint16_t)port);
+    for (int i = 0; i < njoined; i++) {
+        if (joined[i].sin_addr.s_addr == g.sin_addr.s_addr && joined[i].sin_port == g.sin_port) return;
+    }
+    if (njoined == MAX_GROUPS) return;
+    int fd = mcast_socket((uint16_t)port);
+    if (fd < 0) return;
+    struct ip_mreq mreq;
+    mreq.imr_multiaddr = g.sin_addr;
+    mreq.imr_interface = mcast_if;
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 && errno != EADDRINUSE) {
+        perror("IP_ADD_MEMBERSHIP");
+        return;
+    }
+    joined[njoined++] = g;
+    printf("[subscriber] '%s' se recibe por multicast en %s:%u\n", topic, group, port);
+}
+
+static TopicState *find_state(TopicState *st, int ntopics, const char *name) {
+    for (int i = 0; i < ntopics; i++) {
+        if (strcmp(st[i].name, name) == 0) return &st[i];
+    }
+    return NULL;
+}
+
+// Espera antes del primer NAK de un hueco. Sin -N se adapta al reordenamiento observado
+// (media + 4 desvíos de lo que tardan en llenarse solos los huecos), entre NAK_DELAY_MS y
+// NAK_RETRY_MS, para no pedir lo que igual iba a llegar.
+static long long nak_delay(const TopicState *ts) {
+    if (nak_delay_ms >= 0) return nak_delay_ms;
+    double d = ts->reorder_ms + 4 * ts->reorder_var;
+    if (d < NAK_DELAY_MS) d = NAK_DELAY_MS;
+    if (d > NAK_RETRY_MS) d = NAK_RETRY_MS;
+    return (long long)d;
+}
+
+// Registra el hueco [from, to]. Si no hay lugar, el más viejo se da por perdido.
+static void gap_add(TopicState *ts, unsigned long long from, unsigned long long to) {
+    if (ts->ngaps == MAX_GAPS) {
+        ts->lost += ts->gaps[0].to - ts->gaps[0].from + 1;
+        memmove(&ts->gaps[0], &ts->gaps[1], (MAX_GAPS - 1) * sizeof(Gap));
+        ts->ngaps--;
+    }
+    ts->gaps[ts->ngaps].from = from;
+    ts->gaps[ts->ngaps].to = to;
+    ts->gaps[ts->ngaps].tries = 0;
+    ts->gaps[ts->ngaps].since = now_ms();
+    ts->ngaps++;
+    if (ts->nak_due == 0) ts->nak_due = ts->gaps[ts->ngaps - 1].since + nak_delay(ts);
+}
+
+// Quita [from, to] de los huecos. Devuelve cuántos números estaban pendientes; si 'hit'
+// no es NULL, recibe una copia del (último) hueco afectado, antes de modificarlo.
+static unsigned long long gap_remove(TopicState *ts, unsigned long long from, unsigned long long to,
+                                     Gap *hit) {
+    unsigned long long removed = 0;
+    for (size_t i = 0; i < ts->ngaps; i++) {
+        Gap *g = &ts->gaps[i];
+        if (to < g->from || from > g->to) continue;
+        if (hit) *hit = *g;
+        unsigned long long lo = from > g->from ? from : g->from;
+        unsigned long long hi = to < g->to ? to : g->to;
+        removed += hi - lo + 1;
+        if (lo == g->from && hi == g->to) {            // el hueco desaparece
+            memmove(g, g + 1, (ts->ngaps - i - 1) * sizeof(Gap));
+            ts->ngaps--;
+            i--;
+        } else if (lo == g->from) {
+            g->from = hi + 1;
+        } else if (hi == g->to) {
+            g->to = lo - 1;
+        } else if (ts->ngaps < MAX_GAPS) {               // queda partido en dos
+            memmove(g + 2, g + 1, (ts->ngaps - i - 1) * sizeof(Gap));
+            g[1].from = hi + 1;
+            g[1].to = g->to;
+            g[1].tries = g->tries;
+            g[1].since = g->since;
+            g->to = lo - 1;
+            ts->ngaps++;
+            i++;
+        } else {
+            ts->lost += g->to - hi;                      // sin lugar: se resigna la parte alta
+            g->to = lo - 1;
+        }
+    }
+    if (ts->ngaps == 0) ts->nak_due = 0;
+    return removed;
+}
+
+// Envía "NAK <tema> a-b,c-d,..." con los huecos pendientes y descarta los que
+// ya agotaron sus reintentos.
+static void send_nak(int sockfd, const struct sockaddr_in *broker_addr, TopicState *ts) {
+    char line[MAX_LINE];
+    int n = snprintf(line, sizeof(line), "NAK %s ", ts->name);
+    for (size_t i = 0; i < ts->ngaps; i++) {
+        Gap *g = &ts->gaps[i];
+        if (g->tries >= NAK_MAX_TRIES) {
+            unsigned long long cnt = g->to - g->from + 1;
+            ts->lost += cnt;
+            printf("[subscriber] '%s': %llu mensaje(s) perdido(s) definitivamente (%llu-%llu)\n",
+                   ts->name, cnt, g->from, g->to);
+            memmove(g, g + 1, (ts->ngaps - i - 1) * sizeof(Gap));
+            ts->ngaps--;
+            i--;
+            continue;
+        }
+        int w = snprintf(line + n, sizeof(line) - (size_t)n, "%s%llu-%llu",
+                         (line[n - 1] == ' ') ? "" : ",", g->from, g->to);
+        if (w < 0 || (size_t)(n + w) >= sizeof(line)) break; // el resto va en el próximo NAK
+        n += w;
+        g->tries++;
+    }
+    if (line[n - 1] != ' ') {
+        sendto(sockfd, line, (size_t)n, 0, (const struct sockaddr *)broker_addr, sizeof(*broker_addr));
+    }
+    ts->nak_due = ts->ngaps ? now_ms() + NAK_RETRY_MS : 0;
+}
+
+// Procesa un datagrama en modo confiable. Devuelve false si no era del protocolo.
+static bool handle_reliable(TopicState *st, int ntopics, char *buffer) {
+    char topic[128];
+    unsigned long long seq, a, b;
+    int off = 0;
+    Gap hit;
+
+    if (sscanf(buffer, "DAT %llu %127s %n", &seq, topic, &off) == 2 && off > 0) {
+        TopicState *ts = find_state(st, ntopics, topic);
+        if (!ts) return true;
+        if (!ts->synced) {
+            ts->synced = true;
+            ts->next = seq + 1;
+        } else if (seq >= ts->next) {
+            if (seq > ts->next) gap_add(ts, ts->next, seq - 1);
+            ts->next = seq + 1;
+        } else if (gap_remove(ts, seq, seq, &hit) > 0) {
+            if (hit.tries > 0) {
+                ts->recovered++;        // llegó después de pedirlo: retransmisión (o muy tarde)
+            } else {
+                ts->reordered++;        // llegó solo, antes del NAK: era reordenamiento
+                double d = (double)(now_ms() - hit.since);
+                double err = d - ts->reorder_ms;
+                ts->reorder_ms += err / 8;
+                ts->reorder_var += ((err < 0 ? -err : err) - ts->reorder_var) / 4;
+            }
+        } else {
+            return true; // duplicado: ya se había entregado
+        }
+        char sep[32];
+        snprintf(sep, sizeof(sep), " #%llu: ", seq);
+        out_message(&out, "🔔 [mensaje] ", topic, strlen(topic), sep, buffer + off, strlen(buffer + off));
+        return true;
+    }
+    if (sscanf(buffer, "SEQ %127s %llu", topic, &seq) == 2) {
+        TopicState *ts = find_state(st, ntopics, topic);
+        if (!ts) return true;
+        if (!ts->synced) {
+            ts->synced = true;          // se empieza desde el próximo mensaje, sin historial
+            ts->next = seq + 1;
+        } else if (seq >= ts->next) {
+            gap_add(ts, ts->next, seq); // se perdió el final de una ráfaga
+            ts->next = seq + 1;
+        }
+        return true;
+    }
+    if (sscanf(buffer, "LOST %127s %llu-%llu", topic, &a, &b) == 3) {
+        TopicState *ts = find_state(st, ntopics, topic);
+        if (!ts) return true;
+        unsigned long long cnt = gap_remove(ts, a, b, NULL);
+        ts->lost += cnt;
+        if (cnt) {
+            printf("[subscriber] '%s': %llu mensaje(s) ya no disponibles en el broker (%llu-%llu)\n",
+                   topic, cnt, a, b);
+        }
+        return true;
+    }
+    return false;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-R [-N ms]] [-k segundos] [-i ip_interfaz] [-o destino | -c] [-F ms] <host> <puerto> <tema1> [<tema2> ...]\n",
+            prog);
+    fprintf(stderr, "     %s [opciones] -C mapa.txt <tema1> [<tema2> ...]\n", prog);
+    fprintf(stderr, "  -R  modo confiable (broker con -R): detecta huecos de secuencia y pide NAK\n");
+    fprintf(stderr, "  -N  espera fija antes del primer NAK (por defecto se adapta al reordenamiento, %d-%d ms)\n",
+            NAK_DELAY_MS, NAK_RETRY_MS);
+    fprintf(stderr, "  -i  interfaz para unirse a los grupos si el broker usa multicast (-m)\n");
+    fprintf(stderr, "  -k  intervalo de renovación de la suscripción (0 = sin latidos; por defecto %d)\n",
+            DEFAULT_HEARTBEAT_S);
+    fprintf(stderr, "  -o  salida con buffer: '-' = stdout, si no un directorio con un archivo <tema>.log por tema\n");
+    fprintf(stderr, "  -c  solo contar mensajes (y latencia si vienen de publisher_udp -r/-n)\n");
+    fprintf(stderr, "  -F  intervalo máximo entre vaciados de la salida con buffer (por defecto %d ms)\n",
+            OUT_DEFAULT_FLUSH_MS);
+    fprintf(stderr, "  -C  mapa del clúster (cluster_map.h): cada tema se pide a su broker dueño\n");
+}
+
+int main(int argc, char **argv) {
+    double heartbeat_s = DEFAULT_HEARTBEAT_S;
+    bool reliable = false;
+    OutMode out_mode = OUT_INTERACTIVE;
+    const char *out_dir = NULL;
+    int flush_ms = OUT_DEFAULT_FLUSH_MS;
+    const char *map_path = NULL;
+    ClusterMap map;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:RN:i:o:cF:C:")) != -1) {
+        switch (opt) {
+        case 'C': map_path = optarg; break;
+        case 'k': heartbeat_s = atof(optarg); break;
+        case 'R': reliable = true; break;
+        case 'N': nak_delay_ms = atoi(optarg); if (nak_delay_ms < 0) nak_delay_ms = 0; break;
+        case 'o':
+            out_mode = strcmp(optarg, "-") == 0 ? OUT_STDOUT : OUT_FILES;
+            out_dir = optarg;
+            break;
+        case 'c': out_mode = OUT_COUNT; break;
+        case 'F': flush_ms = atoi(optarg); break;
+        case 'i':
+            if (inet_pton(AF_INET, optarg, &mcast_if) != 1) {
+                fprintf(stderr, "Interfaz inválida: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    int first_topic = optind + (map_path ? 0 : 2);
+    if (argc - first_topic < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char **topics = &argv[first_topic];
+    int ntopics = argc - first_topic;
+
+    // Crear socket UDP
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // Configurar la dirección del broker de cada tema (sin -C, la misma para todos)
+    struct sockaddr_in *dests = (struct sockaddr_in *)calloc((size_t)ntopics, sizeof(struct sockaddr_in));
+    if (!dests) {
+        perror("calloc");
+        close(sockfd);
+        return 1;
+    }
+    if (map_path) {
+        if (cluster_map_load(&map, map_path) != 0) {
+            close(sockfd);
+            return 1;
+        }
+        for (int i = 0; i < ntopics; i++) dests[i] = cluster_map_owner(&map, topics[i])->addr;
+    } else {
+        dests[0].sin_family = AF_INET;
+        dests[0].sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+        if (inet_pton(AF_INET, argv[optind], &dests[0].sin_addr) <= 0) {
+            perror("inet_pton: Dirección de host inválida");
             close(sockfd);
             return 1;
         }
+        for (int i = 1; i < ntopics; i++) dests[i] = dests[0];
+    }
 
+    // Enviar solicitudes de suscripción para cada tópico recibido por línea de comandos
+    if (send_subscriptions(sockfd, dests, topics, ntopics) < 0) {
+        close(sockfd);
+        return 1;
+    }
+    for (int i = 0; i < ntopics; i++) {
         // Notificamos al usuario que se envió la suscripción a cada tema
-        printf("[subscriber] Solicitud de suscripción enviada para '%s'.\n", argv[i]);
+        if (map_path) {
+            printf("[subscriber] Solicitud de suscripción enviada para '%s' a %s.\n", topics[i],
+                   cluster_map_owner(&map, topics[i])->name);
+        } else {
+            printf("[subscriber] Solicitud de suscripción enviada para '%s'.\n", topics[i]);
+        }
     }
 
     printf("[subscriber] Esperando mensajes... 📡\n");
+    fflush(stdout);
+
+    out_init(&out, out_mode, out_dir, flush_ms);
+    // En modo unicast simple el broker reenvía solo el texto: con un único tema se sabe
+    // a cuál pertenece; con varios, los archivos/contadores usan "mensajes".
+    const char *raw_topic = ntopics == 1 ? topics[0] : "mensajes";
+    struct sigaction sa = {0};
+    sa.sa_handler = on_sigint; // sin SA_RESTART: poll() vuelve con EINTR
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
 
-    // Bucle para recibir mensajes del broker
-    char buffer[MAX_LINE];
-    while (1) {
-        // recvfrom() bloquea hasta que llega un datagrama UDP
-        // - sockfd: socket por el que recibimos
-        // - buffer: lugar donde se almacenará el mensaje
-        // - sizeof(buffer)-1: tamaño máximo de recepción
-        // - 0: flags
-        // - NULL,NULL: no necesitamos saber quién lo envió (el broker siempre es el mismo)
-        ssize_t n_bytes = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0, NULL, NULL);
-        if (n_bytes < 0) {
-            perror("recvfrom");
-            break; // Salir en caso de error
+    long long heartbeat_ms = (long long)(heartbeat_s * 1000.0);
+    long long next_heartbeat = now_ms() + heartbeat_ms;
+
+    TopicState *states = (TopicState *)calloc((size_t)ntopics, sizeof(TopicState));
+    if (!states) {
+        perror("calloc");
+        close(sockfd);
+        return 1;
+    }
+    for (int i = 0; i < ntopics; i++) states[i].name = topics[i];
+
+    // Bucle para recibir mensajes del broker: recvmmsg() trae hasta RX_BATCH datagramas por llamada
+    static char bufs[RX_BATCH][MAX_LINE];
+    struct iovec iov[RX_BATCH];
+    struct mmsghdr mmsgs[RX_BATCH];
+    memset(mmsgs, 0, sizeof(mmsgs));
+    for (int i = 0; i < RX_BATCH; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = MAX_LINE - 1;
+        mmsgs[i].msg_hdr.msg_iov = &iov[i];
+        mmsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (!stop) {
+        // Esperar un datagrama, como máximo hasta el próximo latido o NAK
+        long long due = heartbeat_ms > 0 ? next_heartbeat : 0;
+        for (int i = 0; reliable && i < ntopics; i++) {
+            if (states[i].nak_due && (due == 0 || states[i].nak_due < due)) due = states[i].nak_due;
         }
+        int timeout = -1;
+        if (due > 0) {
+            long long left = due - now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        int out_timeout = out_timeout_ms(&out);
+        if (out_timeout >= 0 && (timeout < 0 || out_timeout < timeout)) timeout = out_timeout;
+        if (map_path && (timeout < 0 || timeout > CLUSTER_RELOAD_MS)) timeout = CLUSTER_RELOAD_MS;
+        struct pollfd pfds[1 + MAX_MCAST_SOCKS];
+        pfds[0].fd = sockfd;
+        pfds[0].events = POLLIN;
+        for (int i = 0; i < nmsocks; i++) {
+            pfds[1 + i].fd = msocks[i].fd;
+            pfds[1 + i].events = POLLIN;
+        }
+        int npfds = 1 + nmsocks;
+        int pr = poll(pfds, (nfds_t)npfds, timeout);
+        if (pr < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (heartbeat_ms > 0 && now_ms() >= next_heartbeat) {
+            // Latido: renueva la concesión (y vuelve a registrar la dirección si cambió por NAT)
+            if (send_subscriptions(sockfd, dests, topics, ntopics) < 0) break;
+            next_heartbeat = now_ms() + heartbeat_ms;
+        }
+        if (map_path && cluster_map_reload(&map)) {
+            // Los temas que cambiaron de dueño se piden ya al broker nuevo; en el anterior
+            // la suscripción vence sola al no recibir más latidos.
+            for (int i = 0; i < ntopics; i++) {
+                const ClusterNode *owner = cluster_map_owner(&map, topics[i]);
+                if (cluster_same_addr(&dests[i], &owner->addr)) continue;
+                dests[i] = owner->addr;
+                if (send_subscriptions(sockfd, &dests[i], &topics[i], 1) < 0) break;
+                printf("[subscriber] Mapa actualizado: '%s' ahora en %s\n", topics[i], owner->name);
+            }
+            fflush(stdout);
+        }
+        for (int i = 0; reliable && i < ntopics; i++) {
+            if (states[i].nak_due && now_ms() >= states[i].nak_due) {
+                send_nak(sockfd, &dests[i], &states[i]);
+            }
+        }
+        out_tick(&out);
+        if (pr <= 0) continue;
+
+        bool failed = false;
+        for (int p = 0; p < npfds; p++) {
+            if (!(pfds[p].revents & POLLIN)) continue;
+            bool from_group = p > 0;
 
-        buffer[n_bytes] = '\0'; // Asegurar terminación null
+            // recvmmsg() lee de una vez todos los datagramas disponibles (hasta RX_BATCH)
+            // - MSG_DONTWAIT: poll() ya avisó que hay datos; no bloquear al vaciar
+            // - no necesitamos saber quién los envió (el broker siempre es el mismo)
+            for (;;) {
+                int got = recvmmsg(pfds[p].fd, mmsgs, RX_BATCH, MSG_DONTWAIT, NULL);
+                if (got < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+                    perror("recvmmsg");
+                    failed = true; // Salir en caso de error
+                    break;
+                }
+                for (int k = 0; k < got; k++) {
+                    char *buffer = bufs[k];
+                    size_t n_bytes = mmsgs[k].msg_len;
+                    buffer[n_bytes] = '\0'; // Asegurar terminación null
 
-        // Imprimir el mensaje recibido
-        // El broker debe incluir el nombre del tema al principio del mensaje
-        printf("🔔 [mensaje] %s\n", buffer);
-        fflush(stdout); // Asegurar que el mensaje se imprima inmediatamente
+                    char topic[128], group[INET_ADDRSTRLEN];
+                    unsigned mport;
+                    int off = 0;
+                    if (!from_group && sscanf(buffer, "MCAST %127s %15s %u", topic, group, &mport) == 3) {
+                        if (find_state(states, ntopics, topic)) join_group(topic, group, mport);
+                        fflush(stdout);
+                        continue;
+                    }
+
+                    if (reliable && handle_reliable(states, ntopics, buffer)) continue;
+
+                    if (from_group) {
+                        // Multicast: el grupo puede ser compartido, se filtra por tema
+                        if (sscanf(buffer, "MSG %127s %n", topic, &off) == 1 && off > 0 &&
+                            find_state(states, ntopics, topic)) {
+                            out_message(&out, "🔔 [mensaje] ", topic, strlen(topic), ": ", buffer + off,
+                                        (size_t)n_bytes - (size_t)off);
+                        }
+                        continue;
+                    }
+
+                    // Mensaje simple: el broker reenvía solo el texto
+                    out_raw(&out, "🔔 [mensaje] ", raw_topic, buffer, n_bytes);
+                }
+                if (got < RX_BATCH) break;
+            }
+            if (failed) break;
+        }
+        out_tick(&out);
+        if (failed) break;
     }
 
+    out_close(&out);
+    if (reliable) {
+        for (int i = 0; i < ntopics; i++) {
+            printf("[subscriber] '%s': %llu recuperado(s) por NAK, %llu fuera de orden, %llu perdido(s)\n",
+                   states[i].name, states[i].recovered, states[i].reordered, states[i].lost);
+        }
+    }
     printf("[subscriber] Terminando.\n");
+    free(states);
+    free(dests);
+    if (map_path) cluster_map_free(&map);
+    for (int i = 0; i < nmsocks; i++) close(msocks[i].fd);
     close(sockfd);
     return 0;
 }
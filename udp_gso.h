@@ -0,0 +1,134 @@
+// udp_gso.h - Ayudas para UDP GSO (UDP_SEGMENT) y GRO (UDP_GRO) en Linux.
+//
+// Es un header "solo cabecera" (funciones static): se incluye desde broker_udp.c
+// y desde los programas QUIC sin cambiar la forma de compilar (un gcc por programa).
+//
+// GSO: en vez de un sendto() por datagrama, se entrega al kernel un super-buffer
+// con varios datagramas del mismo tamaño hacia el mismo destino y el kernel lo
+// corta en segmentos de 'gso_size' bytes (el último puede ser más corto).
+// GRO: el kernel entrega en un solo recvmsg() varios datagramas del mismo flujo
+// pegados; el tamaño de cada segmento llega en un cmsg UDP_GRO.
+//
+// Si el kernel (o la interfaz) no lo soporta, todo cae a un sendto() por datagrama.
+
+#ifndef UDP_GSO_H
+#define UDP_GSO_H
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>    // SOL_UDP, UDP_SEGMENT, UDP_GRO (según la versión de glibc)
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define UDP_GSO_MAX_SEGS 64       // límite del kernel (UDP_MAX_SEGMENTS)
+#define UDP_GSO_MAX_BYTES 65000   // tamaño máximo de un super-buffer (cabe en un datagrama IP)
+
+// Verifica si el kernel acepta UDP_SEGMENT en este socket (no deja nada activado).
+static bool udp_gso_probe(int fd) {
+    int zero = 0;
+    return setsockopt(fd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0;
+}
+
+// Activa la recepción coalescida (GRO). Devuelve false si no está soportada.
+static bool udp_gro_enable(int fd) {
+    int on = 1;
+    return setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+}
+
+// Tamaño de segmento informado por GRO en un msghdr recibido con recvmsg/recvmmsg
+// (msg_control debe tener espacio para el cmsg). 0 si el datagrama no viene coalescido.
+static size_t udp_gro_segment_size(struct msghdr *mh) {
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int seg;
+            memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+            return seg > 0 ? (size_t)seg : 0;
+        }
+    }
+    return 0;
+}
+
+// Envía iov[0..n) como UN super-buffer GSO con segmentos de 'seg' bytes.
+static ssize_t udp_sendmsg_gso(int fd, struct iovec *iov, size_t n, uint16_t seg,
+                               const struct sockaddr *to, socklen_t to_len) {
+    char ctrl[CMSG_SPACE(sizeof(uint16_t))];
+    memset(ctrl, 0, sizeof(ctrl));
+    struct msghdr mh = {0};
+    mh.msg_name = (void *)to;
+    mh.msg_namelen = to_len;
+    mh.msg_iov = iov;
+    mh.msg_iovlen = n;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = sizeof(ctrl);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+    ssize_t r;
+    do {
+        r = sendmsg(fd, &mh, 0);
+    } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+// Envía 'n' datagramas (uno por iovec) al mismo destino.
+// Con *gso == true agrupa tramos consecutivos del mismo tamaño (más, opcionalmente,
+// un último datagrama más corto) en un solo sendmsg con UDP_SEGMENT. Si el kernel
+// rechaza GSO se pone *gso = false y se sigue con un sendto() por datagrama.
+// Devuelve la cantidad de llamadas al sistema realizadas.
+static size_t udp_send_batch(int fd, bool *gso, struct iovec *iov, size_t n,
+                             const struct sockaddr *to, socklen_t to_len) {
+    size_t calls = 0;
+    size_t i = 0;
+    while (i < n) {
+        size_t seg = iov[i].iov_len;
+        size_t j = i, total = 0;
+        if (*gso && seg > 0 && seg <= UINT16_MAX) {
+            while (j < n && j - i < UDP_GSO_MAX_SEGS && iov[j].iov_len == seg &&
+                   total + seg <= UDP_GSO_MAX_BYTES) {
+                total += seg;
+                j++;
+            }
+            // El último segmento de un super-buffer puede ser más corto.
+            if (j < n && j - i < UDP_GSO_MAX_SEGS && iov[j].iov_len > 0 &&
+                iov[j].iov_len < seg && total + iov[j].iov_len <= UDP_GSO_MAX_BYTES) {
+                j++;
+            }
+        } else {
+            j = i + 1;
+        }
+
+        if (j - i > 1) {
+            calls++;
+            if (udp_sendmsg_gso(fd, &iov[i], j - i, (uint16_t)seg, to, to_len) >= 0) {
+                i = j;
+                continue;
+            }
+            if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+                *gso = false; // sin soporte real (p.ej. la interfaz no hace checksum offload)
+            }
+            // se reenvía el tramo con un sendto() por datagrama
+        }
+        for (; i < j; i++) {
+            calls++;
+            sendto(fd, iov[i].iov_base, iov[i].iov_len, 0, to, to_len);
+        }
+    }
+    return calls;
+}
+
+#endif // UDP_GSO_H